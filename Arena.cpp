@@ -0,0 +1,133 @@
+// ***********************************************************
+// Methods for the per-thread scratch arena
+// ***********************************************************
+
+#include "Arena.h"
+#include <cstdlib>
+#include <iostream>
+
+
+// The per-thread state
+
+thread_local TArena *ActiveScratchArena = NULL;
+
+TArena &ThreadArena(void)
+{
+	static thread_local TArena arena;
+	return arena;
+}
+
+static std::atomic<long> ArenaEscapes(0);
+
+long ArenaEscapeCount(void)
+{
+	return ArenaEscapes;
+}
+
+
+// *****************************
+// Constructors and Destructors
+// *****************************
+
+TArena::TArena(void)
+{
+	current = 0;
+	used = 0;
+	depth = 0;
+	live.assign(1, 0);
+}
+
+TArena::~TArena()
+{
+	for (size_t i = 0; i < blocks.size(); i++)
+		free(blocks[i]);
+}
+
+
+// **********
+// Allocation
+// **********
+
+// Return BYTES of storage aligned to ArenaAlignment. Blocks are kept across
+// rewinds, so once an evaluation has run the arena stops touching the heap.
+
+void *TArena::Allocate(size_t bytes)
+{
+	bytes = (bytes + ArenaAlignment - 1) & ~(ArenaAlignment - 1);
+	// Advance through the existing blocks looking for room
+	while (current < (int)blocks.size()) {
+		if (used + bytes <= sizes[current]) {
+			void *p = blocks[current] + used;
+			used += bytes;
+			return p;
+		}
+		current++;
+		used = 0;
+	}
+	// Otherwise add a new block big enough for the request
+	size_t size = (bytes > ArenaBlockSize)?bytes:ArenaBlockSize;
+	void *block = NULL;
+	if (posix_memalign(&block, ArenaAlignment, size) != 0) {
+		cerr << "Error: Out of memory!\n";
+		exit(0);
+	}
+	blocks.push_back((char *)block);
+	sizes.push_back(size);
+	current = blocks.size() - 1;
+	used = bytes;
+	return block;
+}
+
+
+// Return the total number of bytes held by the arena
+
+size_t TArena::Capacity(void)
+{
+	size_t total = 0;
+	for (size_t i = 0; i < sizes.size(); i++)
+		total += sizes[i];
+	return total;
+}
+
+
+// ******
+// Scopes
+// ******
+
+int TArena::OpenScope(void)
+{
+	depth++;
+	if (depth >= (int)live.size()) live.push_back(0);
+	live[depth] = 0;
+	return depth;
+}
+
+// Allocations released after their scope ended make a count negative; only
+// those still alive are counted (once, since the count starts again from 0)
+
+long TArena::CloseScope(void)
+{
+	long escaped = live[depth] > 0 ? live[depth] : 0;
+	live[depth] = 0;
+	depth--;
+	return escaped;
+}
+
+TArenaScope::TArenaScope(void)
+{
+	previous = ActiveScratchArena;
+	arena = &ThreadArena();
+	arena->GetMark(block, offset);
+	arena->OpenScope();
+	ActiveScratchArena = arena;
+}
+
+// Check that nothing allocated in the scope is still alive, then rewind
+
+TArenaScope::~TArenaScope()
+{
+	long escaped = arena->CloseScope();
+	if (escaped > 0) ArenaEscapes += escaped;
+	arena->Rewind(block, offset);
+	ActiveScratchArena = previous;
+}
@@ -0,0 +1,137 @@
+// ***********************************************************
+// A per-thread bump allocator for evaluation scratch memory
+//
+// While a TArenaScope is alive, TVector and TMatrix storage for
+// trivial element types is carved out of the calling thread's
+// arena instead of the global heap. When the scope ends the arena
+// is rewound, so the blocks are reused by the next evaluation and
+// the allocator lock never appears on the evaluation hot path.
+//
+// Anything that must outlive the scope (e.g., a vector stored in
+// a cache shared between evaluations) has to be sized while a
+// TArenaSuspend is alive. To catch vectors that break this rule,
+// each allocation is tagged with the depth of the scope it was
+// made in, and a scope that ends while allocations made in it are
+// still alive counts them as escapes (see ArenaEscapeCount).
+// ***********************************************************
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+#include <type_traits>
+
+using namespace std;
+
+// The size of a regular arena block (larger requests get their own block)
+
+const size_t ArenaBlockSize = 64*1024;
+const size_t ArenaAlignment = 16;
+
+
+// The TArena class declaration
+
+class TArena {
+	public:
+		// The constructor
+		TArena(void);
+		// The destructor
+		~TArena();
+		// Allocation
+		void *Allocate(size_t bytes);
+		// Marks
+		void GetMark(int &block, size_t &offset) {block = current; offset = used;};
+		void Rewind(int block, size_t offset) {current = block; used = offset;};
+		void Reset(void) {Rewind(0,0);};
+		// Scopes: the depth of the innermost open scope (1 for the outermost)
+		int Depth(void) {return depth;};
+		int OpenScope(void);
+		// Close the innermost scope, returning the number of allocations made
+		// in it that are still alive
+		long CloseScope(void);
+		// Count an allocation made in the innermost scope, returning its depth,
+		// and the release of one made at DEPTH
+		int CountAllocation(void) {live[depth]++; return depth;};
+		void CountRelease(int d) {if (d < (int)live.size()) live[d]--;};
+		// Statistics
+		size_t Capacity(void);
+
+	private:
+		std::vector<char *> blocks;
+		std::vector<size_t> sizes;
+		int current;
+		size_t used;
+		int depth;
+		std::vector<long> live;       // The live allocations made at each depth
+};
+
+
+// The arena that scratch allocations on this thread are currently served from
+// (NULL when no TArenaScope is active)
+
+extern thread_local TArena *ActiveScratchArena;
+
+// The arena owned by the calling thread
+
+TArena &ThreadArena(void);
+
+
+// The number of arena allocations, on any thread, that were still alive when
+// the scope they were made in ended. Their storage may be reused by the next
+// scope, so anything but 0 is a bug.
+
+long ArenaEscapeCount(void);
+
+
+// Activate the calling thread's arena for the lifetime of the scope and
+// rewind it to its entry state on exit. Scopes may be nested.
+
+class TArenaScope {
+	public:
+		TArenaScope(void);
+		~TArenaScope();
+
+	private:
+		TArena *previous;
+		TArena *arena;
+		int block;
+		size_t offset;
+};
+
+
+// Temporarily route scratch allocations back to the global heap
+
+class TArenaSuspend {
+	public:
+		TArenaSuspend(void) {previous = ActiveScratchArena; ActiveScratchArena = NULL;};
+		~TArenaSuspend() {ActiveScratchArena = previous;};
+
+	private:
+		TArena *previous;
+};
+
+
+// Allocate and free element storage for TVector and TMatrix. Only trivial
+// element types are placed in the arena, since arena storage is never
+// constructed or destroyed element by element. FROMARENA is 0 for heap
+// storage and otherwise the depth of the scope the storage was taken in.
+
+template<class EltType>
+inline EltType *ScratchAllocate(int len, int &fromarena)
+{
+	TArena *arena = ActiveScratchArena;
+	if (arena != NULL && is_trivial<EltType>::value) {
+		fromarena = arena->CountAllocation();
+		return (EltType *)arena->Allocate(len * sizeof(EltType));
+	}
+	fromarena = 0;
+	return new EltType[len];
+}
+
+template<class EltType>
+inline void ScratchFree(EltType *p, int fromarena)
+{
+	if (!fromarena) delete [] p;
+	else ThreadArena().CountRelease(fromarena);
+}
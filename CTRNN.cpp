@@ -21,29 +21,37 @@
 
 // A fast sigmoid implementation using a table w/ linear interpolation
 #ifdef FAST_SIGMOID
-int SigTableInitFlag = 0;
-double SigTab[SigTabSize];
-
-void InitSigmoidTable(void)
+TSigmoidTable::TSigmoidTable(void)
 {
-  if (!SigTableInitFlag) {
-    double DeltaX = SigTabRange/(SigTabSize-1);
-    for (int i = 0; i <= SigTabSize-1; i++)
-      SigTab[i] = sigma(i * DeltaX);
-    SigTableInitFlag = 1;
+  for (int i = 0; i <= SigTabSize; i++) {
+    d[i] = sigma(i/SigTabScale - SigTabRange);
+    f[i] = (float)d[i];
   }
+  // Guard entries so that x == SigTabRange can read d[i+1]
+  d[SigTabSize+1] = d[SigTabSize];
+  f[SigTabSize+1] = f[SigTabSize];
 }
 
-double fastsigmoid(double x)
+// Apply the fast sigmoid to a batch of values (looking the table up once)
+
+void FastSigmoidBatch(const double *x, double *y, int n)
 {
-  if (x >= SigTabRange) return 1.0;
-  if (x < 0) return 1.0 - fastsigmoid(-x);
-  double id;
-  double frac = modf(x*(SigTabSize-1)/SigTabRange, &id);
-  int i = (int)id;
-  double y1 = SigTab[i], y2 = SigTab[i+1];
- 
-  return y1 + (y2 - y1) * frac;
+  const double *tab = SigmoidTable().d;
+  for (int i = 0; i < n; i++)
+    y[i] = fastsigmoid(x[i], tab);
+}
+
+// Measure the maximum absolute error of the fast sigmoid against sigma on a
+// grid much finer than the table (covering the saturated tails as well)
+
+double FastSigmoidMaxError(void)
+{
+  double maxerr = 0.0;
+  for (double x = -2*SigTabRange; x <= 2*SigTabRange; x += 1.0/(64*SigTabScale)) {
+    double err = fabs(fastsigmoid(x) - sigma(x));
+    if (err > maxerr) maxerr = err;
+  }
+  return maxerr;
 }
 #endif
 
@@ -53,18 +61,18 @@ double fastsigmoid(double x)
 
 // The constructor
 
-CTRNN::CTRNN(int newsize)
+template<class Real>
+TCTRNN<Real>::TCTRNN(int newsize)
 {
+	integrator = EULER;
 	SetCircuitSize(newsize);
-#ifdef FAST_SIGMOID
-  InitSigmoidTable();
-#endif
 }
 
 
 // The destructor
 
-CTRNN::~CTRNN()
+template<class Real>
+TCTRNN<Real>::~TCTRNN()
 {
 	SetCircuitSize(0);
 }
@@ -76,7 +84,8 @@ CTRNN::~CTRNN()
 
 // Resize a circuit.
 
-void CTRNN::SetCircuitSize(int newsize)
+template<class Real>
+void TCTRNN<Real>::SetCircuitSize(int newsize)
 {
 	size = newsize;
 	states.SetBounds(1,size);
@@ -101,6 +110,8 @@ void CTRNN::SetCircuitSize(int newsize)
 	k2.SetBounds(1,size);
 	k3.SetBounds(1,size);
 	k4.SetBounds(1,size);
+	Decays.SetBounds(1,size);
+	DecayStepSize = 0;
 }
 
 
@@ -110,25 +121,29 @@ void CTRNN::SetCircuitSize(int newsize)
 
 // Randomize the states or outputs of a circuit.
 
-void CTRNN::RandomizeCircuitState(double lb, double ub)
+template<class Real>
+void TCTRNN<Real>::RandomizeCircuitState(Real lb, Real ub)
 {
 	for (int i = 1; i <= size; i++)
         SetNeuronState(i, UniformRandom(lb, ub));
 }
 
-void CTRNN::RandomizeCircuitState(double lb, double ub, RandomState &rs)
+template<class Real>
+void TCTRNN<Real>::RandomizeCircuitState(Real lb, Real ub, RandomState &rs)
 {
 	for (int i = 1; i <= size; i++)
     SetNeuronState(i, rs.UniformRandom(lb, ub));
 }
 
-void CTRNN::RandomizeCircuitOutput(double lb, double ub)
+template<class Real>
+void TCTRNN<Real>::RandomizeCircuitOutput(Real lb, Real ub)
 {
 	for (int i = 1; i <= size; i++)
         SetNeuronOutput(i, UniformRandom(lb, ub));
 }
 
-void CTRNN::RandomizeCircuitOutput(double lb, double ub, RandomState &rs)
+template<class Real>
+void TCTRNN<Real>::RandomizeCircuitOutput(Real lb, Real ub, RandomState &rs)
 {
 	for (int i = 1; i <= size; i++)
     SetNeuronOutput(i, rs.UniformRandom(lb, ub));
@@ -138,11 +153,12 @@ void CTRNN::RandomizeCircuitOutput(double lb, double ub, RandomState &rs)
 
 // Integrate a circuit one step using Euler integration.
 
-void CTRNN::EulerStep(double stepsize)
+template<class Real>
+void TCTRNN<Real>::EulerStep(Real stepsize)
 {
   // Update the state of all neurons.
   for (int i = 1; i <= size; i++) {
-    double input = externalinputs[i];
+    Real input = externalinputs[i];
     for (int j = 1; j <= size; j++) 
       input += weights[j][i] * outputs[j];
     states[i] += stepsize * Rtaus[i] * (input - states[i]);
@@ -153,12 +169,39 @@ void CTRNN::EulerStep(double stepsize)
 }
 
 
+// Integrate a circuit one step using exponential Euler integration. Over a step
+// the synaptic and external input I is held fixed, so the leaky dynamics
+// tau*dy/dt = -y + I are solved exactly: y' = I + (y - I)*exp(-stepsize/tau).
+// The decay factors are cached until the step size or a time constant changes.
+
+template<class Real>
+void TCTRNN<Real>::ExponentialEulerStep(Real stepsize)
+{
+  if (stepsize != DecayStepSize) {
+    for (int i = 1; i <= size; i++)
+      Decays[i] = exp(-stepsize * Rtaus[i]);
+    DecayStepSize = stepsize;
+  }
+  // Update the state of all neurons.
+  for (int i = 1; i <= size; i++) {
+    Real input = externalinputs[i];
+    for (int j = 1; j <= size; j++)
+      input += weights[j][i] * outputs[j];
+    states[i] = input + (states[i] - input) * Decays[i];
+  }
+  // Update the outputs of all neurons.
+  for (int i = 1; i <= size; i++)
+    outputs[i] = sigmoid(gains[i] * (states[i] + biases[i]));
+}
+
+
 // Integrate a circuit one step using 4th-order Runge-Kutta.
 
-void CTRNN::RK4Step(double stepsize)
+template<class Real>
+void TCTRNN<Real>::RK4Step(Real stepsize)
 {
 	int i,j;
-	double input;
+	Real input;
 	
 	// The first step.
 	for (i = 1; i <= size; i++) {
@@ -206,9 +249,10 @@ void CTRNN::RK4Step(double stepsize)
 
 // Set the biases of the CTRNN to their center-crossing values
 
-void CTRNN::SetCenterCrossing(void)
+template<class Real>
+void TCTRNN<Real>::SetCenterCrossing(void)
 {
-    double InputWeights, ThetaStar;
+    Real InputWeights, ThetaStar;
     
     for (int i = 1; i <= CircuitSize(); i++) {
         // Sum the input weights to this neuron
@@ -228,7 +272,8 @@ void CTRNN::SetCenterCrossing(void)
 
 #include <iomanip>
 
-ostream& operator<<(ostream& os, CTRNN& c)
+template<class Real>
+ostream& operator<<(ostream& os, TCTRNN<Real>& c)
 {
 	// Set the precision
 	os << setprecision(32);
@@ -256,7 +301,8 @@ ostream& operator<<(ostream& os, CTRNN& c)
 	return os;
 }
 
-istream& operator>>(istream& is, CTRNN& c)
+template<class Real>
+istream& operator>>(istream& is, TCTRNN<Real>& c)
 {
 	// Read the size
 	int size;
@@ -267,6 +313,7 @@ istream& operator>>(istream& is, CTRNN& c)
 		is >> c.taus[i];
 		c.Rtaus[i] = 1/c.taus[i];
 	}
+	c.DecayStepSize = 0;
 	// Read the biases
 	for (int i = 1; i <= size; i++)
 		is >> c.biases[i];
@@ -279,5 +326,16 @@ istream& operator>>(istream& is, CTRNN& c)
 			is >> c.weights[i][j];
 	// Return the istream		
 	return is;
-}		
-		
+}
+
+
+// ***********************
+// Explicit instantiations
+// ***********************
+
+template class TCTRNN<double>;
+template class TCTRNN<float>;
+template ostream& operator<<(ostream& os, TCTRNN<double>& c);
+template ostream& operator<<(ostream& os, TCTRNN<float>& c);
+template istream& operator>>(istream& is, TCTRNN<double>& c);
+template istream& operator>>(istream& is, TCTRNN<float>& c);
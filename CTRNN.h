@@ -7,31 +7,83 @@
 //  1/08 Added table-based fast sigmoid w/ linear interpolation
 // ************************************************************
 
-// Uncomment the following line for table-based fast sigmoid w/ linear interpolation
-//#define FAST_SIGMOID
+// Comment out the following line to use the exact sigmoid everywhere instead of
+// the table-based fast sigmoid w/ linear interpolation (max abs error ~3e-6)
+#define FAST_SIGMOID
 
 #include "VectorMatrix.h"
 #include "random.h"
 #include <iostream>
 #include <math.h>
+#include <cmath>
 
 #pragma once
 
 
 // The sigmoid function
 
+inline double sigma(double x) 
+{
+  return 1/(1 + exp(-x));
+}
+
+inline float sigma(float x)
+{
+  return 1/(1 + expf(-x));
+}
+
 #ifdef FAST_SIGMOID
-const int SigTabSize = 400;
-const double SigTabRange = 15.0;
+// The table spans [-SigTabRange, SigTabRange] in SigTabSize intervals. It is
+// built by the first call to SigmoidTable (a function-local static, so the
+// construction is thread-safe and complete before any lookup, including
+// lookups made during the static initialization of other translation units).
+const int SigTabSize = 2048;
+const double SigTabRange = 16.0;
+const double SigTabScale = SigTabSize/(2*SigTabRange);
+
+struct TSigmoidTable {
+  double d[SigTabSize+2];
+  float f[SigTabSize+2];
+  TSigmoidTable(void);
+};
 
-double fastsigmoid(double x);
-#endif
+inline const TSigmoidTable &SigmoidTable(void)
+{
+  static const TSigmoidTable table;
+  return table;
+}
 
-inline double sigma(double x) 
+// Branch-free lookup in TAB: the input is clamped into the table range
+// (min/max), so every call takes the same path and batches of calls vectorize.
+inline double fastsigmoid(double x, const double *tab)
 {
-  return 1/(1 + exp(-x));
+  x = (x < -SigTabRange) ? -SigTabRange : x;
+  x = (x > SigTabRange) ? SigTabRange : x;
+  double u = (x + SigTabRange) * SigTabScale;
+  int i = (int)u;
+  double frac = u - i;
+  double y1 = tab[i];
+  return y1 + (tab[i+1] - y1) * frac;
 }
 
+inline float fastsigmoid(float x, const float *tab)
+{
+  x = (x < -(float)SigTabRange) ? -(float)SigTabRange : x;
+  x = (x > (float)SigTabRange) ? (float)SigTabRange : x;
+  float u = (x + (float)SigTabRange) * (float)SigTabScale;
+  int i = (int)u;
+  float frac = u - i;
+  float y1 = tab[i];
+  return y1 + (tab[i+1] - y1) * frac;
+}
+
+inline double fastsigmoid(double x) {return fastsigmoid(x, SigmoidTable().d);}
+inline float fastsigmoid(float x) {return fastsigmoid(x, SigmoidTable().f);}
+
+void FastSigmoidBatch(const double *x, double *y, int n);
+double FastSigmoidMaxError(void);
+#endif
+
 inline double sigmoid(double x)
 {
 #ifndef FAST_SIGMOID
@@ -41,6 +93,15 @@ inline double sigmoid(double x)
 #endif
 }
 
+inline float sigmoid(float x)
+{
+#ifndef FAST_SIGMOID
+  return sigma(x);
+#else
+  return fastsigmoid(x);
+#endif
+}
+
 
 // The inverse sigmoid function
 
@@ -49,38 +110,57 @@ inline double InverseSigmoid(double y)
   return log(y/(1-y));
 }
 
+inline float InverseSigmoid(float y)
+{
+  return logf(y/(1-y));
+}
+
+
+// Supported integration methods. EXPONENTIAL_EULER treats the leaky term
+// exactly (using exp(-stepsize/tau) per neuron) and holds the synaptic input
+// constant over the step, which stays stable and accurate at step sizes well
+// beyond the range of forward Euler.
+
+enum TIntegrator {EULER, EXPONENTIAL_EULER, RUNGE_KUTTA4};
+
 
-// The CTRNN class declaration
+// The CTRNN class declaration. The circuit is templated on the scalar type of
+// its state and parameters; CTRNN is the double-precision circuit.
 
-class CTRNN {
+template<class Real> class TCTRNN;
+template<class Real> ostream& operator<<(ostream& os, TCTRNN<Real>& c);
+template<class Real> istream& operator>>(istream& is, TCTRNN<Real>& c);
+
+template<class Real>
+class TCTRNN {
     public:
         // The constructor
-        CTRNN(int newsize = 0);
+        TCTRNN(int newsize = 0);
         // The destructor
-        ~CTRNN();
+        ~TCTRNN();
         
         // Accessors
         int CircuitSize(void) {return size;};
         void SetCircuitSize(int newsize);
-        double NeuronState(int i) {return states[i];};
-        double &NeuronStateReference(int i) {return states[i];};
-        void SetNeuronState(int i, double value) 
+        Real NeuronState(int i) {return states[i];};
+        Real &NeuronStateReference(int i) {return states[i];};
+        void SetNeuronState(int i, Real value) 
             {states[i] = value;outputs[i] = sigmoid(gains[i]*(states[i] + biases[i]));};
-        double NeuronOutput(int i) {return outputs[i];};
-        double &NeuronOutputReference(int i) {return outputs[i];};
-        void SetNeuronOutput(int i, double value) 
+        Real NeuronOutput(int i) {return outputs[i];};
+        Real &NeuronOutputReference(int i) {return outputs[i];};
+        void SetNeuronOutput(int i, Real value) 
             {outputs[i] = value; states[i] = InverseSigmoid(value)/gains[i] - biases[i];};
-        double NeuronBias(int i) {return biases[i];};
-        void SetNeuronBias(int i, double value) {biases[i] = value;};
-        double NeuronGain(int i) {return gains[i];};
-        void SetNeuronGain(int i, double value) {gains[i] = value;};
-        double NeuronTimeConstant(int i) {return taus[i];};
-        void SetNeuronTimeConstant(int i, double value) {taus[i] = value;Rtaus[i] = 1/value;};
-        double NeuronExternalInput(int i) {return externalinputs[i];};
-        double &NeuronExternalInputReference(int i) {return externalinputs[i];};
-        void SetNeuronExternalInput(int i, double value) {externalinputs[i] = value;};
-        double ConnectionWeight(int from, int to) {return weights[from][to];};
-        void SetConnectionWeight(int from, int to, double value) {weights[from][to] = value;};
+        Real NeuronBias(int i) {return biases[i];};
+        void SetNeuronBias(int i, Real value) {biases[i] = value;};
+        Real NeuronGain(int i) {return gains[i];};
+        void SetNeuronGain(int i, Real value) {gains[i] = value;};
+        Real NeuronTimeConstant(int i) {return taus[i];};
+        void SetNeuronTimeConstant(int i, Real value) {taus[i] = value;Rtaus[i] = 1/value;DecayStepSize = 0;};
+        Real NeuronExternalInput(int i) {return externalinputs[i];};
+        Real &NeuronExternalInputReference(int i) {return externalinputs[i];};
+        void SetNeuronExternalInput(int i, Real value) {externalinputs[i] = value;};
+        Real ConnectionWeight(int from, int to) {return weights[from][to];};
+        void SetConnectionWeight(int from, int to, Real value) {weights[from][to] = value;};
         void LesionNeuron(int n) 
         {
             for (int i = 1; i<= size; i++) {
@@ -89,22 +169,37 @@ class CTRNN {
             }
         }
         void SetCenterCrossing(void);
+        TIntegrator Integrator(void) {return integrator;};
+        void SetIntegrator(TIntegrator newintegrator) {integrator = newintegrator;};
 
         // Input and output
-        friend ostream& operator<<(ostream& os, CTRNN& c);
-        friend istream& operator>>(istream& is, CTRNN& c);
+        friend ostream& operator<< <Real>(ostream& os, TCTRNN<Real>& c);
+        friend istream& operator>> <Real>(istream& is, TCTRNN<Real>& c);
                             
         // Control
-        void RandomizeCircuitState(double lb, double ub);
-        void RandomizeCircuitState(double lb, double ub, RandomState &rs);
-        void RandomizeCircuitOutput(double lb, double ub);
-        void RandomizeCircuitOutput(double lb, double ub, RandomState &rs);
-        void EulerStep(double stepsize);
-        void RK4Step(double stepsize);
+        void RandomizeCircuitState(Real lb, Real ub);
+        void RandomizeCircuitState(Real lb, Real ub, RandomState &rs);
+        void RandomizeCircuitOutput(Real lb, Real ub);
+        void RandomizeCircuitOutput(Real lb, Real ub, RandomState &rs);
+        void EulerStep(Real stepsize);
+        void ExponentialEulerStep(Real stepsize);
+        void RK4Step(Real stepsize);
+        void Step(Real stepsize)
+        {
+            switch (integrator) {
+                case EULER: EulerStep(stepsize); break;
+                case EXPONENTIAL_EULER: ExponentialEulerStep(stepsize); break;
+                case RUNGE_KUTTA4: RK4Step(stepsize); break;
+            }
+        }
 		
         int size;
-        TVector<double> states, outputs, biases, gains, taus, Rtaus, externalinputs;
-        TMatrix<double> weights;
-        TVector<double> TempStates,TempOutputs,k1,k2,k3,k4;
+        TIntegrator integrator;
+        TVector<Real> states, outputs, biases, gains, taus, Rtaus, externalinputs;
+        TMatrix<Real> weights;
+        TVector<Real> TempStates,TempOutputs,k1,k2,k3,k4;
+        TVector<Real> Decays;
+        Real DecayStepSize;
 };
 
+typedef TCTRNN<double> CTRNN;
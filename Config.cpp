@@ -0,0 +1,173 @@
+// ***********************************************************
+// Methods for the experiment configuration
+// ***********************************************************
+
+#include "Config.h"
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+
+
+// Remove leading and trailing white space
+
+static string Trim(const string &s)
+{
+	size_t first = s.find_first_not_of(" \t\r\n");
+	if (first == string::npos) return "";
+	size_t last = s.find_last_not_of(" \t\r\n");
+	return s.substr(first, last - first + 1);
+}
+
+
+// ********
+// Settings
+// ********
+
+int TConfig::ReadFile(const string &path)
+{
+	ifstream ifs(path.c_str());
+	if (!ifs) return 0;
+	Read(ifs, path);
+	return 1;
+}
+
+void TConfig::Read(istream &is, const string &name)
+{
+	string line, section;
+	for (int lineno = 1; getline(is, line); lineno++) {
+		size_t comment = line.find_first_of(";#");
+		if (comment != string::npos) line.erase(comment);
+		line = Trim(line);
+		if (line.empty()) continue;
+		if (line[0] == '[') {
+			if (line[line.size() - 1] != ']') {
+				cerr << "Error: " << name << ":" << lineno << ": Malformed section header\n";
+				exit(0);
+			}
+			section = Trim(line.substr(1, line.size() - 2));
+			continue;
+		}
+		size_t eq = line.find('=');
+		if (eq == string::npos || Trim(line.substr(0, eq)).empty()) {
+			cerr << "Error: " << name << ":" << lineno << ": Expected key = value\n";
+			exit(0);
+		}
+		string key = Trim(line.substr(0, eq));
+		Set(section.empty() ? key : section + "." + key, Trim(line.substr(eq + 1)));
+	}
+}
+
+void TConfig::MarkDefaults(void)
+{
+	for (map<string, string>::iterator it = values.begin(); it != values.end(); ++it)
+		defaults.insert(it->first);
+}
+
+void TConfig::Set(const string &key, const string &value)
+{
+	values[key] = value;
+	defaults.erase(key);
+}
+
+int TConfig::SetAssignment(const string &text)
+{
+	size_t eq = text.find('=');
+	if (eq == string::npos || eq == 0) return 0;
+	Set(Trim(text.substr(0, eq)), Trim(text.substr(eq + 1)));
+	return 1;
+}
+
+
+// *******
+// Lookups
+// *******
+
+string TConfig::String(const string &key, const string &def)
+{
+	map<string, string>::iterator it = values.find(key);
+	string value = (it == values.end()) ? def : it->second;
+	used[key] = value;
+	return value;
+}
+
+long TConfig::Integer(const string &key, long def)
+{
+	if (!Has(key)) {used[key] = to_string(def); return def;}
+	string text = String(key, "");
+	char *end;
+	long value = strtol(text.c_str(), &end, 10);
+	if (text.empty() || *end != '\0') {
+		cerr << "Error: " << key << " = " << text << " is not an integer\n";
+		exit(0);
+	}
+	return value;
+}
+
+double TConfig::Real(const string &key, double def)
+{
+	if (!Has(key)) {
+		ostringstream text;
+		text.precision(17);
+		text << def;
+		used[key] = text.str();
+		return def;
+	}
+	string text = String(key, "");
+	char *end;
+	double value = strtod(text.c_str(), &end);
+	if (text.empty() || *end != '\0') {
+		cerr << "Error: " << key << " = " << text << " is not a number\n";
+		exit(0);
+	}
+	return value;
+}
+
+int TConfig::Flag(const string &key, int def)
+{
+	string text = String(key, def ? "true" : "false");
+	if (text == "1" || text == "true" || text == "yes" || text == "on") return 1;
+	if (text == "0" || text == "false" || text == "no" || text == "off") return 0;
+	cerr << "Error: " << key << " = " << text << " is not a flag (true or false)\n";
+	exit(0);
+}
+
+vector<string> TConfig::List(const string &key)
+{
+	istringstream text(String(key, ""));
+	vector<string> items;
+	string item;
+	while (text >> item) items.push_back(item);
+	return items;
+}
+
+
+// ******
+// Output
+// ******
+
+// Keys without a section come first; the map keeps each section's keys together
+
+void TConfig::WriteEffective(ostream &os)
+{
+	map<string, string>::iterator it;
+	for (it = used.begin(); it != used.end(); ++it)
+		if (it->first.find('.') == string::npos)
+			os << it->first << " = " << it->second << "\n";
+	string section = "";
+	for (it = used.begin(); it != used.end(); ++it) {
+		size_t dot = it->first.rfind('.');
+		if (dot == string::npos) continue;
+		if (it->first.substr(0, dot) != section) {
+			section = it->first.substr(0, dot);
+			os << "\n[" << section << "]\n";
+		}
+		os << it->first.substr(dot + 1) << " = " << it->second << "\n";
+	}
+}
+
+void TConfig::WarnUnused(void)
+{
+	for (map<string, string>::iterator it = values.begin(); it != values.end(); ++it)
+		if (used.count(it->first) == 0 && defaults.count(it->first) == 0)
+			cerr << "Warning: The setting " << it->first << " was not used" << endl;
+}
@@ -0,0 +1,63 @@
+// ***********************************************************
+// Experiment configuration
+//
+// A configuration is a set of "section.key = value" settings,
+// read from INI files:
+//
+//   [search]
+//   popsize = 500     ; comments start with ; or #
+//
+// and overridden from the command line with assignments such
+// as search.popsize=100. Every value read is recorded, so the
+// configuration an experiment actually ran with can be written
+// next to its results, and settings that nothing read (usually
+// misspelled keys) can be reported.
+// ***********************************************************
+
+#pragma once
+
+#include <iostream>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+
+// The TConfig class declaration
+
+class TConfig {
+	public:
+		// Read the settings in the INI file PATH, replacing earlier values of
+		// the same keys. Returns 0 if the file cannot be opened.
+		int ReadFile(const string &path);
+		// Read INI text from IS (NAME identifies it in error messages)
+		void Read(istream &is, const string &name);
+		// Treat the settings read so far as defaults, which are not reported
+		// as unused unless they are set again
+		void MarkDefaults(void);
+		// Set KEY (section.key) to VALUE
+		void Set(const string &key, const string &value);
+		// Apply an assignment "section.key=value". Returns 0 if TEXT is not one.
+		int SetAssignment(const string &text);
+		int Has(const string &key) {return values.count(key) > 0;};
+		// Typed lookups, returning DEFAULT for missing keys
+		string String(const string &key, const string &def);
+		long Integer(const string &key, long def);
+		double Real(const string &key, double def);
+		int Flag(const string &key, int def);
+		// A whitespace-separated list (empty if the key is missing)
+		vector<string> List(const string &key);
+		// Write every setting that was looked up, with the value used, as an INI file
+		void WriteEffective(ostream &os);
+		// The settings looked up so far, with the values used
+		const map<string, string> &Used(void) {return used;};
+		// Warn about settings that were never looked up
+		void WarnUnused(void);
+
+	private:
+		map<string, string> values;
+		map<string, string> used;
+		set<string> defaults;
+};
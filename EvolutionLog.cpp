@@ -0,0 +1,87 @@
+// ***********************************************************
+// Methods for the evolution log
+// ***********************************************************
+
+#include "EvolutionLog.h"
+
+
+// The column names, in the order Append writes them
+
+static const char *EvolutionLogHeader =
+	"# generation best average variance min max q25 median q75"
+	" evaluations cachehits evaltime reprotime checkpointtime screened surrogatecorr"
+	" lowevals fidelitycorr\n";
+
+thread_local TEvolutionLog *ActiveEvolutionLog = NULL;
+
+
+// *****************************
+// Constructors and Destructors
+// *****************************
+
+TEvolutionLog::TEvolutionLog(void)
+{
+	file = NULL;
+	flushInterval = 0;
+	pendingRecords = 0;
+	bufferSize = 1 << 16;
+	cacheHits = 0;
+}
+
+TEvolutionLog::~TEvolutionLog()
+{
+	Close();
+}
+
+
+// ********
+// The file
+// ********
+
+int TEvolutionLog::Open(const string &path, int append)
+{
+	Close();
+	file = fopen(path.c_str(), append ? "a" : "w");
+	if (file == NULL) return 0;
+	// A new file (or an empty one being appended to) starts with the header
+	fseek(file, 0, SEEK_END);
+	if (ftell(file) == 0) buffer += EvolutionLogHeader;
+	return 1;
+}
+
+void TEvolutionLog::Close(void)
+{
+	if (file == NULL) return;
+	Flush();
+	fclose(file);
+	file = NULL;
+}
+
+
+// *******
+// Records
+// *******
+
+void TEvolutionLog::Append(const TGenerationRecord &r)
+{
+	char line[512];
+	int n = snprintf(line, sizeof(line),
+		"%d %.10g %.10g %.10g %.10g %.10g %.10g %.10g %.10g %ld %ld %.6g %.6g %.6g %ld %.4g %ld %.4g\n",
+		r.Generation, r.BestPerf, r.AvgPerf, r.PerfVar,
+		r.MinPerf, r.MaxPerf, r.LowerQuartile, r.Median, r.UpperQuartile,
+		r.Evaluations, r.CacheHits, r.EvaluationTime, r.ReproductionTime, r.CheckpointTime,
+		r.Screened, r.SurrogateCorrelation, r.LowFidelityEvaluations, r.FidelityCorrelation);
+	buffer.append(line, n);
+	pendingRecords++;
+	if ((flushInterval > 0 && pendingRecords >= flushInterval) || buffer.size() >= bufferSize)
+		Flush();
+}
+
+void TEvolutionLog::Flush(void)
+{
+	if (file == NULL) return;
+	if (!buffer.empty()) fwrite(buffer.data(), 1, buffer.size(), file);
+	fflush(file);
+	buffer.clear();
+	pendingRecords = 0;
+}
@@ -0,0 +1,89 @@
+// ***********************************************************
+// A buffered per-generation log of an evolutionary search
+//
+// Each generation is one line of whitespace-separated columns
+// under a "#" header naming them. The first four columns are
+// generation, best, average and variance, as in the old
+// evol*.dat files. Lines collect in memory and are written
+// only on Flush, when the buffer fills, or every FlushInterval
+// generations, so the search loop never waits on the disk.
+// ***********************************************************
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <string>
+
+using namespace std;
+
+
+// Wall-clock time in seconds
+
+inline double WallClock(void)
+{
+	return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+// The statistics of one generation
+
+struct TGenerationRecord {
+	int Generation;
+	double BestPerf, AvgPerf, PerfVar;
+	double MinPerf, MaxPerf, LowerQuartile, Median, UpperQuartile;
+	long Evaluations, CacheHits;
+	double EvaluationTime, ReproductionTime, CheckpointTime;   // In seconds
+	long Screened;                 // Candidates rejected by the surrogate
+	double SurrogateCorrelation;   // Between its predictions and the evaluations
+	long LowFidelityEvaluations;
+	double FidelityCorrelation;    // Between low- and full-fidelity performance
+};
+
+
+// The TEvolutionLog class declaration
+
+class TEvolutionLog {
+	public:
+		// The constructor
+		TEvolutionLog(void);
+		// The destructor (flushes and closes the file)
+		~TEvolutionLog();
+		// Open PATH, appending to an existing log if APPEND is set. Returns 0 on failure.
+		int Open(const string &path, int append = 0);
+		void Close(void);
+		int IsOpen(void) {return file != NULL;};
+		// Flushing control: write every INTERVAL generations (0 leaves it to
+		// explicit flushes) or whenever BYTES of records are waiting
+		int FlushInterval(void) {return flushInterval;};
+		void SetFlushInterval(int interval) {flushInterval = interval;};
+		size_t BufferSize(void) {return bufferSize;};
+		void SetBufferSize(size_t bytes) {bufferSize = bytes;};
+		// Add the record of a generation
+		void Append(const TGenerationRecord &r);
+		// Write all waiting records to the file
+		void Flush(void);
+		// Cache hits are counted from the evaluation threads and collected once per generation
+		void CountCacheHits(long n) {cacheHits += n;};
+		long TakeCacheHits(void) {return cacheHits.exchange(0);};
+
+	private:
+		FILE *file;
+		string buffer;
+		int flushInterval, pendingRecords;
+		size_t bufferSize;
+		atomic<long> cacheHits;
+};
+
+
+// The log of the search whose evaluation is running on this thread (NULL when
+// none is). Fitness functions count their cache hits in it with
+// CountEvaluationCacheHits, which does nothing outside a search.
+
+extern thread_local TEvolutionLog *ActiveEvolutionLog;
+
+inline void CountEvaluationCacheHits(long n)
+{
+	if (ActiveEvolutionLog != NULL && n > 0) ActiveEvolutionLog->CountCacheHits(n);
+}
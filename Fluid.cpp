@@ -7,17 +7,17 @@
 
 
 
-Fluid::Fluid(float dt, float diffusion, float viscosity)
-    : size(spaceN), dt(dt), diff(diffusion), visc(viscosity),
-      s(spaceN * spaceN, 0), odor(spaceN * spaceN, 0),
-      Vx(spaceN * spaceN, 0), Vy(spaceN * spaceN, 0),
-      Vx0(spaceN * spaceN, 0), Vy0(spaceN * spaceN, 0) {}
+Fluid::Fluid(float dt, float diffusion, float viscosity, int size)
+    : size(size), dt(dt), diff(diffusion), visc(viscosity),
+      s(size * size, 0), odor(size * size, 0),
+      Vx(size * size, 0), Vy(size * size, 0),
+      Vx0(size * size, 0), Vy0(size * size, 0) {}
 
 
 
 void Fluid::saveodor(std::ofstream& file) {
-    for (int j = 0; j < spaceN; j++) {
-        for (int i = 0; i < spaceN; i++) {
+    for (int j = 0; j < size; j++) {
+        for (int i = 0; i < size; i++) {
             file << odor[IX(i, j)] << " ";
         }
         file << "\n";
@@ -27,7 +27,7 @@ void Fluid::saveodor(std::ofstream& file) {
 
 float Fluid::getOdorConcentration(float x, float y) {
     // Check bounds and return -1.0f if out of range
-    if (x < 0.0f || x > static_cast<float>(spaceN) || y < 0.0f || y > static_cast<float>(spaceN)) {
+    if (x < 0.0f || x > static_cast<float>(size) || y < 0.0f || y > static_cast<float>(size)) {
         std::cerr << "Coordinates out of bounds!" << std::endl;
         return -1.0f;
     }
@@ -41,7 +41,7 @@ float Fluid::getOdorConcentration(float x, float y) {
     float y_frac = y - static_cast<float>(y_int);
 
     // Check bounds for top-right corner of the interpolation square
-    if (x_int >= spaceN - 1 || y_int >= spaceN - 1) {
+    if (x_int >= size - 1 || y_int >= size - 1) {
         return odor[IX(x_int, y_int)]; // Return the value at the bottom-left corner
     }
 
@@ -57,27 +57,27 @@ float Fluid::getOdorConcentration(float x, float y) {
 }
 
 void Fluid::set_bnd(int b, std::vector<float>& x) {
-    for (int i = 1; i < spaceN - 1; i++) {
+    for (int i = 1; i < size - 1; i++) {
         x[IX(i, 0)] = (b == 2) ? -x[IX(i, 1)] : x[IX(i, 1)];
-        x[IX(i, spaceN - 1)] = (b == 2) ? -x[IX(i, spaceN - 2)] : x[IX(i, spaceN - 2)];
+        x[IX(i, size - 1)] = (b == 2) ? -x[IX(i, size - 2)] : x[IX(i, size - 2)];
     }
 
-    for (int j = 1; j < spaceN - 1; j++) {
+    for (int j = 1; j < size - 1; j++) {
         x[IX(0, j)] = (b == 1) ? -x[IX(1, j)] : x[IX(1, j)];
-        x[IX(spaceN - 1, j)] = (b == 1) ? -x[IX(spaceN - 2, j)] : x[IX(spaceN - 2, j)];
+        x[IX(size - 1, j)] = (b == 1) ? -x[IX(size - 2, j)] : x[IX(size - 2, j)];
     }
 
     x[IX(0, 0)] = 0.5 * (x[IX(1, 0)] + x[IX(0, 1)]);
-    x[IX(0, spaceN - 1)] = 0.5 * (x[IX(1, spaceN - 1)] + x[IX(0, spaceN - 2)]);
-    x[IX(spaceN - 1, 0)] = 0.5 * (x[IX(spaceN - 2, 0)] + x[IX(spaceN - 1, 1)]);
-    x[IX(spaceN - 1, spaceN - 1)] = 0.5 * (x[IX(spaceN - 2, spaceN - 1)] + x[IX(spaceN - 1, spaceN - 2)]);
+    x[IX(0, size - 1)] = 0.5 * (x[IX(1, size - 1)] + x[IX(0, size - 2)]);
+    x[IX(size - 1, 0)] = 0.5 * (x[IX(size - 2, 0)] + x[IX(size - 1, 1)]);
+    x[IX(size - 1, size - 1)] = 0.5 * (x[IX(size - 2, size - 1)] + x[IX(size - 1, size - 2)]);
 }
 
 void Fluid::lin_solve(int b, std::vector<float>& x, std::vector<float>& x0, float a, float c) {
     float cRecip = 1.0 / c;
     for (int k = 0; k < iter; k++) {
-        for (int j = 1; j < spaceN - 1; j++) {
-            for (int i = 1; i < spaceN - 1; i++) {
+        for (int j = 1; j < size - 1; j++) {
+            for (int i = 1; i < size - 1; i++) {
                 x[IX(i, j)] =
                     (x0[IX(i, j)] +
                      a * (x[IX(i + 1, j)] + x[IX(i - 1, j)] +
@@ -90,16 +90,16 @@ void Fluid::lin_solve(int b, std::vector<float>& x, std::vector<float>& x0, floa
 }
 
 void Fluid::diffuse(int b, std::vector<float>& x, std::vector<float>& x0, float diff, float dt) {
-    float a = dt * diff * (spaceN - 2) * (spaceN - 2);
+    float a = dt * diff * (size - 2) * (size - 2);
     lin_solve(b, x, x0, a, 1 + 6 * a);
 }
 
 
 void Fluid::project(std::vector<float>& velocX, std::vector<float>& velocY, std::vector<float>& p, std::vector<float>& div) {
-    for (int j = 1; j < spaceN - 1; j++) {
-        for (int i = 1; i < spaceN - 1; i++) {
+    for (int j = 1; j < size - 1; j++) {
+        for (int i = 1; i < size - 1; i++) {
             div[IX(i, j)] = (-0.5 * (velocX[IX(i + 1, j)] - velocX[IX(i - 1, j)] +
-                                     velocY[IX(i, j + 1)] - velocY[IX(i, j - 1)])) / spaceN;
+                                     velocY[IX(i, j + 1)] - velocY[IX(i, j - 1)])) / size;
             p[IX(i, j)] = 0;
         }
     }
@@ -108,10 +108,10 @@ void Fluid::project(std::vector<float>& velocX, std::vector<float>& velocY, std:
     set_bnd(0, p);
     lin_solve(0, p, div, 1, 6);
 
-    for (int j = 1; j < spaceN - 1; j++) {
-        for (int i = 1; i < spaceN - 1; i++) {
-            velocX[IX(i, j)] -= 0.5 * (p[IX(i + 1, j)] - p[IX(i - 1, j)]) * spaceN;
-            velocY[IX(i, j)] -= 0.5 * (p[IX(i, j + 1)] - p[IX(i, j - 1)]) * spaceN;
+    for (int j = 1; j < size - 1; j++) {
+        for (int i = 1; i < size - 1; i++) {
+            velocX[IX(i, j)] -= 0.5 * (p[IX(i + 1, j)] - p[IX(i - 1, j)]) * size;
+            velocY[IX(i, j)] -= 0.5 * (p[IX(i, j + 1)] - p[IX(i, j - 1)]) * size;
         }
     }
 
@@ -123,26 +123,26 @@ void Fluid::project(std::vector<float>& velocX, std::vector<float>& velocY, std:
 void Fluid::advect(int b, std::vector<float>& d, std::vector<float>& d0, std::vector<float>& velocX, std::vector<float>& velocY, float dt) {
     float i0, i1, j0, j1;
 
-    float dtx = dt * (spaceN - 2);
-    float dty = dt * (spaceN - 2);
+    float dtx = dt * (size - 2);
+    float dty = dt * (size - 2);
 
     float s0, s1, t0, t1;
     float tmp1, tmp2, x, y;
 
-    for (int j = 1; j < spaceN - 1; j++) {
-        for (int i = 1; i < spaceN - 1; i++) {
+    for (int j = 1; j < size - 1; j++) {
+        for (int i = 1; i < size - 1; i++) {
             tmp1 = dtx * velocX[IX(i, j)];
             tmp2 = dty * velocY[IX(i, j)];
             x = i - tmp1;
             y = j - tmp2;
 
             if (x < 0.5) x = 0.5;
-            if (x > spaceN + 0.5) x = spaceN + 0.5;
+            if (x > size + 0.5) x = size + 0.5;
             i0 = floor(x);
             i1 = i0 + 1.0;
 
             if (y < 0.5) y = 0.5;
-            if (y > spaceN + 0.5) y = spaceN + 0.5;
+            if (y > size + 0.5) y = size + 0.5;
             j0 = floor(y);
             j1 = j0 + 1.0;
 
@@ -7,16 +7,9 @@
 #include <iostream>
 #include <fstream>
 
-const int spaceN = 100;
+const int spaceN = 100;  // The default number of grid cells along each side
 const int iter = 16;
 
-inline int IX(int x, int y) {
-    return x + y * spaceN;
-}
-
-
-
-
 class Fluid {
 public:
     int size;
@@ -30,7 +23,7 @@ public:
     std::vector<float> Vx0;
     std::vector<float> Vy0;
 
-    Fluid(float dt, float diffusion, float viscosity);
+    Fluid(float dt, float diffusion, float viscosity, int size = spaceN);
 
     void step();
     void addOdor(int x, int y, float amount);
@@ -38,9 +31,12 @@ public:
     float getOdorConcentration(float x, float y);
     void saveodor(std::ofstream& file);
 
+    // The index of cell (x, y)
+    int IX(int x, int y) const {
+        return x + y * size;
+    }
 
-
-private:
+    // The solver kernels called by step (public so that they can be benchmarked)
     void set_bnd(int b, std::vector<float>& x);
     void lin_solve(int b, std::vector<float>& x, std::vector<float>& x0, float a, float c);
     void diffuse(int b, std::vector<float>& x, std::vector<float>& x0, float diff, float dt);
@@ -0,0 +1,319 @@
+// ***********************************************************
+// Methods for the limit set analysis
+// ***********************************************************
+
+#include "LimitSet.h"
+#include "ThreadPool.h"
+#include "random.h"
+#include <cmath>
+
+
+// A copy of the parameters of SOURCE, integrated with INTEGRATOR
+
+static void CopyCircuit(TCTRNN<double> &source, TCTRNN<double> &c, TIntegrator integrator)
+{
+	int n = source.CircuitSize();
+	c.SetCircuitSize(n);
+	for (int i = 1; i <= n; i++) {
+		c.SetNeuronTimeConstant(i, source.NeuronTimeConstant(i));
+		c.SetNeuronBias(i, source.NeuronBias(i));
+		c.SetNeuronGain(i, source.NeuronGain(i));
+		for (int j = 1; j <= n; j++)
+			c.SetConnectionWeight(i, j, source.ConnectionWeight(i, j));
+	}
+	c.SetIntegrator(integrator);
+}
+
+static double MaxDistance(const double *a, const double *b, int n)
+{
+	double d = 0.0;
+	for (int i = 0; i < n; i++) d = fmax(d, fabs(a[i] - b[i]));
+	return d;
+}
+
+
+// *****************
+// Equilibria
+// *****************
+
+// The residual G(y) = -y + W'sigma(g(y + theta)) + I of the equilibrium
+// equations and its Jacobian J[i][k] = -delta(i,k) + w(k,i) g(k) s(k)(1 - s(k))
+// (row-major, 0-based)
+
+static void Residual(TCTRNN<double> &c, const vector<double> &inputs, const vector<double> &y,
+                     vector<double> &g, vector<double> *J)
+{
+	int n = c.CircuitSize();
+	vector<double> s(n), ds(n);
+	for (int k = 0; k < n; k++) {
+		s[k] = sigma(c.NeuronGain(k+1) * (y[k] + c.NeuronBias(k+1)));
+		ds[k] = c.NeuronGain(k+1) * s[k] * (1 - s[k]);
+	}
+	for (int i = 0; i < n; i++) {
+		double sum = inputs[i] - y[i];
+		for (int k = 0; k < n; k++) {
+			sum += c.ConnectionWeight(k+1, i+1) * s[k];
+			if (J != NULL) (*J)[i*n + k] = c.ConnectionWeight(k+1, i+1) * ds[k] - (i == k ? 1.0 : 0.0);
+		}
+		g[i] = sum;
+	}
+}
+
+// Solve A x = B (A is n x n, row-major) by Gaussian elimination with partial
+// pivoting, overwriting B with x. Returns 0 if A is singular.
+
+static int Solve(vector<double> &A, vector<double> &b, int n)
+{
+	for (int col = 0; col < n; col++) {
+		int pivot = col;
+		for (int r = col + 1; r < n; r++)
+			if (fabs(A[r*n + col]) > fabs(A[pivot*n + col])) pivot = r;
+		if (fabs(A[pivot*n + col]) < 1e-300) return 0;
+		if (pivot != col) {
+			for (int k = 0; k < n; k++) swap(A[col*n + k], A[pivot*n + k]);
+			swap(b[col], b[pivot]);
+		}
+		for (int r = col + 1; r < n; r++) {
+			double f = A[r*n + col] / A[col*n + col];
+			for (int k = col; k < n; k++) A[r*n + k] -= f * A[col*n + k];
+			b[r] -= f * b[col];
+		}
+	}
+	for (int r = n - 1; r >= 0; r--) {
+		for (int k = r + 1; k < n; k++) b[r] -= A[r*n + k] * b[k];
+		b[r] /= A[r*n + r];
+	}
+	return 1;
+}
+
+// Newton's method from Y. Returns 1 (with the equilibrium in Y) if it converged.
+
+static int Newton(TCTRNN<double> &c, const vector<double> &inputs, vector<double> &y, const TLimitSetSettings &s)
+{
+	int n = c.CircuitSize();
+	vector<double> g(n), J(n*n);
+	for (int it = 0; it <= s.newtonIterations; it++) {
+		Residual(c, inputs, y, g, &J);
+		double residual = 0.0;
+		for (int i = 0; i < n; i++) residual = fmax(residual, fabs(g[i]));
+		if (residual < s.newtonTolerance) return 1;
+		if (it == s.newtonIterations || !Solve(J, g, n)) return 0;
+		for (int i = 0; i < n; i++) y[i] -= g[i];
+	}
+	return 0;
+}
+
+// An equilibrium is stable if every eigenvalue of the Jacobian of the flow,
+// diag(1/tau) J, has negative real part. The largest real part is the growth
+// rate of a generic perturbation under the linearized flow, which is
+// integrated with RK4 (renormalizing each step) over the window.
+
+static int Stable(TCTRNN<double> &c, const vector<double> &inputs, const vector<double> &y,
+                  const TLimitSetSettings &s, RandomState &rs)
+{
+	int n = c.CircuitSize();
+	vector<double> g(n), J(n*n);
+	Residual(c, inputs, y, g, &J);
+	for (int i = 0; i < n; i++)
+		for (int k = 0; k < n; k++) J[i*n + k] /= c.NeuronTimeConstant(i+1);
+
+	vector<double> d(n), k1(n), k2(n), k3(n), k4(n), t(n);
+	double norm = 0.0;
+	for (int i = 0; i < n; i++) {d[i] = rs.UniformRandom(-1, 1); norm += d[i] * d[i];}
+	norm = sqrt(norm);
+	for (int i = 0; i < n; i++) d[i] /= norm;
+
+	double h = s.stepSize, growth = 0.0;
+	int steps = (int)ceil(s.window / h);
+	for (int step = 0; step < steps; step++) {
+		vector<double> *stage[4] = {&k1, &k2, &k3, &k4};
+		const double scale[4] = {0.0, 0.5, 0.5, 1.0};
+		for (int q = 0; q < 4; q++) {
+			for (int i = 0; i < n; i++) t[i] = d[i] + (q > 0 ? scale[q] * h * (*stage[q-1])[i] : 0.0);
+			for (int i = 0; i < n; i++) {
+				double sum = 0.0;
+				for (int k = 0; k < n; k++) sum += J[i*n + k] * t[k];
+				(*stage[q])[i] = sum;
+			}
+		}
+		norm = 0.0;
+		for (int i = 0; i < n; i++) {
+			d[i] += h / 6 * (k1[i] + 2 * k2[i] + 2 * k3[i] + k4[i]);
+			norm += d[i] * d[i];
+		}
+		norm = sqrt(norm);
+		if (norm == 0.0) return 1;
+		growth += log(norm);
+		for (int i = 0; i < n; i++) d[i] /= norm;
+	}
+	return growth < 0.0;
+}
+
+
+// *****************
+// Attractors
+// *****************
+
+void AnalyseLimitSet(TCTRNN<double> &circuit, const vector<double> &inputs,
+                     const TLimitSetSettings &s, int condition, TLimitSetResult &result)
+{
+	int n = circuit.CircuitSize();
+	TCTRNN<double> c;
+	CopyCircuit(circuit, c, s.integrator);
+	for (int i = 1; i <= n; i++) {
+		c.SetNeuronExternalInput(i, inputs[i-1]);
+		c.SetNeuronState(i, 0.0);
+	}
+	RandomState rs(s.seed + condition);
+	result.inputs = inputs;
+
+	// Integrate past the transient, then keep the trajectory over the window
+	for (int step = (int)ceil(s.transient / s.stepSize); step > 0; step--) c.Step(s.stepSize);
+	int steps = (int)ceil(s.window / s.stepSize);
+	vector<double> trajectory((size_t)(steps + 1) * n);
+	result.minOutput.assign(n, 1.0);
+	result.maxOutput.assign(n, 0.0);
+	vector<double> minState(n, HUGE_VAL), maxState(n, -HUGE_VAL);
+	for (int step = 0; step <= steps; step++) {
+		if (step > 0) c.Step(s.stepSize);
+		for (int i = 0; i < n; i++) {
+			double y = c.NeuronState(i+1), o = c.NeuronOutput(i+1);
+			trajectory[(size_t)step * n + i] = y;
+			minState[i] = fmin(minState[i], y);
+			maxState[i] = fmax(maxState[i], y);
+			result.minOutput[i] = fmin(result.minOutput[i], o);
+			result.maxOutput[i] = fmax(result.maxOutput[i], o);
+		}
+	}
+	int widest = 0;
+	for (int i = 1; i < n; i++)
+		if (maxState[i] - minState[i] > maxState[widest] - minState[widest]) widest = i;
+	double range = n > 0 ? maxState[widest] - minState[widest] : 0.0;
+
+	result.period = 0.0;
+	result.state.assign(trajectory.end() - n, trajectory.end());
+	if (range < s.tolerance) result.kind = ATTRACTOR_FIXED_POINT;
+	else {
+		// Find the upward crossings of the widest neuron through the middle of
+		// its range; the cycle closes at the first crossing that returns to
+		// the state of the first one
+		result.kind = ATTRACTOR_UNRESOLVED;
+		double level = 0.5 * (minState[widest] + maxState[widest]);
+		vector<double> first(n), crossing(n);
+		double firstTime = -1.0;
+		for (int step = 1; step <= steps; step++) {
+			const double *a = &trajectory[(size_t)(step - 1) * n], *b = &trajectory[(size_t)step * n];
+			if (!(a[widest] < level && b[widest] >= level)) continue;
+			double frac = (level - a[widest]) / (b[widest] - a[widest]);
+			for (int i = 0; i < n; i++) crossing[i] = a[i] + frac * (b[i] - a[i]);
+			double time = (step - 1 + frac) * s.stepSize;
+			if (firstTime < 0.0) {
+				first = crossing;
+				firstTime = time;
+			}
+			else if (MaxDistance(&first[0], &crossing[0], n) < s.cycleTolerance * range) {
+				result.kind = ATTRACTOR_LIMIT_CYCLE;
+				result.period = time - firstTime;
+				result.state = first;
+				break;
+			}
+		}
+	}
+
+	// Newton's method from the attractor and from random states in the box
+	// |y(i)| <= |I(i)| + sum |w(j,i)|, which holds every equilibrium
+	vector<double> bound(n);
+	for (int i = 0; i < n; i++) {
+		bound[i] = fabs(inputs[i]);
+		for (int j = 1; j <= n; j++) bound[i] += fabs(circuit.ConnectionWeight(j, i+1));
+	}
+	result.equilibria.clear();
+	for (int start = 0; start <= s.newtonStarts; start++) {
+		vector<double> y(n);
+		for (int i = 0; i < n; i++)
+			y[i] = (start == 0) ? result.state[i] : rs.UniformRandom(-bound[i], bound[i]);
+		if (!Newton(c, inputs, y, s)) continue;
+		int known = 0;
+		for (size_t e = 0; e < result.equilibria.size() && !known; e++) {
+			double scale = 1.0;
+			for (int i = 0; i < n; i++) scale = fmax(scale, fabs(y[i]));
+			known = MaxDistance(&y[0], &result.equilibria[e].state[0], n) < 1e-6 * scale;
+		}
+		if (known) continue;
+		TEquilibrium eq;
+		eq.state = y;
+		eq.stable = Stable(c, inputs, y, s, rs);
+		result.equilibria.push_back(eq);
+	}
+}
+
+// The conditions of a parallel analysis
+
+struct TLimitSetBatch {
+	TCTRNN<double> *circuit;
+	const vector< vector<double> > *inputs;
+	const TLimitSetSettings *settings;
+	vector<TLimitSetResult> *results;
+};
+
+static void LimitSetTask(int k, void *arg)
+{
+	TLimitSetBatch *b = (TLimitSetBatch *)arg;
+	AnalyseLimitSet(*b->circuit, (*b->inputs)[k], *b->settings, k, (*b->results)[k]);
+}
+
+void AnalyseLimitSets(TCTRNN<double> &circuit, const vector< vector<double> > &inputs,
+                      const TLimitSetSettings &settings, vector<TLimitSetResult> &results)
+{
+	results.assign(inputs.size(), TLimitSetResult());
+	TLimitSetBatch batch = {&circuit, &inputs, &settings, &results};
+	SharedThreadPool().ParallelFor(0, (int)inputs.size() - 1, LimitSetTask, &batch);
+}
+
+
+// *****************
+// Tables
+// *****************
+
+static void WriteLabels(ostream &os, const vector< vector<double> > &columns, size_t k)
+{
+	for (size_t c = 0; c < columns[k].size(); c++) os << columns[k][c] << " ";
+}
+
+void WriteLimitSetTable(ostream &os, const vector<TLimitSetResult> &results,
+                        const string &labels, const vector< vector<double> > &columns)
+{
+	int n = results.empty() ? 0 : results[0].state.size();
+	os << "# kind: 0 fixed point, 1 limit cycle, 2 unresolved; amplitude: the largest output range\n";
+	os << "# " << labels << " kind period amplitude equilibria stable";
+	for (int i = 1; i <= n; i++) os << " y" << i;
+	os << "\n";
+	for (size_t k = 0; k < results.size(); k++) {
+		const TLimitSetResult &r = results[k];
+		double amplitude = 0.0;
+		for (int i = 0; i < n; i++) amplitude = fmax(amplitude, r.maxOutput[i] - r.minOutput[i]);
+		int stable = 0;
+		for (size_t e = 0; e < r.equilibria.size(); e++) stable += r.equilibria[e].stable;
+		WriteLabels(os, columns, k);
+		os << r.kind << " " << r.period << " " << amplitude << " " << r.equilibria.size() << " " << stable;
+		for (int i = 0; i < n; i++) os << " " << r.state[i];
+		os << "\n";
+	}
+}
+
+void WriteEquilibriumTable(ostream &os, const vector<TLimitSetResult> &results,
+                           const string &labels, const vector< vector<double> > &columns)
+{
+	int n = results.empty() ? 0 : results[0].state.size();
+	os << "# " << labels << " stable";
+	for (int i = 1; i <= n; i++) os << " y" << i;
+	os << "\n";
+	for (size_t k = 0; k < results.size(); k++)
+		for (size_t e = 0; e < results[k].equilibria.size(); e++) {
+			const TEquilibrium &eq = results[k].equilibria[e];
+			WriteLabels(os, columns, k);
+			os << eq.stable;
+			for (int i = 0; i < n; i++) os << " " << eq.state[i];
+			os << "\n";
+		}
+}
@@ -0,0 +1,80 @@
+// ***********************************************************
+// The attractors of a CTRNN with clamped inputs
+//
+// For each input condition (a set of external inputs held
+// constant), the circuit is integrated past a transient and the
+// attractor it has reached is classified: a fixed point, a limit
+// cycle (with its period and the range of each output on it) or
+// unresolved (nothing repeated within the window examined). The
+// equilibria of the condition are also found directly, by
+// Newton's method with the analytic Jacobian from several
+// starting states, and classified as stable or unstable. The
+// conditions are analysed in parallel on the shared thread pool.
+// ***********************************************************
+
+#pragma once
+
+#include "CTRNN.h"
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// The kinds of attractor
+
+enum TAttractorKind {ATTRACTOR_FIXED_POINT, ATTRACTOR_LIMIT_CYCLE, ATTRACTOR_UNRESOLVED};
+
+// How the attractors are found
+
+struct TLimitSetSettings {
+	TIntegrator integrator;
+	double stepSize;
+	double transient;         // The time integrated before the attractor is examined
+	double window;            // The time over which it is examined
+	double tolerance;         // The largest state range of a fixed point
+	double cycleTolerance;    // The largest distance between two passes of a cycle through
+	                          // its section (relative to the largest state range)
+	int newtonStarts;         // The starting states of Newton's method (besides the attractor)
+	int newtonIterations;
+	double newtonTolerance;   // On the largest residual of the equilibrium equations
+	long seed;                // For the initial and starting states
+
+	TLimitSetSettings(void) : integrator(RUNGE_KUTTA4), stepSize(0.01), transient(500), window(200),
+		tolerance(1e-4), cycleTolerance(1e-3), newtonStarts(20), newtonIterations(50), newtonTolerance(1e-10), seed(0) {}
+};
+
+// An equilibrium found by Newton's method
+
+struct TEquilibrium {
+	vector<double> state;
+	int stable;               // Whether all eigenvalues of the Jacobian have negative real part
+};
+
+// The analysis of one input condition
+
+struct TLimitSetResult {
+	vector<double> inputs;
+	TAttractorKind kind;
+	double period;                        // Of a limit cycle (0 otherwise)
+	vector<double> state;                 // The fixed point, or where the cycle crosses its section
+	vector<double> minOutput, maxOutput;  // The range of each output on the attractor
+	vector<TEquilibrium> equilibria;      // The distinct equilibria found
+};
+
+// Analyse CIRCUIT (its parameters; its state is not used) under each of the
+// input vectors in INPUTS (one input per neuron), in parallel
+void AnalyseLimitSets(TCTRNN<double> &circuit, const vector< vector<double> > &inputs,
+                      const TLimitSetSettings &settings, vector<TLimitSetResult> &results);
+
+// Analyse a single input condition (CONDITION numbers its random states)
+void AnalyseLimitSet(TCTRNN<double> &circuit, const vector<double> &inputs,
+                     const TLimitSetSettings &settings, int condition, TLimitSetResult &result);
+
+// Write RESULTS as a table of attractors and a table of equilibria, with one
+// line per condition and per equilibrium. LABELS names the leading columns
+// that describe each condition, whose values are in COLUMNS.
+void WriteLimitSetTable(ostream &os, const vector<TLimitSetResult> &results,
+                        const string &labels, const vector< vector<double> > &columns);
+void WriteEquilibriumTable(ostream &os, const vector<TLimitSetResult> &results,
+                           const string &labels, const vector< vector<double> > &columns);
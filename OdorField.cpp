@@ -0,0 +1,89 @@
+// ***********************************************************
+// Methods for the odor fields
+// ***********************************************************
+
+#include "OdorField.h"
+#include <iostream>
+#include <cstdlib>
+
+
+// Adapter for the adaptive integrator
+
+double OdorFieldConcentration(double x, double y, void *env)
+{
+	return ((OdorField *)env)->Concentration(x, y);
+}
+
+
+// ****************
+// RasterOdorField
+// ****************
+
+RasterOdorField::RasterOdorField(int nx, int ny, double width, double height)
+{
+	if (nx < 2 || ny < 2) {
+		cerr << "Error: A raster odor field needs at least 2x2 nodes\n";
+		exit(0);
+	}
+	columns = nx;
+	rows = ny;
+	cellX = width / (nx - 1);
+	cellY = height / (ny - 1);
+	invCellX = 1.0 / cellX;
+	invCellY = 1.0 / cellY;
+	values.assign(nx * ny, 0.0);
+}
+
+RasterOdorField::RasterOdorField(const OdorField &source, int nx, int ny, double width, double height)
+	: RasterOdorField(nx, ny, width, height)
+{
+	Sample(source);
+}
+
+// Tabulate SOURCE at the grid nodes
+
+void RasterOdorField::Sample(const OdorField &source)
+{
+	for (int j = 0; j < rows; j++)
+		for (int i = 0; i < columns; i++)
+			values[j * columns + i] = source.Concentration(i * cellX, j * cellY);
+}
+
+double RasterOdorField::MaxError(const OdorField &source, int samples) const
+{
+	double maxerr = 0.0;
+	for (int j = 0; j < (rows - 1) * samples; j++)
+		for (int i = 0; i < (columns - 1) * samples; i++) {
+			double x = (i + 0.5) * cellX / samples, y = (j + 0.5) * cellY / samples;
+			double err = fabs(Concentration(x, y) - source.Concentration(x, y));
+			if (err > maxerr) maxerr = err;
+		}
+	return maxerr;
+}
+
+
+// ***************
+// FluidOdorField
+// ***************
+
+FluidOdorField::FluidOdorField(Fluid &f, int sourcex, int sourcey, float amount, double width, double height)
+	: fluid(f)
+{
+	sourceX = sourcex;
+	sourceY = sourcey;
+	emission = amount;
+	scaleX = (fluid.size - 1) / width;
+	scaleY = (fluid.size - 1) / height;
+	fluidTime = 0.0;
+}
+
+// Emit and step the fluid until it has caught up with TIME
+
+void FluidOdorField::Advance(double time)
+{
+	while (fluidTime + fluid.dt <= time) {
+		fluid.addOdor(sourceX, sourceY, emission);
+		fluid.step();
+		fluidTime += fluid.dt;
+	}
+}
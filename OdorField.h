@@ -0,0 +1,124 @@
+// ***********************************************************
+// Odor fields sampled by the agent's sensors
+//
+// OdorField is the common interface. Fitness code takes the
+// field type as a template parameter, so calls through the
+// final classes below are resolved at compile time and the
+// lookups inline into the trial loop.
+// ***********************************************************
+
+#pragma once
+
+#include "Fluid.h"
+#include <cmath>
+#include <vector>
+
+using namespace std;
+
+
+// The OdorField interface
+
+class OdorField {
+	public:
+		virtual ~OdorField() {};
+		// The concentration at (x, y)
+		virtual double Concentration(double x, double y) const = 0;
+		// Advance a time-varying field to TIME (static fields ignore this)
+		virtual void Advance(double /*time*/) {};
+};
+
+// Adapter for the adaptive integrator (ENV points to an OdorField)
+
+double OdorFieldConcentration(double x, double y, void *env);
+
+
+// The linear gradient of DistanceGradient: 1 - steepness * (distance to the
+// peak) / (diagonal of the space), with the normalization folded into one factor
+
+class AnalyticOdorField final : public OdorField {
+	public:
+		AnalyticOdorField(double peakx = 50.0, double peaky = 50.0, double steepness = 1.5,
+		                  double width = 100.0, double height = 100.0)
+			{maxDistance = sqrt(width * width + height * height); SetPeak(peakx, peaky, steepness);};
+		void SetPeak(double peakx, double peaky, double steepness)
+			{peakX = peakx; peakY = peaky; scale = steepness / maxDistance;};
+		double Concentration(double x, double y) const override
+			{double dx = x - peakX, dy = y - peakY; return 1.0 - sqrt(dx * dx + dy * dy) * scale;};
+		void Advance(double /*time*/) override {};
+
+		double peakX, peakY;
+
+	private:
+		double maxDistance, scale;
+};
+
+
+// A field tabulated on a regular grid covering [0,width] x [0,height] and
+// read back by bilinear interpolation. Points outside the grid take the
+// value at the nearest edge.
+
+class RasterOdorField final : public OdorField {
+	public:
+		RasterOdorField(int nx, int ny, double width = 100.0, double height = 100.0);
+		RasterOdorField(const OdorField &source, int nx, int ny, double width = 100.0, double height = 100.0);
+
+		void Sample(const OdorField &source);
+		double &Value(int i, int j) {return values[j * columns + i];};
+		double Concentration(double x, double y) const override;
+		void Advance(double /*time*/) override {};
+		// The largest interpolation error against SOURCE at points between the nodes
+		double MaxError(const OdorField &source, int samples = 4) const;
+
+	private:
+		int columns, rows;
+		double cellX, cellY, invCellX, invCellY;
+		vector<double> values;
+};
+
+inline double RasterOdorField::Concentration(double x, double y) const
+{
+	double gx = x * invCellX, gy = y * invCellY;
+	if (gx < 0.0) gx = 0.0;
+	if (gx > columns - 1) gx = columns - 1;
+	if (gy < 0.0) gy = 0.0;
+	if (gy > rows - 1) gy = rows - 1;
+	int i = (int)gx, j = (int)gy;
+	if (i > columns - 2) i = columns - 2;
+	if (j > rows - 2) j = rows - 2;
+	double fx = gx - i, fy = gy - j;
+	const double *p = &values[j * columns + i];
+	double b = p[0] + fx * (p[1] - p[0]);
+	double t = p[columns] + fx * (p[columns + 1] - p[columns]);
+	return b + fy * (t - b);
+}
+
+
+// The odor of a Fluid simulation. Odor is emitted at the source cell and
+// the fluid is stepped by its own dt as the trial time advances.
+
+class FluidOdorField final : public OdorField {
+	public:
+		FluidOdorField(Fluid &fluid, int sourcex, int sourcey, float emission,
+		               double width = 100.0, double height = 100.0);
+
+		double Concentration(double x, double y) const override;
+		void Advance(double time) override;
+
+	private:
+		Fluid &fluid;
+		int sourceX, sourceY;
+		float emission;
+		double scaleX, scaleY, fluidTime;
+};
+
+inline double FluidOdorField::Concentration(double x, double y) const
+{
+	// Keep the sensors inside the grid, where Fluid interpolates
+	float fx = (float)(x * scaleX), fy = (float)(y * scaleY);
+	const float hi = (float)(fluid.size - 1);
+	if (fx < 0.0f) fx = 0.0f;
+	if (fx > hi) fx = hi;
+	if (fy < 0.0f) fy = 0.0f;
+	if (fy > hi) fy = hi;
+	return fluid.getOdorConcentration(fx, fy);
+}
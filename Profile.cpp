@@ -0,0 +1,281 @@
+// ***********************************************************
+// Methods for the search profiler
+// ***********************************************************
+
+#include "Profile.h"
+
+#ifdef PROFILE_SEARCH
+
+#include <iostream>
+#include <cstring>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+static const char *PhaseNames[PROFILE_PHASES] =
+	{"eval", "sort", "select", "vary", "stats", "io"};
+static const char *CounterNames[ProfileCounters] =
+	{"cycles", "instructions", "misses"};
+
+TProfiler &SearchProfiler(void)
+{
+	static TProfiler profiler;
+	return profiler;
+}
+
+
+// ****************
+// Hardware counters
+// ****************
+
+// Each thread opens its own counter group the first time it reads it
+// (-1 if that failed, -2 if it has not tried yet)
+
+static thread_local int CounterGroup = -2;
+
+static int OpenCounter(unsigned int type, unsigned long long config, int group)
+{
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_GROUP;
+	return (int)syscall(__NR_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+static int OpenCounterGroup(void)
+{
+	int leader = OpenCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, -1);
+	if (leader < 0) return -1;
+	if (OpenCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, leader) < 0 ||
+	    OpenCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, leader) < 0) {
+		close(leader);
+		return -1;
+	}
+	ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+	ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	return leader;
+}
+
+void TProfiler::ReadCounters(TProfileCounts &counts)
+{
+	if (hardware && CounterGroup == -2) CounterGroup = OpenCounterGroup();
+	if (!hardware || CounterGroup < 0) {
+		for (int k = 0; k < ProfileCounters; k++) counts.value[k] = 0;
+		return;
+	}
+	unsigned long long buf[1 + ProfileCounters];
+	if (read(CounterGroup, buf, sizeof(buf)) != (ssize_t)sizeof(buf)) buf[1] = buf[2] = buf[3] = 0;
+	for (int k = 0; k < ProfileCounters; k++) counts.value[k] = (long long)buf[k + 1];
+}
+
+int TProfiler::SetHardwareCounters(int flag)
+{
+	if (flag) {
+		if (CounterGroup == -2) CounterGroup = OpenCounterGroup();
+		if (CounterGroup < 0) {
+			cerr << "Warning: Hardware counters are not available (see /proc/sys/kernel/perf_event_paranoid)\n";
+			flag = 0;
+		}
+	}
+	hardware = flag;
+	return flag;
+}
+
+
+// *****************************
+// Constructors and Destructors
+// *****************************
+
+TProfiler::TProfiler(void)
+{
+	file = NULL;
+	hardware = 0;
+	slotsUsed = 0;
+	for (int p = 0; p < PROFILE_PHASES; p++) {
+		phaseTime[p] = totalPhaseTime[p] = 0;
+		for (int k = 0; k < ProfileCounters; k++) phaseCounts[p][k] = 0;
+	}
+	for (int t = 0; t < MaxProfileThreads; t++) {
+		slots[t].busy = slots[t].tasks = 0;
+		slots[t].totalBusy = slots[t].totalTasks = 0;
+		for (int k = 0; k < ProfileCounters; k++) {
+			slots[t].counts[k] = 0;
+			slots[t].totalCounts[k] = 0;
+		}
+	}
+}
+
+TProfiler::~TProfiler()
+{
+	Close();
+}
+
+
+// ********
+// The file
+// ********
+
+int TProfiler::Open(const string &path)
+{
+	Close();
+	file = fopen(path.c_str(), "w");
+	if (file == NULL) return 0;
+	fprintf(file, "# generation");
+	for (int p = 0; p < PROFILE_PHASES; p++) fprintf(file, " %s", PhaseNames[p]);
+	fprintf(file, " threads busymin busymean busymax imbalance tasks");
+	if (hardware) {
+		for (int p = 0; p < PROFILE_PHASES; p++)
+			for (int k = 0; k < ProfileCounters; k++) fprintf(file, " %s_%s", PhaseNames[p], CounterNames[k]);
+		for (int k = 0; k < ProfileCounters; k++) fprintf(file, " task_%s", CounterNames[k]);
+	}
+	fprintf(file, "\n");
+	return 1;
+}
+
+// The summary gives the totals of each phase and of each thread that ran tasks
+
+void TProfiler::Close(void)
+{
+	if (file == NULL) return;
+	fprintf(file, "# total");
+	for (int p = 0; p < PROFILE_PHASES; p++) fprintf(file, " %s %.6g", PhaseNames[p], 1e-9 * totalPhaseTime[p]);
+	fprintf(file, "\n");
+	int used = slotsUsed < MaxProfileThreads ? (int)slotsUsed : MaxProfileThreads;
+	for (int t = 0; t < used; t++) {
+		fprintf(file, "# thread %d busy %.6g tasks %lld", t, 1e-9 * slots[t].totalBusy, slots[t].totalTasks);
+		if (hardware)
+			for (int k = 0; k < ProfileCounters; k++) fprintf(file, " %s %lld", CounterNames[k], slots[t].totalCounts[k]);
+		fprintf(file, "\n");
+	}
+	fclose(file);
+	file = NULL;
+}
+
+
+// *******************
+// Phases and tasks
+// *******************
+
+// The phases open on this thread, innermost last
+
+const int MaxPhaseDepth = 16;
+static thread_local int PhaseStack[MaxPhaseDepth];
+static thread_local int PhaseDepth = 0;
+
+void TProfiler::PhaseBegin(TProfilePhase phase, long long &start, TProfileCounts &counts)
+{
+	if (PhaseDepth < MaxPhaseDepth) PhaseStack[PhaseDepth] = phase;
+	PhaseDepth++;
+	ReadCounters(counts);
+	start = ProfileClock();
+}
+
+// Charge the phase with its time and take that time off the enclosing phase,
+// which will be charged for its whole extent when it ends
+
+void TProfiler::PhaseEnd(TProfilePhase phase, long long start, const TProfileCounts &counts)
+{
+	long long elapsed = ProfileClock() - start;
+	TProfileCounts now;
+	ReadCounters(now);
+	PhaseDepth--;
+	int outer = (PhaseDepth > 0 && PhaseDepth <= MaxPhaseDepth) ? PhaseStack[PhaseDepth - 1] : -1;
+	phaseTime[phase] += elapsed;
+	if (outer >= 0) phaseTime[outer] -= elapsed;
+	if (hardware)
+		for (int k = 0; k < ProfileCounters; k++) {
+			long long c = now.value[k] - counts.value[k];
+			phaseCounts[phase][k] += c;
+			if (outer >= 0) phaseCounts[outer][k] -= c;
+		}
+}
+
+// The calling thread's slot, assigned the first time it runs a task
+
+int TProfiler::ThreadSlot(void)
+{
+	static thread_local int slot = -1;
+	if (slot < 0) {
+		slot = slotsUsed++;
+		if (slot >= MaxProfileThreads) slot %= MaxProfileThreads;
+	}
+	return slot;
+}
+
+void TProfiler::TaskBegin(long long &start, TProfileCounts &counts)
+{
+	ReadCounters(counts);
+	start = ProfileClock();
+}
+
+void TProfiler::TaskEnd(long long start, const TProfileCounts &counts)
+{
+	TThreadSlot &s = slots[ThreadSlot()];
+	s.busy += ProfileClock() - start;
+	s.tasks++;
+	if (hardware) {
+		TProfileCounts now;
+		ReadCounters(now);
+		for (int k = 0; k < ProfileCounters; k++) s.counts[k] += now.value[k] - counts.value[k];
+	}
+}
+
+
+// ***********
+// Generations
+// ***********
+
+void TProfiler::EndGeneration(int gen, int threads)
+{
+	// Collect the busy time of each thread. Threads that ran no tasks count
+	// as idle, so the imbalance (the busiest thread over the mean) also
+	// shows a population too small for the pool.
+	int used = slotsUsed < MaxProfileThreads ? (int)slotsUsed : MaxProfileThreads;
+	long long busymin = -1, busymax = 0, busysum = 0, tasks = 0, taskCounts[ProfileCounters] = {0};
+	int active = 0;
+	for (int t = 0; t < used; t++) {
+		TThreadSlot &s = slots[t];
+		long long b = s.busy.exchange(0), n = s.tasks.exchange(0);
+		s.totalBusy += b;
+		s.totalTasks += n;
+		for (int k = 0; k < ProfileCounters; k++) {
+			long long c = s.counts[k].exchange(0);
+			s.totalCounts[k] += c;
+			taskCounts[k] += c;
+		}
+		if (n == 0) continue;
+		active++;
+		busysum += b;
+		tasks += n;
+		if (b > busymax) busymax = b;
+		if (busymin < 0 || b < busymin) busymin = b;
+	}
+	if (threads < active) threads = active;
+	if (busymin < 0 || active < threads) busymin = 0;
+	double busymean = threads > 0 ? (double)busysum / threads : 0.0;
+	double imbalance = busymean > 0.0 ? busymax / busymean : 1.0;
+
+	if (file != NULL) {
+		fprintf(file, "%d", gen);
+		for (int p = 0; p < PROFILE_PHASES; p++) fprintf(file, " %.6g", 1e-9 * phaseTime[p]);
+		fprintf(file, " %d %.6g %.6g %.6g %.4f %lld", threads, 1e-9 * busymin, 1e-9 * busymean, 1e-9 * busymax, imbalance, tasks);
+		if (hardware) {
+			for (int p = 0; p < PROFILE_PHASES; p++)
+				for (int k = 0; k < ProfileCounters; k++) fprintf(file, " %lld", phaseCounts[p][k]);
+			for (int k = 0; k < ProfileCounters; k++) fprintf(file, " %lld", taskCounts[k]);
+		}
+		fprintf(file, "\n");
+	}
+	for (int p = 0; p < PROFILE_PHASES; p++) {
+		totalPhaseTime[p] += phaseTime[p];
+		phaseTime[p] = 0;
+		for (int k = 0; k < ProfileCounters; k++) phaseCounts[p][k] = 0;
+	}
+}
+
+#endif
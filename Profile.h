@@ -0,0 +1,146 @@
+// ***********************************************************
+// Instrumentation of the search
+//
+// Scoped timers charge wall-clock time (and, if enabled and
+// permitted by the kernel, cycles, instructions and cache
+// misses) to the phases of a generation. Every top-level task
+// run by the thread pool is also timed on the thread that runs
+// it, which gives the busy time of each thread and the load
+// imbalance of the parallel evaluation. One line per generation
+// is written to the profile file, and a per-thread summary when
+// it is closed.
+//
+// When PROFILE_SEARCH is not defined the macros below expand to
+// nothing and none of this is compiled.
+// ***********************************************************
+
+#pragma once
+
+// Uncomment the following line to profile the search
+//#define PROFILE_SEARCH
+
+// The phases of a generation
+
+enum TProfilePhase {PROFILE_EVALUATION, PROFILE_SORTING, PROFILE_SELECTION, PROFILE_VARIATION,
+                    PROFILE_STATISTICS, PROFILE_IO, PROFILE_PHASES};
+
+#ifdef PROFILE_SEARCH
+
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include <time.h>
+
+using namespace std;
+
+// The largest number of threads with their own busy-time counters
+// (further threads share them)
+
+const int MaxProfileThreads = 256;
+
+// The hardware counters read together
+// (cycles, instructions, cache misses)
+
+const int ProfileCounters = 3;
+
+struct TProfileCounts {
+	long long value[ProfileCounters];
+};
+
+// Monotonic time in nanoseconds
+
+inline long long ProfileClock(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+
+// The TProfiler class declaration
+
+class TProfiler {
+	public:
+		// The constructor
+		TProfiler(void);
+		// The destructor (closes the profile file)
+		~TProfiler();
+		// Open PATH for the per-generation report (after choosing whether to
+		// count hardware events, which adds columns). Returns 0 on failure.
+		int Open(const string &path);
+		// Write the per-thread summary and close the file
+		void Close(void);
+		// Count cycles, instructions and cache misses with perf_event_open.
+		// Returns 0 (and leaves them off) if the kernel does not allow it.
+		int SetHardwareCounters(int flag);
+		int HardwareCounters(void) {return hardware;};
+		// Phases (timed on the calling thread). A phase begun inside another
+		// is not charged to the outer one.
+		void PhaseBegin(TProfilePhase phase, long long &start, TProfileCounts &counts);
+		void PhaseEnd(TProfilePhase phase, long long start, const TProfileCounts &counts);
+		// Pool tasks (timed on the thread running them)
+		void TaskBegin(long long &start, TProfileCounts &counts);
+		void TaskEnd(long long start, const TProfileCounts &counts);
+		// Report the generation GEN, run with THREADS threads, and start the next one
+		void EndGeneration(int gen, int threads);
+
+	private:
+		struct alignas(64) TThreadSlot {
+			atomic<long long> busy, tasks;
+			atomic<long long> counts[ProfileCounters];
+			long long totalBusy, totalTasks, totalCounts[ProfileCounters];
+		};
+		int ThreadSlot(void);
+		void ReadCounters(TProfileCounts &counts);
+
+		FILE *file;
+		int hardware;
+		atomic<int> slotsUsed;
+		long long phaseTime[PROFILE_PHASES], phaseCounts[PROFILE_PHASES][ProfileCounters];
+		long long totalPhaseTime[PROFILE_PHASES];
+		TThreadSlot slots[MaxProfileThreads];
+};
+
+// The profiler used by the search and the thread pool
+
+TProfiler &SearchProfiler(void);
+
+
+// Charge the rest of the enclosing block to PHASE
+
+class TProfileScope {
+	public:
+		TProfileScope(TProfilePhase p) {phase = p; SearchProfiler().PhaseBegin(phase, start, counts);};
+		~TProfileScope() {SearchProfiler().PhaseEnd(phase, start, counts);};
+
+	private:
+		TProfilePhase phase;
+		long long start;
+		TProfileCounts counts;
+};
+
+// Charge the rest of the enclosing block to the calling thread's busy time
+
+class TProfileTask {
+	public:
+		TProfileTask(void) {SearchProfiler().TaskBegin(start, counts);};
+		~TProfileTask() {SearchProfiler().TaskEnd(start, counts);};
+
+	private:
+		long long start;
+		TProfileCounts counts;
+};
+
+#define PROFILE_CONCAT2(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT2(a, b)
+#define PROFILE_SCOPE(phase) TProfileScope PROFILE_CONCAT(profileScope, __LINE__)(phase)
+#define PROFILE_TASK() TProfileTask PROFILE_CONCAT(profileTask, __LINE__)
+#define PROFILE_GENERATION(gen, threads) SearchProfiler().EndGeneration(gen, threads)
+
+#else
+
+#define PROFILE_SCOPE(phase)
+#define PROFILE_TASK()
+#define PROFILE_GENERATION(gen, threads)
+
+#endif
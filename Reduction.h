@@ -0,0 +1,57 @@
+// ***********************************************************
+// Deterministic summation
+//
+// Sums whose terms are produced in parallel are combined with
+// these helpers in a fixed order, so results are reproducible
+// bit for bit whatever the number of threads.
+// ***********************************************************
+
+#pragma once
+
+#include "VectorMatrix.h"
+#include <cmath>
+
+
+// A compensated (Kahan-Babuska-Neumaier) running sum. The result does not
+// depend on the magnitude of the running total, which keeps long sums of
+// small penalties accurate.
+
+class TCompensatedSum {
+	public:
+		TCompensatedSum(double x = 0.0) {sum = x; c = 0.0;};
+		void Add(double x)
+		{
+			double t = sum + x;
+			if (fabs(sum) >= fabs(x)) c += (sum - t) + x;
+			else c += (x - t) + sum;
+			sum = t;
+		};
+		TCompensatedSum &operator+=(double x) {Add(x); return *this;};
+		TCompensatedSum &operator-=(double x) {Add(-x); return *this;};
+		double Value(void) const {return sum + c;};
+
+	private:
+		double sum, c;
+};
+
+
+// Sum X[0..N-1] by a fixed binary tree over blocks of PairwiseBlock terms.
+// The order depends only on N.
+
+const int PairwiseBlock = 8;
+
+inline double PairwiseSum(const double *x, int n)
+{
+	if (n <= PairwiseBlock) {
+		double s = 0.0;
+		for (int i = 0; i < n; i++) s += x[i];
+		return s;
+	}
+	int half = n / 2;
+	return PairwiseSum(x, half) + PairwiseSum(x + half, n - half);
+}
+
+inline double PairwiseSum(TVector<double> &v)
+{
+	return (v.Size() > 0) ? PairwiseSum(&v[v.LowerBound()], v.Size()) : 0.0;
+}
@@ -13,6 +13,15 @@ const double MaxAngle = M_PI / 12.0; // Pi/12
 const double MaxThrust = 1.5; // 0.6 is default for previous evos 
 const double Friction = 0.9; // 0.9 default
 
+// The incrementally rotated heading is re-derived from theta this often (in steps)
+const int HeadingSyncInterval = 256;
+
+// Largest per-step turn applied with the truncated Taylor rotation. The first
+// omitted terms are dtheta^6/720 (cos) and dtheta^7/5040 (sin), which at this
+// bound are about 2e-17, below the rounding of a double. (A full turn at the
+// reference step is at most 0.01 * MaxAngle, about 0.0026.)
+const double HeadingTaylorLimit = 0.005;
+
 // for earlier work
 // const double MaxAngle = M_PI / 12; // Pi/12
 // const double MaxThrust = 0.6; // 0.6 is default for previous evos 
@@ -20,17 +29,20 @@ const double Friction = 0.9; // 0.9 default
 
 
 // Contructor
-Sniffer::Sniffer(int networksize) {
+template<class Real>
+TSniffer<Real>::TSniffer(int networksize) {
     Set(networksize);
 }
 
 // destructor
-Sniffer::~Sniffer() {
+template<class Real>
+TSniffer<Real>::~TSniffer() {
     Set(0);
 }
 
 // Initialize the agent
-void Sniffer::Set(int networksize) {
+template<class Real>
+void TSniffer<Real>::Set(int networksize) {
     size = networksize;
     sensorweights.SetBounds(1, numberOfSensors*size);
     sensorweights.FillContents(0.0);
@@ -44,6 +56,12 @@ void Sniffer::Set(int networksize) {
     is_passed_out = false;
     oxygenLevel = 50.0;
     co2Level = 20.0;
+    frictionStepSize = 0.0;
+    stepFriction = Friction;
+    stepThrust = ReferenceStepSize;
+    sensorOffset = 1.0;
+    SyncHeading();
+    SetAdaptiveTolerances(1e-6, 1e-6, 1e-4, 1.0, 1e-4);
 
     sensor = 0.0;
     leftSensor = 0.0;
@@ -53,7 +71,8 @@ void Sniffer::Set(int networksize) {
 }
 
 // Reset the state of the agent
-void Sniffer::Reset(double initposX, double initposY, double initTheta) {
+template<class Real>
+void TSniffer<Real>::Reset(Real initposX, Real initposY, Real initTheta) {
     posX = initposX;
     posY = initposY;
     pastposX = initposX;
@@ -63,7 +82,11 @@ void Sniffer::Reset(double initposX, double initposY, double initTheta) {
     rightSensor = 0.0;
     velocity = 0.0;
     theta = initTheta;
-    NervousSystem.RandomizeCircuitState(0.0, 0.0);
+    SyncHeading();
+    // Zero the neural state directly: RandomizeCircuitState would draw from
+    // the global random state, which is shared by all evaluation threads
+    for (int i = 1; i <= NervousSystem.CircuitSize(); i++)
+        NervousSystem.SetNeuronState(i, 0.0);
 
     oxygenLevel = 100.0;
     co2Level = 0.0;
@@ -71,22 +94,25 @@ void Sniffer::Reset(double initposX, double initposY, double initTheta) {
 }
 
 // Map the output of neuron 3 to the breathing rate
-double Sniffer::MapBreathingRate(double neuronOutput){
-    double minRate = 0.1;
-    double maxRate = 2.0;
+template<class Real>
+Real TSniffer<Real>::MapBreathingRate(Real neuronOutput){
+    Real minRate = 0.1;
+    Real maxRate = 2.0;
 
     return minRate + (maxRate - minRate) * neuronOutput;
 
 }
 
 // Define rate of change of O2 and CO2
-double Sniffer::dO2dt(double R) {
-    double a = 0.5, b = 0.5; 
+template<class Real>
+Real TSniffer<Real>::dO2dt(Real R) {
+    Real a = 0.5, b = 0.5; 
     return a * R - b ;
 }
 
-double Sniffer::dCO2dt(double R) {
-    double c = 0.5, d = 0.5; 
+template<class Real>
+Real TSniffer<Real>::dCO2dt(Real R) {
+    Real c = 0.5, d = 0.5; 
     return c * R - d;
 }
 
@@ -124,18 +150,20 @@ double Sniffer::dCO2dt(double R) {
 // Respiration Two Sensors 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-void Sniffer::SenseResp(double leftConcentration, double rightConcentration, double current_time) {
+template<class Real>
+void TSniffer<Real>::SenseResp(Real leftConcentration, Real rightConcentration, double current_time, Real StepSize) {
 
     current_time = current_time / 10.0;
 
-    double breathingRate = MapBreathingRate(NervousSystem.NeuronOutput(3));
-    double phase = sin(current_time * 2 * M_PI * breathingRate);
+    Real breathingRate = MapBreathingRate(NervousSystem.NeuronOutput(3));
+    Real phase = sin(current_time * 2 * M_PI * breathingRate);
 
-    double R = breathingRate;
+    Real R = breathingRate;
 
     // Update O2 and CO2 levels
-    oxygenLevel += 0.01 * dO2dt(R); // 0.01 for prev, 0.001 for recent one. 
-    co2Level += 0.01 * dCO2dt(R);
+    Real respScale = 0.01 * (StepSize / ReferenceStepSize);
+    oxygenLevel += respScale * dO2dt(R); // 0.01 for prev, 0.001 for recent one. 
+    co2Level += respScale * dCO2dt(R);
 
     // sense oxygen and co2 levels
     o2sensor = oxygenLevel;
@@ -176,13 +204,15 @@ void Sniffer::SenseResp(double leftConcentration, double rightConcentration, dou
 // }
 
 // TWO SENSORS -- AGENT CAN DETECT DIFFERENCE IN AMOUNT BETWEEN SENSOR OFFSET
-void Sniffer::Sense(double leftConcentration, double rightConcentration) {
+template<class Real>
+void TSniffer<Real>::Sense(Real leftConcentration, Real rightConcentration) {
     leftSensor = leftConcentration;
     rightSensor = rightConcentration;
 }
 
 // Step in time
-void Sniffer::Step(double StepSize) {
+template<class Real>
+void TSniffer<Real>::Step(Real StepSize) {
     
     pastposX = posX;
     pastposY = posY;
@@ -196,10 +226,10 @@ void Sniffer::Step(double StepSize) {
 // FOR > 1 SENSORS 
 // double sensorValues[3] = {sensor, o2sensor, co2sensor};
 // double sensorValues[2] = {leftSensor, rightSensor};
-double sensorValues[4] = {leftSensor, rightSensor, o2sensor, co2sensor};
+Real sensorValues[4] = {leftSensor, rightSensor, o2sensor, co2sensor};
 
 for (int neuron = 1; neuron <= size; neuron++) {
-    double externalInput = 0.0;
+    Real externalInput = 0.0;
     for (int sensorType = 0; sensorType < numberOfSensors; sensorType++) {
         
         // Calculate the index for the current sensor weight
@@ -212,22 +242,46 @@ for (int neuron = 1; neuron <= size; neuron++) {
 }
 
 	// Update the nervous system
-    NervousSystem.EulerStep(StepSize);
+    NervousSystem.Step(StepSize);
 
-    double outputMotorRight = NervousSystem.NeuronOutput(1); 
-    double outputMotorLeft = NervousSystem.NeuronOutput(2); 
+    Real outputMotorRight = NervousSystem.NeuronOutput(1); 
+    Real outputMotorLeft = NervousSystem.NeuronOutput(2); 
 
     // Calculate the torque and thrust based on the neural outputs
-    double torque = (outputMotorRight - outputMotorLeft) * MaxAngle;
-    double thrust = (outputMotorRight + outputMotorLeft) * MaxThrust;
-
-    // Update velocity and angle
-    velocity = velocity * Friction + StepSize * thrust;
-    theta += StepSize * torque;
+    Real torque = (outputMotorRight - outputMotorLeft) * (Real)MaxAngle;
+    Real thrust = (outputMotorRight + outputMotorLeft) * (Real)MaxThrust;
+
+    // Update velocity and angle. Friction is defined per reference step, so for
+    // other step sizes the decay and thrust gain are rescaled to keep the same
+    // decay rate and terminal velocity.
+    if (StepSize != frictionStepSize) {
+        stepFriction = pow(Friction, StepSize / ReferenceStepSize);
+        stepThrust = ReferenceStepSize * ((1 - stepFriction) / (1 - Friction));
+        frictionStepSize = StepSize;
+    }
+    velocity = velocity * stepFriction + stepThrust * thrust;
+    Real dtheta = StepSize * torque;
+    theta += dtheta;
+
+    // Rotate the heading by dtheta. Up to HeadingTaylorLimit the truncated
+    // Taylor series is within rounding of the exact rotation (larger turns use
+    // sin/cos); the periodic resync from theta removes the accumulated
+    // rounding drift.
+    if (++headingSteps >= HeadingSyncInterval || fabs(dtheta) > (Real)HeadingTaylorLimit)
+        SyncHeading();
+    else {
+        Real d2 = dtheta * dtheta;
+        Real c = 1 - d2 * ((Real)0.5 - d2 * (Real)(1.0/24.0));
+        Real s = dtheta * (1 - d2 * ((Real)(1.0/6.0) - d2 * (Real)(1.0/120.0)));
+        Real hx = headingX * c - headingY * s;
+        headingY = headingY * c + headingX * s;
+        headingX = hx;
+        UpdateSensorDirection();
+    }
 
     // Calculate the new position based on velocity and angle
-    posX += StepSize * velocity * cos(theta);
-    posY += StepSize * velocity * sin(theta);
+    posX += StepSize * velocity * headingX;
+    posY += StepSize * velocity * headingY;
 
        // Check for lower and upper bounds
     if (oxygenLevel > 100) {oxygenLevel = 100.0;}
@@ -246,5 +300,257 @@ for (int neuron = 1; neuron <= size; neuron++) {
 }
 
 
+// Recompute the heading and sensor direction from theta
+template<class Real>
+void TSniffer<Real>::SyncHeading() {
+    headingX = cos(theta);
+    headingY = sin(theta);
+    headingSteps = 0;
+    UpdateSensorDirection();
+}
+
+// The sensors sit at +/- sensorOffset along the heading rotated by pi/3
+template<class Real>
+void TSniffer<Real>::UpdateSensorDirection() {
+    const Real c = 0.5, s = (Real)(0.5 * sqrt(3.0));
+    sensorDirX = sensorOffset * (headingX * c - headingY * s);
+    sensorDirY = sensorOffset * (headingY * c + headingX * s);
+}
+
+
+// Adaptive integration
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// The joint state integrated by AdaptiveStep is the continuous-time limit of
+// SenseResp + Step at the reference step size:
+//   x' = v cos(theta), y' = v sin(theta), theta' = torque,
+//   v' = -lambda v + kappa thrust (same decay rate and terminal velocity as the
+//        per-step friction), O2' and CO2' = dO2dt and dCO2dt per unit time
+//        (SenseResp adds 0.01 of them per reference step of 0.01),
+//   tau_i s_i' = -s_i + sum_j w_ji o_j + sensor input.
+// The chemical sensors are gated by the breathing phase and by passing out, so
+// the right-hand side is only piecewise smooth. Steps that cross a change of
+// gating regime are cut back to end just past the switching time. The regime
+// is checked at the intermediate stages of a step as well as at its end, and
+// steps are kept short enough near a switch that the regime cannot change and
+// change back unseen within one step.
+
+enum {JointX = 1, JointY, JointTheta, JointVelocity, JointO2, JointCO2, JointNeurons};
+
+template<class Real>
+void TSniffer<Real>::PackJointState(TVector<double> &y) {
+    y[JointX] = posX;
+    y[JointY] = posY;
+    y[JointTheta] = theta;
+    y[JointVelocity] = velocity;
+    y[JointO2] = oxygenLevel;
+    y[JointCO2] = co2Level;
+    for (int i = 1; i <= NervousSystem.CircuitSize(); i++)
+        y[JointNeurons + i - 1] = NervousSystem.NeuronState(i);
+}
+
+template<class Real>
+void TSniffer<Real>::JointDerivatives(double time, TVector<double> &y, TVector<double> &dydt, TConcentrationFunction concentration, void *env) {
+    int n = NervousSystem.CircuitSize();
+    for (int i = 1; i <= n; i++)
+        JointOutputs[i] = sigmoid(NervousSystem.gains[i] * (y[JointNeurons + i - 1] + NervousSystem.biases[i]));
+
+    // Respiration and breathing-gated sensing
+    double R = MapBreathingRate(JointOutputs[3]);
+    double phase = sin(time / 10.0 * 2 * M_PI * R);
+    bool passedOut = (y[JointO2] < 10 || y[JointCO2] > 90);
+    double left = 0.0, right = 0.0;
+    if (phase > 0 && !passedOut) {
+        double c = sensorOffset * cos(y[JointTheta] + M_PI / 3);
+        double s = sensorOffset * sin(y[JointTheta] + M_PI / 3);
+        left = (*concentration)(y[JointX] - c, y[JointY] - s, env) * phase;
+        right = (*concentration)(y[JointX] + c, y[JointY] + s, env) * phase;
+    }
+    double sensorValues[4] = {left, right, y[JointO2], y[JointCO2]};
+
+    // Nervous system
+    for (int i = 1; i <= n; i++) {
+        double input = 0.0;
+        for (int j = 1; j <= n; j++)
+            input += NervousSystem.weights[j][i] * JointOutputs[j];
+        for (int sensorType = 0; sensorType < numberOfSensors; sensorType++)
+            input += sensorValues[sensorType] * sensorweights[(i - 1) * numberOfSensors + sensorType + 1];
+        dydt[JointNeurons + i - 1] = NervousSystem.Rtaus[i] * (input - y[JointNeurons + i - 1]);
+    }
+
+    // Body
+    const double lambda = -log(Friction) / ReferenceStepSize;
+    const double kappa = lambda * ReferenceStepSize / (1 - Friction);
+    double torque = (JointOutputs[1] - JointOutputs[2]) * MaxAngle;
+    double thrust = (JointOutputs[1] + JointOutputs[2]) * MaxThrust;
+    dydt[JointX] = y[JointVelocity] * cos(y[JointTheta]);
+    dydt[JointY] = y[JointVelocity] * sin(y[JointTheta]);
+    dydt[JointTheta] = torque;
+    dydt[JointVelocity] = -lambda * y[JointVelocity] + kappa * thrust;
+    dydt[JointO2] = (0.01 / ReferenceStepSize) * dO2dt(R);
+    dydt[JointCO2] = (0.01 / ReferenceStepSize) * dCO2dt(R);
+}
+
+// The sensor gating regime: bit 0 is set while inhaling, bit 1 while passed out
+template<class Real>
+int TSniffer<Real>::JointRegime(double time, TVector<double> &y) {
+    double o3 = sigmoid(NervousSystem.gains[3] * (y[JointNeurons + 2] + NervousSystem.biases[3]));
+    double phase = sin(time / 10.0 * 2 * M_PI * MapBreathingRate(o3));
+    bool passedOut = (y[JointO2] < 10 || y[JointCO2] > 90);
+    return (phase > 0 ? 1 : 0) | (passedOut ? 2 : 0);
+}
+
+// The longest step over which a change of regime cannot be missed, from the
+// derivatives at TIME in Jk1. The breathing phase sin(2 pi time R / 10) changes
+// sign each time time R / 5 passes an integer, and that grows at (R + time R') / 5;
+// a step may advance it by at most half of that, so its sign cannot flip twice.
+// Within PassOutBand of a pass-out threshold, O2 and CO2 may move at most the
+// band in a step.
+const double PassOutBand = 1.0;
+
+template<class Real>
+double TSniffer<Real>::RegimeStepLimit(double time, TVector<double> &y) {
+    double g = NervousSystem.gains[3];
+    double o3 = sigmoid(g * (y[JointNeurons + 2] + NervousSystem.biases[3]));
+    double R = MapBreathingRate(o3);
+    double dR = (MapBreathingRate(1) - MapBreathingRate(0)) * g * o3 * (1 - o3) * Jk1[JointNeurons + 2];
+    double halfCycles = fabs(R + time * dR) / 5.0;
+    double limit = adaptiveMaxStep;
+    if (halfCycles > 0.0) limit = fmin(limit, 0.5 / halfCycles);
+    if (fabs(y[JointO2] - 10) < PassOutBand && Jk1[JointO2] != 0.0)
+        limit = fmin(limit, PassOutBand / fabs(Jk1[JointO2]));
+    if (fabs(y[JointCO2] - 90) < PassOutBand && Jk1[JointCO2] != 0.0)
+        limit = fmin(limit, PassOutBand / fabs(Jk1[JointCO2]));
+    return fmax(limit, adaptiveMinStep);
+}
+
+// Take one Bogacki-Shampine 3(2) step of size h from JointState into JointTemp,
+// with the derivatives at the start already in Jk1, and return the scaled error
+// estimate (<= 1 means acceptable). CROSSED is set if the regime differs from
+// REGIME at any stage of the step.
+template<class Real>
+double TSniffer<Real>::BogackiShampineStep(double time, double h, TConcentrationFunction concentration, void *env,
+                                           int regime, int &crossed) {
+    int dim = JointState.Size();
+    for (int i = 1; i <= dim; i++) JointTemp[i] = JointState[i] + 0.5 * h * Jk1[i];
+    crossed = JointRegime(time + 0.5 * h, JointTemp) != regime;
+    JointDerivatives(time + 0.5 * h, JointTemp, Jk2, concentration, env);
+    for (int i = 1; i <= dim; i++) JointTemp[i] = JointState[i] + 0.75 * h * Jk2[i];
+    crossed |= JointRegime(time + 0.75 * h, JointTemp) != regime;
+    JointDerivatives(time + 0.75 * h, JointTemp, Jk3, concentration, env);
+    for (int i = 1; i <= dim; i++)
+        JointTemp[i] = JointState[i] + h * ((2.0/9.0) * Jk1[i] + (1.0/3.0) * Jk2[i] + (4.0/9.0) * Jk3[i]);
+    crossed |= JointRegime(time + h, JointTemp) != regime;
+    JointDerivatives(time + h, JointTemp, Jk4, concentration, env);
+    double err = 0.0;
+    for (int i = 1; i <= dim; i++) {
+        double e = h * ((-5.0/72.0) * Jk1[i] + (1.0/12.0) * Jk2[i] + (1.0/9.0) * Jk3[i] - (1.0/8.0) * Jk4[i]);
+        double scale = adaptiveAbsTol + adaptiveRelTol * fabs(JointTemp[i]);
+        double r = fabs(e) / scale;
+        if (r > err) err = r;
+    }
+    return err;
+}
+
+// Copy an accepted joint state back into the agent, applying the same bounds as Step
+template<class Real>
+void TSniffer<Real>::UnpackJointState(double time, TVector<double> &y, TConcentrationFunction concentration, void *env) {
+    pastposX = posX;
+    pastposY = posY;
+    pastTheta = theta;
+    posX = y[JointX];
+    posY = y[JointY];
+    theta = y[JointTheta];
+    SyncHeading();
+    velocity = y[JointVelocity];
+    oxygenLevel = y[JointO2];
+    co2Level = y[JointCO2];
+    for (int i = 1; i <= NervousSystem.CircuitSize(); i++)
+        NervousSystem.SetNeuronState(i, y[JointNeurons + i - 1]);
+
+    if (oxygenLevel > 100) {oxygenLevel = 100.0;}
+    if (oxygenLevel < 0) {oxygenLevel = 0;}
+    if (co2Level < 0) {co2Level = 0.0;}
+    if (co2Level > 100) {co2Level = 100;}
+    if (posX >= SpaceWidth) posX = SpaceWidth;
+    if (posX < 0.0) posX = 0.0;
+    if (posY >= SpaceHeight) posY = SpaceHeight;
+    if (posY < 0.0) posY = 0.0;
+
+    // Refresh the sensors for observers
+    o2sensor = oxygenLevel;
+    co2sensor = co2Level;
+    is_passed_out = (oxygenLevel < 10 || co2Level > 90);
+    double phase = sin(time / 10.0 * 2 * M_PI * GetBreathingRate());
+    if (phase > 0 && !is_passed_out) {
+        leftSensor = (*concentration)(LeftSensorX(), LeftSensorY(), env) * phase;
+        rightSensor = (*concentration)(RightSensorX(), RightSensorY(), env) * phase;
+    } else {
+        leftSensor = 0.0;
+        rightSensor = 0.0;
+    }
+}
+
+// Advance the agent from TIME by one error-controlled step of at most H (and
+// not beyond TMAX) in CONCENTRATION. Returns the step actually taken and
+// updates H to the suggested size of the next step.
+template<class Real>
+double TSniffer<Real>::AdaptiveStep(double time, double &h, double tmax, TConcentrationFunction concentration, void *env) {
+    int dim = JointNeurons + NervousSystem.CircuitSize() - 1;
+    if (JointState.Size() != dim) {
+        JointState.SetBounds(1, dim);
+        JointTemp.SetBounds(1, dim);
+        Jk1.SetBounds(1, dim);
+        Jk2.SetBounds(1, dim);
+        Jk3.SetBounds(1, dim);
+        Jk4.SetBounds(1, dim);
+    }
+    JointOutputs.SetBounds(1, NervousSystem.CircuitSize());
+    PackJointState(JointState);
+    JointDerivatives(time, JointState, Jk1, concentration, env);
+    int regime = JointRegime(time, JointState), crossed;
+
+    // Find a step that meets the error tolerance
+    double err;
+    h = fmin(h, RegimeStepLimit(time, JointState));
+    if (h > adaptiveMaxStep) h = adaptiveMaxStep;
+    if (h < adaptiveMinStep) h = adaptiveMinStep;
+    while (true) {
+        if (time + h > tmax) h = tmax - time;
+        err = BogackiShampineStep(time, h, concentration, env, regime, crossed);
+        if (err <= 1.0 || h <= adaptiveMinStep) break;
+        h = fmax(adaptiveMinStep, h * fmax(0.2, 0.9 * pow(err, -1.0/3.0)));
+    }
+
+    // If the gating regime switches within the step, bisect for the switching
+    // time and end the step just past it. The shortened step straddles the
+    // switch, so its error is tested again, and if it fails the step is cut
+    // back further (to end before the switch, which the next step finds again).
+    if (crossed && h > eventTol) {
+        double lo = 0.0, hi = h;
+        while (hi - lo > eventTol) {
+            double mid = 0.5 * (lo + hi);
+            BogackiShampineStep(time, mid, concentration, env, regime, crossed);
+            if (crossed) hi = mid;
+            else lo = mid;
+        }
+        h = hi;
+        err = BogackiShampineStep(time, h, concentration, env, regime, crossed);
+        while (err > 1.0 && h > adaptiveMinStep) {
+            h = fmax(adaptiveMinStep, h * fmax(0.2, 0.9 * pow(err, -1.0/3.0)));
+            err = BogackiShampineStep(time, h, concentration, env, regime, crossed);
+        }
+    }
+
+    // Accept the step and suggest the next step size
+    double taken = h;
+    UnpackJointState(time + taken, JointTemp, concentration, env);
+    double grow = (err > 0.0) ? 0.9 * pow(err, -1.0/3.0) : 5.0;
+    h = fmin(adaptiveMaxStep, fmax(adaptiveMinStep, taken * fmin(5.0, fmax(0.2, grow))));
+    return taken;
+}
 
 
+// Explicit instantiations
+template class TSniffer<double>;
+template class TSniffer<float>;
@@ -2,52 +2,93 @@
 
 #include "CTRNN.h"
 
-// The Sniffer Agent class declaration
-class Sniffer {
+// The step size that the body and respiration constants were tuned for.
+// Other step sizes rescale the per-step friction and respiration updates
+// so that the agent follows the same continuous-time dynamics.
+const double ReferenceStepSize = 0.01;
+
+// A chemical concentration field sampled by the adaptive integrator
+typedef double (*TConcentrationFunction)(double x, double y, void *env);
+
+// The Sniffer Agent class declaration. The agent is templated on the scalar
+// type of its body and nervous system; Sniffer is the double-precision agent.
+template<class Real>
+class TSniffer {
 public:
     // The constructor
-    Sniffer(int networksize);
+    TSniffer(int networksize);
 
     // The destructor
-   	~Sniffer();
+   	~TSniffer();
 
     // Accessors
-    double GetPosX() const { return posX; }
-    double GetPosY() const { return posY; }
-    double GetPastPosX() const { return pastposX; }
-    double GetPastPosY() const { return pastposY; }
-    double GetVelocity() const { return velocity; }
-    double GetTheta() const { return theta; }
-    void SetPosX(double newPosX) { posX = newPosX; }
-    void SetPosY(double newPosY) { posY = newPosY; }
-    void SetSensorWeight(int index, double value) { sensorweights[index] = value; }
-    double GetBreathingRate() {return MapBreathingRate(NervousSystem.NeuronOutput(3));}
-    double GetCO2Level(){return co2Level;}
-    double GetOxygenLevel(){return oxygenLevel;}
+    Real GetPosX() const { return posX; }
+    Real GetPosY() const { return posY; }
+    Real GetPastPosX() const { return pastposX; }
+    Real GetPastPosY() const { return pastposY; }
+    Real GetVelocity() const { return velocity; }
+    Real GetTheta() const { return theta; }
+    void SetPosX(Real newPosX) { posX = newPosX; }
+    void SetPosY(Real newPosY) { posY = newPosY; }
+    void SetSensorWeight(int index, Real value) { sensorweights[index] = value; }
+    Real GetBreathingRate() {return MapBreathingRate(NervousSystem.NeuronOutput(3));}
+    Real GetCO2Level(){return co2Level;}
+    Real GetOxygenLevel(){return oxygenLevel;}
     bool GetPassedOutState() {return is_passed_out;}
-    void SetLeftSensorState(double state) {leftSensor = state;};
-    void SetRightSensorState(double state){rightSensor = state;};
-    void Seto2State(double state){o2sensor = state;};
-    void setco2State(double state){co2sensor = state;};
+    void SetLeftSensorState(Real state) {leftSensor = state;};
+    void SetRightSensorState(Real state){rightSensor = state;};
+    void Seto2State(Real state){o2sensor = state;};
+    void setco2State(Real state){co2sensor = state;};
+    Real GetSensorOffset() {return sensorOffset;}
+    void SetSensorOffset(Real offset) {sensorOffset = offset; SyncHeading();}
+    // Sensor positions, kept up to date by Reset, Step and AdaptiveStep
+    Real LeftSensorX() const { return posX - sensorDirX; }
+    Real LeftSensorY() const { return posY - sensorDirY; }
+    Real RightSensorX() const { return posX + sensorDirX; }
+    Real RightSensorY() const { return posY + sensorDirY; }
+    void SetAdaptiveTolerances(double rtol, double atol, double hmin, double hmax, double eventtol)
+        {adaptiveRelTol = rtol; adaptiveAbsTol = atol; adaptiveMinStep = hmin; adaptiveMaxStep = hmax; eventTol = eventtol;}
 
 
     // Control methods
     void Set(int networksize);
-    void Reset(double initposX, double initposY, double initTheta);
-    double MapBreathingRate(double neuronOutput);
-    // void Sense(double chemical_concentration, double current_time);
-    void Sense(double leftchemical, double rightchemical);
-    void SenseResp(double leftchemicalconcentration, double rightconcentration, double currenttime);
-    void Step(double StepSize);
-    void Respirate(double StepSize);
-    double CalculateRespiratoryState();
-    double dCO2dt(double R);
-    double dO2dt(double R);
+    void Reset(Real initposX, Real initposY, Real initTheta);
+    Real MapBreathingRate(Real neuronOutput);
+    // void Sense(Real chemical_concentration, Real current_time);
+    void Sense(Real leftchemical, Real rightchemical);
+    void SenseResp(Real leftchemicalconcentration, Real rightconcentration, double currenttime, Real StepSize = ReferenceStepSize);
+    void Step(Real StepSize);
+    void SyncHeading();
+    double AdaptiveStep(double time, double &h, double tmax, TConcentrationFunction concentration, void *env);
+    void Respirate(Real StepSize);
+    Real CalculateRespiratoryState();
+    Real dCO2dt(Real R);
+    Real dO2dt(Real R);
     // Properties
     int size;
-    double breathingRate;
+    Real breathingRate;
     bool is_passed_out;
-    double posX, posY, pastposX, pastposY, velocity, theta, pastTheta, gain, leftSensor, rightSensor, sensor, oxygenLevel, co2Level, o2sensor,co2sensor;
-    TVector<double> sensorweights;
-    CTRNN NervousSystem;
+    Real posX, posY, pastposX, pastposY, velocity, theta, pastTheta, gain, leftSensor, rightSensor, sensor, oxygenLevel, co2Level, o2sensor,co2sensor;
+    Real frictionStepSize, stepFriction, stepThrust;
+    Real sensorOffset;
+    // The heading (cos theta, sin theta) and the offset of the right sensor
+    // from the center (sensorOffset along theta + pi/3), updated incrementally
+    Real headingX, headingY, sensorDirX, sensorDirY;
+    int headingSteps;
+    TVector<Real> sensorweights;
+    TCTRNN<Real> NervousSystem;
+
+private:
+    void UpdateSensorDirection();
+    // Adaptive integration of the joint brain-body-respiration state
+    void PackJointState(TVector<double> &y);
+    void UnpackJointState(double time, TVector<double> &y, TConcentrationFunction concentration, void *env);
+    void JointDerivatives(double time, TVector<double> &y, TVector<double> &dydt, TConcentrationFunction concentration, void *env);
+    int JointRegime(double time, TVector<double> &y);
+    double RegimeStepLimit(double time, TVector<double> &y);
+    double BogackiShampineStep(double time, double h, TConcentrationFunction concentration, void *env, int regime, int &crossed);
+    double adaptiveRelTol, adaptiveAbsTol, adaptiveMinStep, adaptiveMaxStep, eventTol;
+    TVector<double> JointState, JointTemp, JointOutputs, Jk1, Jk2, Jk3, Jk4;
 };
+
+typedef TSniffer<double> Sniffer;
@@ -0,0 +1,259 @@
+// ***********************************************************
+// Methods for the surrogate model
+// ***********************************************************
+
+#include "Surrogate.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+
+// The fewest samples a model is fitted to
+const int MinSurrogateSamples = 20;
+
+// The most samples whose distances set the kernel width
+const int WidthSamples = 50;
+
+
+// ****************************
+// Constructors and Settings
+// ****************************
+
+TSurrogate::TSurrogate(void)
+{
+	features = 128;
+	window = 1000;
+	ridge = 1e-3;
+	dim = count = next = 0;
+	fitted = 0;
+	mean = 0.0;
+}
+
+void TSurrogate::SetFeatures(int n)
+{
+	if (n <= 0) {
+		cerr << "Invalid surrogate feature count: " << n;
+		exit(0);
+	}
+	features = n;
+	fitted = 0;
+}
+
+void TSurrogate::SetWindow(int n)
+{
+	if (n < MinSurrogateSamples) {
+		cerr << "Invalid surrogate window: " << n << " (at least " << MinSurrogateSamples << ")";
+		exit(0);
+	}
+	window = n;
+	Clear();
+}
+
+void TSurrogate::SetRidge(double r)
+{
+	if (r <= 0.0) {
+		cerr << "Invalid surrogate ridge: " << r;
+		exit(0);
+	}
+	ridge = r;
+}
+
+
+// *************
+// Training data
+// *************
+
+void TSurrogate::Add(TVector<double> &x, double y)
+{
+	if (dim != x.Size()) {
+		Clear();
+		dim = x.Size();
+	}
+	if (xs.size() != (size_t)window * dim) {
+		xs.resize((size_t)window * dim);
+		ys.resize(window);
+	}
+	for (int k = 0; k < dim; k++)
+		xs[(size_t)next * dim + k] = x[x.LowerBound() + k];
+	ys[next] = y;
+	next = (next + 1) % window;
+	if (count < window) count++;
+}
+
+void TSurrogate::Clear(void)
+{
+	count = next = 0;
+	fitted = 0;
+}
+
+
+// *****
+// Model
+// *****
+
+// The random Fourier features of X: sqrt(2/D) cos(w.x + b)
+
+void TSurrogate::FeatureVector(const double *x, double *phi)
+{
+	double scale = sqrt(2.0/features);
+	for (int j = 0; j < features; j++) {
+		const double *wj = &w[(size_t)j * dim];
+		double a = b[j];
+		for (int k = 0; k < dim; k++)
+			a += wj[k] * x[k];
+		phi[j] = scale * cos(a);
+	}
+}
+
+int TSurrogate::Fit(void)
+{
+	fitted = 0;
+	if (count < MinSurrogateSamples) return 0;
+	// The samples in the order they were added
+	int first = (count < window) ? 0 : next;
+	vector<int> order(count);
+	for (int s = 0; s < count; s++)
+		order[s] = (first + s) % window;
+	// Set the kernel width to the median distance between the latest samples
+	int m = min(count, WidthSamples);
+	vector<double> dist;
+	for (int s = count - m; s < count; s++)
+		for (int t = s + 1; t < count; t++) {
+			double d = 0.0;
+			for (int k = 0; k < dim; k++) {
+				double e = xs[(size_t)order[s] * dim + k] - xs[(size_t)order[t] * dim + k];
+				d += e * e;
+			}
+			dist.push_back(d);
+		}
+	nth_element(dist.begin(), dist.begin() + dist.size()/2, dist.end());
+	double width2 = dist[dist.size()/2];
+	if (width2 <= 0.0) return 0;
+	// Draw the features of a Gaussian kernel of that width
+	w.resize((size_t)features * dim);
+	b.resize(features);
+	for (size_t i = 0; i < w.size(); i++)
+		w[i] = rs.GaussianRandom(0.0, 1.0/width2);
+	for (int j = 0; j < features; j++)
+		b[j] = rs.UniformRandom(0.0, 2 * M_PI);
+	// Accumulate the normal equations (Phi'Phi + ridge I) beta = Phi'(y - mean)
+	mean = 0.0;
+	for (int s = 0; s < count; s++)
+		mean += ys[order[s]];
+	mean /= count;
+	vector<double> a((size_t)features * features, 0.0), r(features, 0.0), phi(features);
+	for (int s = 0; s < count; s++) {
+		FeatureVector(&xs[(size_t)order[s] * dim], &phi[0]);
+		double y = ys[order[s]] - mean;
+		for (int i = 0; i < features; i++) {
+			r[i] += phi[i] * y;
+			double *ai = &a[(size_t)i * features];
+			for (int j = 0; j <= i; j++)
+				ai[j] += phi[i] * phi[j];
+		}
+	}
+	// Solve them by Cholesky factorization (of the lower triangle, in place)
+	for (int i = 0; i < features; i++)
+		a[(size_t)i * features + i] += ridge;
+	for (int j = 0; j < features; j++) {
+		double *aj = &a[(size_t)j * features];
+		double d = aj[j];
+		for (int k = 0; k < j; k++)
+			d -= aj[k] * aj[k];
+		if (d <= 0.0) return 0;
+		aj[j] = sqrt(d);
+		for (int i = j + 1; i < features; i++) {
+			double *ai = &a[(size_t)i * features];
+			double e = ai[j];
+			for (int k = 0; k < j; k++)
+				e -= ai[k] * aj[k];
+			ai[j] = e / aj[j];
+		}
+	}
+	beta.assign(features, 0.0);
+	for (int i = 0; i < features; i++) {
+		double e = r[i];
+		for (int k = 0; k < i; k++)
+			e -= a[(size_t)i * features + k] * beta[k];
+		beta[i] = e / a[(size_t)i * features + i];
+	}
+	for (int i = features - 1; i >= 0; i--) {
+		double e = beta[i];
+		for (int k = i + 1; k < features; k++)
+			e -= a[(size_t)k * features + i] * beta[k];
+		beta[i] = e / a[(size_t)i * features + i];
+	}
+	fitted = 1;
+	return 1;
+}
+
+double TSurrogate::Predict(TVector<double> &x)
+{
+	if (!fitted) return mean;
+	vector<double> phi(features);
+	FeatureVector(&x[x.LowerBound()], &phi[0]);
+	double y = mean;
+	for (int j = 0; j < features; j++)
+		y += beta[j] * phi[j];
+	return y;
+}
+
+
+// ****************
+// Input and Output
+// ****************
+
+void TSurrogate::WriteState(ostream &bofs)
+{
+	bofs.write((const char*) &(features), sizeof(features));
+	bofs.write((const char*) &(window), sizeof(window));
+	bofs.write((const char*) &(ridge), sizeof(ridge));
+	rs.BinaryWriteRandomState(bofs);
+	bofs.write((const char*) &(dim), sizeof(dim));
+	bofs.write((const char*) &(count), sizeof(count));
+	bofs.write((const char*) &(next), sizeof(next));
+	if (count > 0) {
+		bofs.write((const char*) &xs[0], xs.size() * sizeof(double));
+		bofs.write((const char*) &ys[0], ys.size() * sizeof(double));
+	}
+	bofs.write((const char*) &(fitted), sizeof(fitted));
+	if (fitted) {
+		bofs.write((const char*) &(mean), sizeof(mean));
+		bofs.write((const char*) &w[0], w.size() * sizeof(double));
+		bofs.write((const char*) &b[0], b.size() * sizeof(double));
+		bofs.write((const char*) &beta[0], beta.size() * sizeof(double));
+	}
+}
+
+void TSurrogate::ReadState(istream &bifs)
+{
+	int i;
+	double d;
+
+	bifs.read((char*) &(i), sizeof(i));
+	SetFeatures(i);
+	bifs.read((char*) &(i), sizeof(i));
+	SetWindow(i);
+	bifs.read((char*) &(d), sizeof(d));
+	SetRidge(d);
+	rs.BinaryReadRandomState(bifs);
+	bifs.read((char*) &(dim), sizeof(dim));
+	bifs.read((char*) &(count), sizeof(count));
+	bifs.read((char*) &(next), sizeof(next));
+	if (count > 0) {
+		xs.resize((size_t)window * dim);
+		ys.resize(window);
+		bifs.read((char*) &xs[0], xs.size() * sizeof(double));
+		bifs.read((char*) &ys[0], ys.size() * sizeof(double));
+	}
+	bifs.read((char*) &(fitted), sizeof(fitted));
+	if (fitted) {
+		bifs.read((char*) &(mean), sizeof(mean));
+		w.resize((size_t)features * dim);
+		b.resize(features);
+		beta.resize(features);
+		bifs.read((char*) &w[0], w.size() * sizeof(double));
+		bifs.read((char*) &b[0], b.size() * sizeof(double));
+		bifs.read((char*) &beta[0], beta.size() * sizeof(double));
+	}
+}
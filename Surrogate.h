@@ -0,0 +1,63 @@
+// ***********************************************************
+// A surrogate model of the performance of search vectors
+//
+// Random-feature ridge regression: each vector is mapped to
+// FEATURES random Fourier features of a Gaussian kernel, and a
+// ridge regression on those features is fitted to the most
+// recent WINDOW (vector, performance) pairs. The kernel width is
+// set from the median distance between training vectors. The
+// model is cheap enough to refit every generation and to
+// predict thousands of candidates, and it only has to rank
+// them, not predict their performance exactly.
+// ***********************************************************
+
+#pragma once
+
+#include "VectorMatrix.h"
+#include "random.h"
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+
+// The TSurrogate class declaration
+
+class TSurrogate {
+	public:
+		// The constructor
+		TSurrogate(void);
+		// Settings
+		int Features(void) {return features;};
+		void SetFeatures(int n);
+		int Window(void) {return window;};
+		void SetWindow(int n);
+		double Ridge(void) {return ridge;};
+		void SetRidge(double r);
+		void SetRandomSeed(long seed) {rs.SetRandomSeed(seed);};
+		// Training data: the samples are kept in a ring of WINDOW vectors
+		void Add(TVector<double> &x, double y);
+		int Samples(void) {return count;};
+		void Clear(void);
+		// Fit the model to the samples (drawing new features). Returns 0,
+		// leaving the model unfitted, if there are too few samples.
+		int Fit(void);
+		int Fitted(void) {return fitted;};
+		// The predicted performance of X
+		double Predict(TVector<double> &x);
+		// Input and output (the samples, the model and the random state)
+		void WriteState(ostream &bofs);
+		void ReadState(istream &bifs);
+
+	private:
+		void FeatureVector(const double *x, double *phi);
+
+		int features, window;
+		double ridge;
+		RandomState rs;
+		int dim, count, next;
+		vector<double> xs, ys;          // The samples (WINDOW x DIM and WINDOW)
+		int fitted;
+		vector<double> w, b, beta;      // The frequencies (FEATURES x DIM), phases and weights
+		double mean;                    // The mean performance of the samples
+};
@@ -23,11 +23,20 @@
 // *******************************************************************************
 
 #include "TSearch.h"
+#include "Profile.h"
 #include <math.h>
 #include <limits.h>
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
 
 
 // An out of memory handler for new
@@ -67,6 +76,7 @@ TSearch::TSearch(int VSize, double (*EvalFn)(TVector<double> &, RandomState &))
 	SetSelectionMode(RANK_BASED);
 	SetReproductionMode(GENETIC_ALGORITHM);
 	SetCrossoverMode(TWO_POINT);
+	SetRestartMode(NO_RESTARTS);
 	// Set up search parameter defaults
 	SetPopulationSize(1);
 	SetMaxGenerations(0);
@@ -76,7 +86,30 @@ TSearch::TSearch(int VSize, double (*EvalFn)(TVector<double> &, RandomState &))
 	SetCrossoverProbability(0.0);
 	SetSearchConstraint(1);
 	SetReEvaluationFlag(0);
+	SetCommonRandomNumbers(0);
+	LowFidelityFunction = NULL;
+	SetLowFidelityFraction(1.0);
+	FidelityCorr = 0.0;
+	GenLowEvaluations = 0;
+	SetTrialParallelism(0);
 	SetCheckpointInterval(0);
+	SetCheckpointFileName("search.cpt");
+	SetInitialStepSize(0.5);
+	SetMaxRestarts(9);
+	SetScreeningCandidates(1);
+	SetHonestFraction(0.2);
+	SurrogateCorr = 0.0;
+	SurrogateTrusted = 1;
+	GenScreened = 0;
+	CMABaseLambda = 0;
+	CMASigma = 0.0;
+	CMARunGen = CMARestarts = CMALargeRuns = CMALargeRegime = 0;
+	CMARunEvals = CMALargeEvals = CMASmallEvals = 0;
+	AsyncCheckpoint = 0;
+	CheckpointWriter = NULL;
+	EvolLog = NULL;
+	GenEvaluations = 0;
+	EvalTime = ReproTime = CheckpointTime = 0.0;
 }
 
 
@@ -84,6 +117,7 @@ TSearch::TSearch(int VSize, double (*EvalFn)(TVector<double> &, RandomState &))
 
 TSearch::~TSearch()
 {
+  delete CheckpointWriter;
   RandomStates.SetSize(0);
 	for (int i = 1; i <= PopulationSize(); i++)
 		Population[i].SetSize(0);
@@ -94,6 +128,17 @@ TSearch::~TSearch()
 	crossPoints.SetSize(0);
 	ConstraintVector.SetSize(0);
 	bestVector.SetSize(0);
+	MutationVector.SetSize(0);
+	CMAMean.SetSize(0);
+	CMACov.SetSize(0,0);
+	CMAEigenvectors.SetSize(0,0);
+	CMAEigenvalues.SetSize(0);
+	CMAPathC.SetSize(0);
+	CMAPathSigma.SetSize(0);
+	Predicted.SetSize(0);
+	PredictionKind.SetSize(0);
+	LowPerf.SetSize(0);
+	FullFidelity.SetSize(0);
 }
 
 
@@ -111,8 +156,9 @@ void TSearch::SetVectorSize(int NewSize)
 	// Resize the population
 	for (int i = 1; i <= Population.Size(); i++)
 		Population[i].SetSize(NewSize);
-	// Adjust bestVector
+	// Adjust bestVector and the mutation scratch vector
 	bestVector.SetSize(NewSize);
+	MutationVector.SetSize(NewSize);
 	// Reset the crossover template and crossover points vectors
 	TVector<int> v(1,NewSize);
 	for (int i = 1; i <= NewSize; i++)
@@ -134,6 +180,12 @@ void TSearch::SetPopulationSize(int NewSize)
 		Population[i].SetSize(vectorSize);
 	Perf.SetSize(NewSize);
 	fitness.SetSize(NewSize);
+	Predicted.SetSize(NewSize);
+	PredictionKind.SetSize(NewSize);
+	LowPerf.SetSize(NewSize);
+	FullFidelity.SetSize(NewSize);
+	PredictionKind.FillContents(0);
+	FullFidelity.FillContents(1);
   RandomStates.SetSize(NewSize);
   for (int i = 1; i <= NewSize; i++)
     //RandomStates[i].SetRandomSeed(rs.UniformRandomInteger(1,LONG_MAX));
@@ -289,6 +341,68 @@ void TSearch::SetSearchConstraint(int flag)
 }
 
 
+// Set the step size with which each CMA-ES run starts (before BIPOP shrinks it)
+
+void TSearch::SetInitialStepSize(double NewSigma)
+{
+	if (NewSigma <= 0.0) {
+		cerr << "Invalid InitialStepSize: " << NewSigma;
+		exit(0);
+	}
+	CMAInitialSigma = NewSigma;
+}
+
+
+// Set the number of times CMA-ES may restart with a larger population (the
+// smaller BIPOP runs in between are not counted)
+
+void TSearch::SetMaxRestarts(int NewMax)
+{
+	if (NewMax < 0) {
+		cerr << "Invalid MaxRestarts: " << NewMax;
+		exit(0);
+	}
+	CMAMaxRestarts = NewMax;
+}
+
+
+// Set the number of mutants a surrogate-screened child is chosen from (1 disables screening)
+
+void TSearch::SetScreeningCandidates(int n)
+{
+	if (n < 1) {
+		cerr << "Invalid ScreeningCandidates: " << n;
+		exit(0);
+	}
+	ScreenCandidates = n;
+}
+
+
+// Set the fraction of children that are left unscreened
+
+void TSearch::SetHonestFraction(double f)
+{
+	if (f < 0.0 || f > 1.0) {
+		cerr << "Invalid HonestFraction: " << f;
+		exit(0);
+	}
+	HonestFrac = f;
+}
+
+
+// Set the fraction of the individuals evaluated at low fidelity that are
+// re-evaluated at full fidelity (1 evaluates all at full fidelity only)
+
+void TSearch::SetLowFidelityFraction(double f)
+{
+	if (f <= 0.0 || f > 1.0) {
+		cerr << "Invalid LowFidelityFraction: " << f;
+		exit(0);
+	}
+	FidelityFrac = f;
+}
+
+
 // Set the frequency with which checkpoint files are written
 // (0 means never)
 
@@ -302,10 +416,33 @@ void TSearch::SetCheckpointInterval(int NewInterval)
 }
 
 
+// Write checkpoints from a background thread while the search continues
+
+void TSearch::SetAsyncCheckpointing(int flag)
+{
+	if (!flag && CheckpointWriter != NULL) CheckpointWriter->Flush();
+	AsyncCheckpoint = flag;
+}
+
+
 // *****************
 // Basic Search Loop
 // *****************
 
+#ifdef PROFILE_SEARCH
+// The number of threads evaluating the population, for the profiler
+
+static int SearchThreads(void)
+{
+#ifdef THREADED_SEARCH
+	return SharedThreadPool().ThreadCount();
+#else
+	return 1;
+#endif
+}
+#endif
+
+
 // The top-level search loop
 
 void TSearch::DoSearch(int ResumeFlag)
@@ -320,31 +457,57 @@ void TSearch::DoSearch(int ResumeFlag)
 	}
 	// Unless we're resuming a checkpointed search, evalute the initial population and reset best
 	if (!ResumeFlag) {
+		DrawTrialSet();
 		EvaluatePopulation();
 		BestPerf = -1;
 		UpdateBestFlag = 0;
 	}
-	// Update and display statistics of the initial population
+	// Update, display and log statistics of the initial population
 	UpdatePopulationStatistics();
-	DisplayPopulationStatistics();
+	{
+		PROFILE_SCOPE(PROFILE_IO);
+		DisplayPopulationStatistics();
+		if (!ResumeFlag) LogPopulationStatistics();  // A resumed search logged it before checkpointing
+	}
 	// If the best changed and there is a BestActionFunction, invoke it
 	if (UpdateBestFlag && BestActionFunction != NULL)
 		(*BestActionFunction)(Gen,bestVector);
+	PROFILE_GENERATION(Gen, SearchThreads());
 	// Repeat until done
 	while (!SearchTerminated())
 	{
 		Gen++;
 		UpdateBestFlag = 0;
+		double start = WallClock();
 		ReproducePopulation();
+		ReproTime = WallClock() - start - EvalTime;
 		UpdatePopulationStatistics();
-		DisplayPopulationStatistics();
+		{
+			PROFILE_SCOPE(PROFILE_IO);
+			DisplayPopulationStatistics();
+		}
 		// If the best changed and there is a BestActionFunction, invoke it
 		if (UpdateBestFlag && BestActionFunction != NULL)
 			(*BestActionFunction)(Gen,bestVector);
-		// If we're checkpointing and this is a checkpoint generation, save the state of the search
-		if ((CheckpointInt > 0) && (Gen > 0) && ((Gen % CheckpointInt) == 0))
-			WriteCheckpointFile();
+		{
+			PROFILE_SCOPE(PROFILE_IO);
+			// If we're checkpointing and this is a checkpoint generation, save the state of the search
+			int checkpoint = (CheckpointInt > 0) && (Gen > 0) && ((Gen % CheckpointInt) == 0);
+			if (checkpoint) {
+				start = WallClock();
+				if (AsyncCheckpoint) WriteCheckpointFileAsync();
+				else WriteCheckpointFile();
+				CheckpointTime = WallClock() - start;
+			}
+			LogPopulationStatistics();
+			// Keep the log on disk in step with the checkpoints, so a resumed run continues it cleanly
+			if (checkpoint && EvolLog != NULL) EvolLog->Flush();
+		}
+		PROFILE_GENERATION(Gen, SearchThreads());
 	}
+	// Make sure the last checkpoint and log records are on disk
+	if (CheckpointWriter != NULL) CheckpointWriter->Flush();
+	if (EvolLog != NULL) EvolLog->Flush();
 	// Display results
 	DisplaySearchResults();
 }
@@ -364,8 +527,12 @@ void TSearch::InitializeSearch(void)
 {
 	// Reset the generation counter
 	Gen = 0;
-	// Set up the initial population
-	RandomizePopulation();
+	// Set up the initial population (for CMA-ES, the first sample of its first run)
+	if (RepMode == CMA_ES) {
+		InitializeCMA();
+		SampleCMAPopulation();
+	}
+	else RandomizePopulation();
 	// The search is now initialized
 	SearchInitialized = 1;
 }
@@ -394,8 +561,8 @@ void TSearch::RandomizePopulation(void)
 
 void TSearch::UpdatePopulationStatistics(void)
 {
+	PROFILE_SCOPE(PROFILE_STATISTICS);
 	register int i;
-	double total = 0;
 	int bestindex = 1;
 	register double perf;
 
@@ -408,26 +575,25 @@ void TSearch::UpdatePopulationStatistics(void)
 		// Update MinPerformance and MaxPerformance as necessary
 		if (perf > MaxPerf) {MaxPerf = perf; bestindex = i;}
 		if (perf < MinPerf) MinPerf = perf;
-		// Update total
-		total += perf;
 	}
-	// Update AveragePerformance (with protection from possible numerical errors)
-	AvgPerf = total/Population.Size();
+	// Update AveragePerformance (with protection from possible numerical errors).
+	// The sums use a fixed summation tree so that they are reproducible.
+	AvgPerf = PairwiseSum(Perf)/Population.Size();
 	if (AvgPerf < MinPerf) AvgPerf = MinPerf;
 	if (AvgPerf > MaxPerf) AvgPerf = MaxPerf;
 	// Update PerformanceVariance
 	if (Population.Size() > 1)
 	{
-		total = 0;
+		TVector<double> sqdev(1, Population.Size());
 		for (int i = 1; i <= Population.Size(); i++) {
 			double d = Perf[i] - AvgPerf;
-			total += d*d;
+			sqdev[i] = d*d;
 		}
-		PerfVar = total/(Population.Size()-1);
+		PerfVar = PairwiseSum(sqdev)/(Population.Size()-1);
 	}
 	else PerfVar = 0.0;
-	// If the best performance has improved or ReEvalFlag is set, update BestPerf and BestVector
-	if ((MaxPerf > BestPerf) || ReEvalFlag)
+	// If the best performance has improved or the population is re-evaluated, update BestPerf and BestVector
+	if ((MaxPerf > BestPerf) || ReEvalFlag || CommonTrials)
 	{
 		UpdateBestFlag = 1;
 		BestPerf = MaxPerf;
@@ -449,6 +615,49 @@ void TSearch::DisplayPopulationStatistics(void)
 }
 
 
+// Append the statistics of the current generation to the evolution log and
+// start counting the work of the next one
+
+void TSearch::LogPopulationStatistics(void)
+{
+	if (EvolLog != NULL) {
+		TGenerationRecord r;
+		r.Generation = Gen;
+		r.BestPerf = BestPerf;
+		r.AvgPerf = AvgPerf;
+		r.PerfVar = PerfVar;
+		r.MinPerf = MinPerf;
+		r.MaxPerf = MaxPerf;
+		// Quartiles by linear interpolation between the order statistics
+		int n = Population.Size();
+		TVector<double> sorted(Perf);
+		sort(&sorted[1], &sorted[1] + n);
+		double q[3];
+		for (int k = 0; k < 3; k++) {
+			double h = (n - 1) * 0.25 * (k + 1);
+			int lo = (int)h;
+			int hi = (lo + 1 < n) ? lo + 1 : lo;
+			q[k] = sorted[lo + 1] + (h - lo) * (sorted[hi + 1] - sorted[lo + 1]);
+		}
+		r.LowerQuartile = q[0];
+		r.Median = q[1];
+		r.UpperQuartile = q[2];
+		r.Evaluations = GenEvaluations;
+		r.CacheHits = EvolLog->TakeCacheHits();
+		r.Screened = GenScreened;
+		r.SurrogateCorrelation = SurrogateCorr;
+		r.LowFidelityEvaluations = GenLowEvaluations;
+		r.FidelityCorrelation = FidelityCorr;
+		r.EvaluationTime = EvalTime;
+		r.ReproductionTime = ReproTime;
+		r.CheckpointTime = CheckpointTime;
+		EvolLog->Append(r);
+	}
+	GenEvaluations = GenLowEvaluations = GenScreened = 0;
+	EvalTime = ReproTime = CheckpointTime = 0.0;
+}
+
+
 // Display the results of a search
 
 void TSearch::DisplaySearchResults(void)
@@ -489,63 +698,191 @@ int TSearch::SearchTerminated(void)
 // Evaluate the given vector
 // Note that negative performances are treated as 0
 
-double TSearch::EvaluateVector(TVector<double> &v, RandomState &rs)
+double TSearch::EvaluateVector(TVector<double> &v, RandomState &rs, int lowFidelity)
 {
-	double perf = (*EvaluationFunction)(v, rs);
+	// Serve the evaluation's scratch vectors from this thread's arena
+	TArenaScope scratch;
+	// and count its cache hits in this search's log
+	TEvolutionLog *previous = ActiveEvolutionLog;
+	ActiveEvolutionLog = EvolLog;
+	double perf = lowFidelity ? (*LowFidelityFunction)(v, rs) : (*EvaluationFunction)(v, rs);
+	ActiveEvolutionLog = previous;
 
 	return (perf<0)?0:perf;
 }
 
 
-// Evaluate a population range
+// Evaluate the Ith individual of the population with its own random state or,
+// with common random numbers, a copy of the generation's. A low-fidelity
+// evaluation uses a copy of the individual's state, so that its full-fidelity
+// evaluation faces the same trials.
 
-void *EvaluatePopulationRange(void *arg)
+double TSearch::EvaluateIndividual(int i, int lowFidelity)
 {
-  PopRangeSpec *prs = (PopRangeSpec *)arg;
-  TSearch *s = prs->search;
-  for (int i = prs->start; i <= prs->end; i++)
-    s->Perf[i] = s->EvaluateVector(s->Population[i], s->RandomStates[i]);
-  pthread_exit(NULL);
+	if (!CommonTrials && !lowFidelity) return EvaluateVector(Population[i], RandomStates[i]);
+	RandomState trials = CommonTrials ? TrialState : RandomStates[i];
+	return EvaluateVector(Population[i], trials, lowFidelity);
 }
 
 
-// Evaluate the current population, beginning with the STARTth individual
+// Draw the random state of a generation's trials (only with common random
+// numbers, so that the search's own random sequence is otherwise unchanged)
 
-void TSearch::EvaluatePopulation(int start)
+void TSearch::DrawTrialSet(void)
 {
-#ifdef THREADED_SEARCH  // Evaluate the population in parallel
-  // Create threads
-  if (THREAD_COUNT > 1) {
-    int NumIndividuals = (PopulationSize() - start + 1)/THREAD_COUNT;
-    pthread_t threads[THREAD_COUNT-1];
-    PopRangeSpec psrs[THREAD_COUNT-1];
-    int rc;
-    for (int i = 1; i <= THREAD_COUNT - 1; i++) {
-      psrs[i-1].search = this;
-      psrs[i-1].start = (i-1)*NumIndividuals + start;
-      psrs[i-1].end = i*NumIndividuals + start - 1;
-      rc  = pthread_create(&threads[i-1], NULL, EvaluatePopulationRange, (void *)&psrs[i-1]);
-      if (rc) {cerr << "Thread creation failed: " << rc << endl; exit(-1);}
-    }
-    // Evaluate the remaining individuals in the main thread
-    for (int i = (THREAD_COUNT - 1)*NumIndividuals + start; i <= PopulationSize(); i++)
-      Perf[i] = EvaluateVector(Population[i], RandomStates[i]);
-    // Wait for all other threads to complete
-    int status;
-    for (int i = 0; i <= THREAD_COUNT-2; i++)
-      pthread_join(threads[i], (void **)&status);
+	if (CommonTrials)
+		TrialState.SetRandomSeed(rs.UniformRandomInteger(1,IM-1));
+}
+
+
+// Evaluate one individual of the population
+
+void EvaluateIndividualTask(int i, void *arg)
+{
+  TSearch *s = (TSearch *)arg;
+  s->Perf[i] = s->EvaluateIndividual(i);
+}
+
+
+// Evaluate the current population, beginning with the STARTth individual.
+// Each individual has its own random state, so the results do not depend on
+// which thread evaluates it. With TrialParallel set, the individuals are
+// evaluated in turn and the evaluation function is left to spread its trials
+// over the pool (for small populations, e.g., hill climbing). Multi-fidelity
+// evaluation is used if it is on and ALLOWLOWFIDELITY is set.
+
+void TSearch::EvaluatePopulation(int start, int allowLowFidelity)
+{
+  PROFILE_SCOPE(PROFILE_EVALUATION);
+  double begin = WallClock();
+  if (LowFidelityFunction != NULL && FidelityFrac < 1.0 && allowLowFidelity) {
+    EvaluatePopulationMultiFidelity(start);
+    EvalTime += WallClock() - begin;
+    if (ScreenCandidates > 1 && RepMode != CMA_ES) UpdateSurrogate(start);
+    return;
   }
-  else
+#ifdef THREADED_SEARCH  // Evaluate the population in parallel
+  if (TrialParallel)
     for (int i = start; i <= Population.Size(); i++)
-      Perf[i] = EvaluateVector(Population[i], RandomStates[i]);
-
+      Perf[i] = EvaluateIndividual(i);
+  else
+    SharedThreadPool().ParallelFor(start, Population.Size(), EvaluateIndividualTask, (void *)this);
 #else // Evaluate the population serially
-	for (int i = start; i <= Population.Size(); i++)
-		Perf[i] = EvaluateVector(Population[i], RandomStates[i]);
+	for (int i = start; i <= Population.Size(); i++) {
+		PROFILE_TASK();
+		Perf[i] = EvaluateIndividual(i);
+	}
+#endif
+  EvalTime += WallClock() - begin;
+  for (int i = start; i <= Population.Size(); i++)
+    FullFidelity[i] = 1;
+  if (start <= Population.Size()) GenEvaluations += Population.Size() - start + 1;
+  if (ScreenCandidates > 1 && RepMode != CMA_ES) UpdateSurrogate(start);
+}
+
+
+// Evaluate one of the individuals listed in EvalIndices, at the fidelity of EvalLowFidelity
+
+void EvaluateSelectedTask(int k, void *arg)
+{
+  TSearch *s = (TSearch *)arg;
+  int i = s->EvalIndices[k];
+  if (s->EvalLowFidelity) s->LowPerf[i] = s->EvaluateIndividual(i, 1);
+  else s->Perf[i] = s->EvaluateIndividual(i);
+}
+
+void TSearch::EvaluateSelected(int lowFidelity)
+{
+  int n = EvalIndices.size();
+  EvalLowFidelity = lowFidelity;
+#ifdef THREADED_SEARCH
+  if (TrialParallel)
+    for (int k = 0; k < n; k++)
+      EvaluateSelectedTask(k, (void *)this);
+  else
+    SharedThreadPool().ParallelFor(0, n - 1, EvaluateSelectedTask, (void *)this);
+#else
+  for (int k = 0; k < n; k++) {
+    PROFILE_TASK();
+    EvaluateSelectedTask(k, (void *)this);
+  }
 #endif
 }
 
 
+// Evaluate the individuals from the STARTth at low fidelity, then re-evaluate
+// the best LowFidelityFraction of them at full fidelity. The others are ranked
+// below those by their low-fidelity performances, scaled down if need be so
+// that none exceeds the worst full-fidelity performance, and are marked as
+// not fully evaluated.
+
+void TSearch::EvaluatePopulationMultiFidelity(int start)
+{
+  int count = Population.Size() - start + 1;
+  if (count <= 0) return;
+  EvalIndices.resize(count);
+  for (int k = 0; k < count; k++)
+    EvalIndices[k] = start + k;
+  EvaluateSelected(1);
+  // Promote the best at low fidelity (ties in population order)
+  int promoted = (int)ceil(FidelityFrac * count);
+  if (promoted < 1) promoted = 1;
+  vector<int> order(EvalIndices);
+  stable_sort(order.begin(), order.end(), [this](int a, int b) {return LowPerf[a] > LowPerf[b];});
+  EvalIndices.assign(order.begin(), order.begin() + promoted);
+  EvaluateSelected(0);
+  for (int k = 0; k < count; k++)
+    FullFidelity[order[k]] = (k < promoted);
+  // The correlation between the two fidelities over the promoted individuals
+  double sl = 0.0, sf = 0.0, sll = 0.0, sff = 0.0, slf = 0.0;
+  double worst = Perf[order[0]];
+  for (int k = 0; k < promoted; k++) {
+    double l = LowPerf[order[k]], f = Perf[order[k]];
+    sl += l; sf += f; sll += l*l; sff += f*f; slf += l*f;
+    if (f < worst) worst = f;
+  }
+  double cov = slf - sl*sf/promoted, vl = sll - sl*sl/promoted, vf = sff - sf*sf/promoted;
+  FidelityCorr = (promoted >= 3 && vl > 0.0 && vf > 0.0) ? cov/sqrt(vl*vf) : 0.0;
+  // Rank the rest below them
+  if (promoted < count) {
+    double top = LowPerf[order[promoted]];
+    double scale = (top > worst) ? worst/top : 1.0;
+    for (int k = promoted; k < count; k++)
+      Perf[order[k]] = scale * LowPerf[order[k]];
+  }
+  GenEvaluations += promoted;
+  GenLowEvaluations += count;
+}
+
+
+// Check the predictions made for the individuals just evaluated (from the
+// STARTth), then add them to the surrogate's training data and refit it. Only
+// full-fidelity performances are used, since the others are only ranks.
+
+void TSearch::UpdateSurrogate(int start)
+{
+	PROFILE_SCOPE(PROFILE_VARIATION);
+	double sp = 0.0, sa = 0.0, spp = 0.0, saa = 0.0, spa = 0.0;
+	int n = 0;
+	for (int i = start; i <= Population.Size(); i++) {
+		if (PredictionKind[i] == 1 && FullFidelity[i]) {
+			double p = Predicted[i], a = Perf[i];
+			sp += p; sa += a; spp += p*p; saa += a*a; spa += p*a;
+			n++;
+		}
+		PredictionKind[i] = 0;
+	}
+	if (n >= 3) {
+		double cov = spa - sp*sa/n, vp = spp - sp*sp/n, va = saa - sa*sa/n;
+		SurrogateCorr = (vp > 0.0 && va > 0.0) ? cov/sqrt(vp*va) : 0.0;
+		SurrogateTrusted = SurrogateCorr > 0.0;
+	}
+	for (int i = start; i <= Population.Size(); i++)
+		if (FullFidelity[i]) Surrogate.Add(Population[i], Perf[i]);
+	Surrogate.Fit();
+}
+
+
 // *********
 // Selection
 // *********
@@ -590,12 +927,9 @@ void TSearch::UpdatePopulationFitness(void)
 		case FITNESS_PROPORTIONATE:
 			{
 				double m = LinearScaleFactor(MinPerf,MaxPerf,AvgPerf,MaxExpOffspring);
-				double total = 0;
 				for (int i = 1; i <= psize; i++)
-				{
 					fitness[i] = m * (Perf[i] - AvgPerf) + AvgPerf;
-					total = total + fitness[i];
-				}
+				double total = PairwiseSum(fitness);
 				for (int i = 1; i <= psize; i++)
 					fitness[i] = fitness[i]/total;
 				break;
@@ -619,18 +953,50 @@ void TSearch::UpdatePopulationFitness(void)
 void TSearch::MutateVector(TVector<double> &v)
 {
 	double magnitude;
-	TVector<double> TempVector(1,vectorSize);
 
 	// Generate a normally-distributed random magnitude
 	magnitude = rs.GaussianRandom(0.0,MutationVar);
 	// Generate a random unit vector
-	rs.RandomUnitVector(TempVector);
+	rs.RandomUnitVector(MutationVector);
 	// Apply the mutation to V
 	for (int i = 1; i <= vectorSize; i++)
 		if (ConstraintVector[i])
-			v[i] = clip(v[i] + magnitude * TempVector[i],MinSearchValue,MaxSearchValue);
+			v[i] = clip(v[i] + magnitude * MutationVector[i],MinSearchValue,MaxSearchValue);
 		else
-			v[i] = v[i] + magnitude * TempVector[i];
+			v[i] = v[i] + magnitude * MutationVector[i];
+}
+
+
+// Mutate the Ith individual. When screening, the child is the mutant of the
+// individual that the surrogate predicts will perform best; an honest child
+// is a single mutant whose prediction is only recorded, to check the model.
+
+void TSearch::MutateChild(int i)
+{
+	if (ScreenCandidates <= 1 || !Surrogate.Fitted()) {
+		MutateVector(Population[i]);
+		return;
+	}
+	if (!SurrogateTrusted || rs.ProbabilisticChoice(HonestFrac)) {
+		MutateVector(Population[i]);
+		Predicted[i] = Surrogate.Predict(Population[i]);
+		PredictionKind[i] = 1;
+		return;
+	}
+	TVector<double> parent(Population[i]), child;
+	double best = 0.0;
+	for (int c = 1; c <= ScreenCandidates; c++) {
+		child = parent;
+		MutateVector(child);
+		double p = Surrogate.Predict(child);
+		if (c == 1 || p > best) {
+			Population[i] = child;
+			best = p;
+		}
+	}
+	Predicted[i] = best;
+	PredictionKind[i] = 2;
+	GenScreened += ScreenCandidates - 1;
 }
 
 
@@ -640,13 +1006,13 @@ void TSearch::UniformCrossover(TVector<double> &v1, TVector<double> &v2)
 {
 	if (crossPoints.Size() < 2) return;
 	for (int i = 1; i <= crossPoints.Size() - 1; i++)
-		if (ProbabilisticChoice(0.5))
+		if (rs.ProbabilisticChoice(0.5))
 			for (int j = crossPoints[i]; j < crossPoints[i+1]; j++) {
 				double temp = v1[j];
 				v1[j] = v2[j];
 				v2[j] = temp;
 			}
-	if (ProbabilisticChoice(0.5))
+	if (rs.ProbabilisticChoice(0.5))
 		for (int j = crossPoints[crossPoints.Size()]; j <= vectorSize; j++) {
 			double temp = v1[j];
 			v1[j] = v2[j];
@@ -685,9 +1051,13 @@ void TSearch::TwoPointCrossover(TVector<double> &v1, TVector<double> &v2)
 
 void TSearch::ReproducePopulation(void)
 {
+	// Time not spent sorting, varying or evaluating goes to selection
+	PROFILE_SCOPE(PROFILE_SELECTION);
+	DrawTrialSet();
 	switch (RepMode) {
 		case HILL_CLIMBING: ReproducePopulationHillClimbing(); break;
 		case GENETIC_ALGORITHM: ReproducePopulationGeneticAlgorithm(); break;
+		case CMA_ES: ReproducePopulationCMAES(); break;
 		default: cerr << "Invalid reproduction mode" << endl; exit(0);
 	}
 }
@@ -702,6 +1072,7 @@ void TSearch::ReproducePopulationHillClimbing(void)
 	// Select the parents using Baker's stochastic universal sampling
 	TVector<TVector<double> > ParentPopulation(1,psize);
 	TVector<double> ParentPerf(1,psize);
+	TVector<int> ParentFull(1,psize);
 	int j = 1;
 	double sum = 0;
 	double rand = rs.UniformRandom(0.0,1.0);
@@ -710,31 +1081,38 @@ void TSearch::ReproducePopulationHillClimbing(void)
 		while (rand < sum) {
 			ParentPopulation[j] = Population[i];
 			ParentPerf[j] = Perf[i];
+			ParentFull[j] = FullFidelity[i];
 			j++;
 			rand++;
 		}
 	}
   // Replace the current population with the parent population
   Population = ParentPopulation;
-	// If ReEvalFlag is set
-	if (ReEvalFlag) {
+	// If the parents are to be re-evaluated
+	if (ReEvalFlag || CommonTrials) {
     // reset BestPerf
     BestPerf = -1;
-    // re-evaluate the parents
-    EvaluatePopulation();
+    // re-evaluate the parents (in full, since they are compared with their children)
+    EvaluatePopulation(1, 0);
     // and update the performance values for the parents
     ParentPerf = Perf;
+    ParentFull.FillContents(1);
   }
   // Produce the new population by mutating each parent
-  for (int i = 1; i <= psize; i++)
-    MutateVector(Population[i]);
+  {
+    PROFILE_SCOPE(PROFILE_VARIATION);
+    for (int i = 1; i <= psize; i++)
+      MutateChild(i);
+  }
   // Evaluate the children
   EvaluatePopulation();
-  // Restore each parent whose child's performance is worse
+  // Restore each parent whose child's performance is worse, or was only
+  // estimated at low fidelity
   for (int i = 1; i <= psize; i++)
-    if (ParentPerf[i] > Perf[i]) {
+    if (ParentPerf[i] > Perf[i] || !FullFidelity[i]) {
       Population[i] = ParentPopulation[i];
       Perf[i] = ParentPerf[i];
+      FullFidelity[i] = ParentFull[i];
     }
 }
 
@@ -772,9 +1150,10 @@ void TSearch::ReproducePopulationGeneticAlgorithm(void)
 	// Apply mutation or crossover to each nonelite parent and compute the child's performance
 	int i = ElitePop+1;
 	TVector<double> Parent1, Parent2;
+	PROFILE_SCOPE(PROFILE_VARIATION);
 	while (i <= psize) {
 		// Perform crossover with probability CrossProb
-		if (ProbabilisticChoice(CrossProb) && (i < psize)) {
+		if (rs.ProbabilisticChoice(CrossProb) && (i < psize)) {
 			Parent1 = Population[i];
 			Parent2 = Population[i+1];
 			switch (CrossMode) {
@@ -787,22 +1166,312 @@ void TSearch::ReproducePopulationGeneticAlgorithm(void)
 			i++;
 		}
 		// Otherwise, perform mutation
-		else MutateVector(Population[i++]);
+		else MutateChild(i++);
 	}
   // Evaluate the new population
-  if (ReEvalFlag) EvaluatePopulation();
+  if (ReEvalFlag || CommonTrials) EvaluatePopulation();
   else EvaluatePopulation(ElitePop+1);
 }
 
 
-// Quicksort the population in descending order by performance
+// ******
+// CMA-ES
+// ******
+
+// The covariance matrix adaptation evolution strategy (Hansen's (mu/mu_w, lambda)-CMA-ES)
+// samples each generation from a multivariate normal distribution and moves the mean,
+// step size and covariance of that distribution towards the best half of the sample.
+// When a run converges or stagnates the search restarts from a random mean. IPOP doubles
+// the population at every restart; BIPOP interleaves those runs with runs of smaller
+// populations and step sizes, giving each regime a similar number of evaluations.
+// Constrained parameters of a sample are clipped to [MinSearchValue,MaxSearchValue]
+// before it is evaluated, and the distribution is updated from the clipped samples.
+
+void TSearch::ReproducePopulationCMAES(void)
+{
+	// A search initialized in another mode starts its first run here
+	if (CMASigma == 0.0) InitializeCMA();
+	else {
+		CMARunEvals += PopulationSize();
+		UpdateCMADistribution();
+		if (CMARestartMode != NO_RESTARTS && CMALargeRuns < CMAMaxRestarts && CMARunConverged())
+			RestartCMA();
+	}
+	{
+		PROFILE_SCOPE(PROFILE_VARIATION);
+		SampleCMAPopulation();
+	}
+	EvaluatePopulation();
+}
+
+
+// Start the first run, with as many offspring as the population has individuals
+
+void TSearch::InitializeCMA(void)
+{
+	CMABaseLambda = PopulationSize();
+	CMARestarts = CMALargeRuns = 0;
+	CMALargeRegime = 1;
+	CMALargeEvals = CMASmallEvals = 0;
+	StartCMARun(CMABaseLambda, CMAInitialSigma);
+}
+
+
+// Start a run of LAMBDA offspring from a random mean with step size SIGMA
 
-inline int partition(int first, int last, TVector<double> &perf, TVector<TVector<double> > &pop)
+void TSearch::StartCMARun(int lambda, double sigma)
+{
+	if (lambda < 2) {
+		cerr << "Invalid CMA-ES population size: " << lambda << endl;
+		exit(0);
+	}
+	if (lambda != PopulationSize()) SetPopulationSize(lambda);
+	CMAMean.SetBounds(1, vectorSize);
+	RandomizeVector(CMAMean);
+	CMASigma = sigma;
+	CMACov.SetBounds(1, vectorSize, 1, vectorSize);
+	CMACov.FillContents(0.0);
+	for (int i = 1; i <= vectorSize; i++)
+		CMACov[i][i] = 1.0;
+	CMAPathC.SetBounds(1, vectorSize);
+	CMAPathC.FillContents(0.0);
+	CMAPathSigma.SetBounds(1, vectorSize);
+	CMAPathSigma.FillContents(0.0);
+	CMAHistory.clear();
+	CMARunGen = 0;
+	CMARunEvals = 0;
+	DecomposeCMACovariance();
+}
+
+
+// Update the distribution from the evaluated population
+
+void TSearch::UpdateCMADistribution(void)
+{
+	int n = vectorSize, lambda = PopulationSize(), mu = lambda/2;
+
+	SortPopulation();
+	CMAHistory.push_back(Perf[1]);
+	CMARunGen++;
+	// The recombination weights and the learning rates (Hansen's defaults)
+	TVector<double> w(1, mu), wsq(1, mu);
+	for (int i = 1; i <= mu; i++)
+		w[i] = log(mu + 0.5) - log((double)i);
+	double wsum = PairwiseSum(w);
+	for (int i = 1; i <= mu; i++) {
+		w[i] /= wsum;
+		wsq[i] = w[i] * w[i];
+	}
+	double mueff = 1.0/PairwiseSum(wsq);
+	double cc = (4.0 + mueff/n)/(n + 4.0 + 2.0*mueff/n);
+	double cs = (mueff + 2.0)/(n + mueff + 5.0);
+	double c1 = 2.0/((n + 1.3)*(n + 1.3) + mueff);
+	double cmu = min(1.0 - c1, 2.0*(mueff - 2.0 + 1.0/mueff)/((n + 2.0)*(n + 2.0) + mueff));
+	double damps = 1.0 + 2.0*max(0.0, sqrt((mueff - 1.0)/(n + 1.0)) - 1.0) + cs;
+	double chiN = sqrt((double)n)*(1.0 - 1.0/(4.0*n) + 1.0/(21.0*n*n));
+	// Move the mean to the weighted average of the best MU offspring
+	TVector<double> old(CMAMean);
+	TMatrix<double> y(1, mu, 1, n);
+	TVector<double> yw(1, n);
+	for (int k = 1; k <= n; k++) {
+		double m = 0.0;
+		for (int i = 1; i <= mu; i++) {
+			y[i][k] = (Population[i][k] - old[k])/CMASigma;
+			m += w[i] * Population[i][k];
+		}
+		CMAMean[k] = m;
+		yw[k] = (m - old[k])/CMASigma;
+	}
+	// Update the evolution paths, the step size path through C^-1/2
+	TVector<double> t(1, n);
+	for (int j = 1; j <= n; j++) {
+		double d = 0.0;
+		for (int k = 1; k <= n; k++)
+			d += CMAEigenvectors[k][j] * yw[k];
+		t[j] = d/CMAEigenvalues[j];
+	}
+	double ps = sqrt(cs*(2.0 - cs)*mueff), psnorm = 0.0;
+	for (int i = 1; i <= n; i++) {
+		double z = 0.0;
+		for (int j = 1; j <= n; j++)
+			z += CMAEigenvectors[i][j] * t[j];
+		CMAPathSigma[i] = (1.0 - cs)*CMAPathSigma[i] + ps*z;
+		psnorm += CMAPathSigma[i] * CMAPathSigma[i];
+	}
+	psnorm = sqrt(psnorm);
+	int hsig = psnorm/sqrt(1.0 - pow(1.0 - cs, 2.0*CMARunGen))/chiN < 1.4 + 2.0/(n + 1.0);
+	double pc = sqrt(cc*(2.0 - cc)*mueff);
+	for (int i = 1; i <= n; i++)
+		CMAPathC[i] = (1.0 - cc)*CMAPathC[i] + (hsig ? pc*yw[i] : 0.0);
+	// Adapt the covariance matrix with the rank-one and rank-mu updates
+	double keep = 1.0 - c1 - cmu + (hsig ? 0.0 : c1*cc*(2.0 - cc));
+	for (int i = 1; i <= n; i++)
+		for (int j = i; j <= n; j++) {
+			double rankmu = 0.0;
+			for (int k = 1; k <= mu; k++)
+				rankmu += w[k] * y[k][i] * y[k][j];
+			CMACov[i][j] = CMACov[j][i] = keep*CMACov[i][j] + c1*CMAPathC[i]*CMAPathC[j] + cmu*rankmu;
+		}
+	// Adapt the step size (by at most a factor of e per generation)
+	CMASigma *= exp(min(1.0, (cs/damps)*(psnorm/chiN - 1.0)));
+	DecomposeCMACovariance();
+}
+
+
+// Find the eigenvectors and the square roots of the eigenvalues of the
+// covariance matrix by cyclic Jacobi rotations
+
+void TSearch::DecomposeCMACovariance(void)
+{
+	int n = vectorSize;
+	TMatrix<double> a(CMACov);
+	CMAEigenvectors.SetBounds(1, n, 1, n);
+	CMAEigenvectors.FillContents(0.0);
+	for (int i = 1; i <= n; i++)
+		CMAEigenvectors[i][i] = 1.0;
+	for (int sweep = 1; sweep <= 50; sweep++) {
+		double off = 0.0, diag = 0.0;
+		for (int p = 1; p <= n; p++) {
+			diag += a[p][p] * a[p][p];
+			for (int q = p + 1; q <= n; q++)
+				off += a[p][q] * a[p][q];
+		}
+		if (off <= 1e-30 * diag) break;
+		for (int p = 1; p < n; p++)
+			for (int q = p + 1; q <= n; q++) {
+				if (a[p][q] == 0.0) continue;
+				double theta = (a[q][q] - a[p][p])/(2.0*a[p][q]);
+				double t = ((theta >= 0.0) ? 1.0 : -1.0)/(fabs(theta) + sqrt(theta*theta + 1.0));
+				double c = 1.0/sqrt(t*t + 1.0), s = t*c;
+				for (int k = 1; k <= n; k++) {
+					double akp = a[k][p], akq = a[k][q];
+					a[k][p] = c*akp - s*akq;
+					a[k][q] = s*akp + c*akq;
+				}
+				for (int k = 1; k <= n; k++) {
+					double apk = a[p][k], aqk = a[q][k];
+					a[p][k] = c*apk - s*aqk;
+					a[q][k] = s*apk + c*aqk;
+				}
+				for (int k = 1; k <= n; k++) {
+					double vkp = CMAEigenvectors[k][p], vkq = CMAEigenvectors[k][q];
+					CMAEigenvectors[k][p] = c*vkp - s*vkq;
+					CMAEigenvectors[k][q] = s*vkp + c*vkq;
+				}
+			}
+	}
+	// Rounding can leave tiny eigenvalues negative
+	CMAEigenvalues.SetBounds(1, n);
+	for (int i = 1; i <= n; i++)
+		CMAEigenvalues[i] = sqrt(max(a[i][i], 1e-20));
+}
+
+
+// Return 1 if the current run should stop: the distribution has collapsed or
+// become degenerate, or the best performance has stopped improving
+
+int TSearch::CMARunConverged(void)
+{
+	int n = vectorSize, lambda = PopulationSize();
+	double mind = CMAEigenvalues[1], maxd = CMAEigenvalues[1];
+	for (int i = 2; i <= n; i++) {
+		mind = min(mind, CMAEigenvalues[i]);
+		maxd = max(maxd, CMAEigenvalues[i]);
+	}
+	// The covariance matrix is too badly conditioned
+	if ((maxd/mind)*(maxd/mind) > 1e14) return 1;
+	// The step size has blown up
+	if (CMASigma/CMAInitialSigma > 1e20*maxd) return 1;
+	// Every coordinate has stopped moving, or adding a tenth of a standard
+	// deviation along an axis or a fifth along a coordinate leaves the mean unchanged
+	int still = 1, axis = CMARunGen % n + 1;
+	for (int i = 1; i <= n; i++) {
+		double sd = CMASigma*sqrt(CMACov[i][i]);
+		if (max(CMASigma*fabs(CMAPathC[i]), sd) >= 1e-12*CMAInitialSigma) still = 0;
+		if (CMAMean[i] == CMAMean[i] + 0.2*sd) return 1;
+	}
+	if (still) return 1;
+	int noeffect = 1;
+	for (int k = 1; k <= n && noeffect; k++)
+		if (CMAMean[k] != CMAMean[k] + 0.1*CMASigma*CMAEigenvalues[axis]*CMAEigenvectors[k][axis]) noeffect = 0;
+	if (noeffect) return 1;
+	// The best performances of recent generations, and the performances of
+	// this one, all lie within a negligible range
+	int recent = 10 + (int)ceil(30.0*n/lambda), g = CMAHistory.size();
+	if (g >= recent) {
+		double lo = Perf[lambda], hi = Perf[1];
+		for (int i = g - recent; i < g; i++) {
+			lo = min(lo, CMAHistory[i]);
+			hi = max(hi, CMAHistory[i]);
+		}
+		if (hi - lo < 1e-12) return 1;
+	}
+	// The median of the last 20 best performances is no better than the
+	// median of the 20 from the start of a window covering the last fifth of the run
+	int window = max(120 + (int)(30.0*n/lambda), (int)(0.2*g));
+	if (g >= window && window >= 40) {
+		vector<double> first(CMAHistory.end() - window, CMAHistory.end() - window + 20);
+		vector<double> last(CMAHistory.end() - 20, CMAHistory.end());
+		nth_element(first.begin(), first.begin() + 10, first.end());
+		nth_element(last.begin(), last.begin() + 10, last.end());
+		if (last[10] <= first[10]) return 1;
+	}
+	return 0;
+}
+
+
+// Start the next run
+
+void TSearch::RestartCMA(void)
+{
+	if (CMALargeRegime) CMALargeEvals += CMARunEvals;
+	else CMASmallEvals += CMARunEvals;
+	CMARestarts++;
+	// IPOP, and BIPOP while the large populations have had no more evaluations than the small
+	if (CMARestartMode == IPOP || CMALargeEvals <= CMASmallEvals) {
+		CMALargeRuns++;
+		CMALargeRegime = 1;
+		StartCMARun(CMABaseLambda << CMALargeRuns, CMAInitialSigma);
+	}
+	else {
+		double u = rs.UniformRandom(0.0, 1.0);
+		double ratio = 0.5*(CMABaseLambda << CMALargeRuns)/CMABaseLambda;
+		int lambda = (int)floor(CMABaseLambda*pow(ratio, u*u));
+		CMALargeRegime = 0;
+		StartCMARun(max(lambda, 2), CMAInitialSigma*pow(10.0, -2.0*u));
+	}
+}
+
+
+// Sample the population from the distribution
+
+void TSearch::SampleCMAPopulation(void)
+{
+	TVector<double> z(1, vectorSize);
+	for (int i = 1; i <= PopulationSize(); i++) {
+		for (int j = 1; j <= vectorSize; j++)
+			z[j] = CMAEigenvalues[j] * rs.GaussianRandom(0.0, 1.0);
+		for (int k = 1; k <= vectorSize; k++) {
+			double x = 0.0;
+			for (int j = 1; j <= vectorSize; j++)
+				x += CMAEigenvectors[k][j] * z[j];
+			x = CMAMean[k] + CMASigma * x;
+			Population[i][k] = ConstraintVector[k] ? clip(x,MinSearchValue,MaxSearchValue) : x;
+		}
+	}
+}
+
+
+// Quicksort the population in descending order by performance (FULL, whether
+// each performance is a full-fidelity one, moves with the individuals)
+
+inline int partition(int first, int last, TVector<double> &perf, TVector<TVector<double> > &pop, TVector<int> &full)
 {
 	int pivot = first;
 	double pivot_value = perf[first];
 	double temp1;
 	TVector<double> temp2;
+	int temp3;
 
 	for (int i = first; i <= last; i++) {
 		if (perf[i] > pivot_value) {
@@ -810,27 +1479,30 @@ inline int partition(int first, int last, TVector<double> &perf, TVector<TVector
 			if (i != pivot) {
 				temp1 = perf[pivot]; perf[pivot] = perf[i]; perf[i] = temp1;
 				temp2 = pop[pivot]; pop[pivot] = pop[i]; pop[i] = temp2;
+				temp3 = full[pivot]; full[pivot] = full[i]; full[i] = temp3;
 			}
 		}
 	}
 	temp1 = perf[pivot]; perf[pivot] = perf[first]; perf[first] = temp1;
 	temp2 = pop[pivot]; pop[pivot] = pop[first]; pop[first] = temp2;
+	temp3 = full[pivot]; full[pivot] = full[first]; full[first] = temp3;
 
 	return pivot;
 }
 
-inline void quicksort(int first, int last, TVector<double> &perf, TVector<TVector<double> > &pop)
+inline void quicksort(int first, int last, TVector<double> &perf, TVector<TVector<double> > &pop, TVector<int> &full)
 {
 	if (first < last) {
-		int pivot = partition(first,last,perf,pop);
-		quicksort(first,pivot-1,perf,pop);
-		quicksort(pivot+1,last,perf,pop);
+		int pivot = partition(first,last,perf,pop,full);
+		quicksort(first,pivot-1,perf,pop,full);
+		quicksort(pivot+1,last,perf,pop,full);
 	}
 }
 
 void TSearch::SortPopulation(void)
 {
-	quicksort(1,Population.Size(),Perf,Population);
+	PROFILE_SCOPE(PROFILE_SORTING);
+	quicksort(1,Population.Size(),Perf,Population,FullFidelity);
 }
 
 
@@ -844,7 +1516,14 @@ void TSearch::SortPopulation(void)
 // in a file because of the function pointers. These i/o methods are primarily
 // designed to support a simple checkpoint/restart facility.
 //
+// Checkpoint files are written to a temporary file that is synced and then
+// renamed over the old checkpoint, so a crash leaves either the old or the new
+// checkpoint intact. The state is preceded by a header that identifies the
+// format and guards against truncated or corrupted files.
+//
 // File format:
+//  <Magic "TSCP"> <Format Version> <State Length> <State Checksum (64-bit FNV-1a)>
+// followed by the state:
 //  <Vector Size> <Population Size>
 //  <Generation> <Max Generation>
 //  <Random State>
@@ -861,10 +1540,231 @@ void TSearch::SortPopulation(void)
 //  <RandomState 1>
 //  ...
 //  <RandomState N>
+//  <Common Random Numbers?> <Trial Random State> <Low Fidelity Fraction>
+//  <Screening Candidates> <Honest Fraction> <Surrogate Trusted?> <Surrogate Correlation>
+//  <Surrogate (settings, random state, samples and fitted model)>
+//  <Restart Mode> <Initial Step Size> <Max Restarts> <CMA-ES Started?>
+// and, if CMA-ES has started:
+//  <Base Population Size> <Run Generation> <Restarts> <Large Runs> <Large Regime?>
+//  <Run Evaluations> <Large Regime Evaluations> <Small Regime Evaluations>
+//  <Step Size> <Mean> <Covariance Path> <Step Size Path>
+//  <Covariance Matrix (row by row)>
+//  <History Length> <Best Performance 1> ... <Best Performance G>
+
+const char CheckpointMagic[4] = {'T','S','C','P'};
+
+// The 64-bit FNV-1a hash of a byte string
+
+static uint64_t CheckpointChecksum(const string &data)
+{
+  uint64_t h = 14695981039346656037ULL;
+  for (size_t i = 0; i < data.size(); i++) {
+    h ^= (unsigned char)data[i];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+// Prepend the checkpoint header to a serialized search state
+
+static string CheckpointImage(const string &state)
+{
+  ostringstream image(ios::binary);
+  int version = CheckpointVersion;
+  uint64_t length = state.size(), checksum = CheckpointChecksum(state);
+  image.write(CheckpointMagic, sizeof(CheckpointMagic));
+  image.write((const char*) &(version), sizeof(version));
+  image.write((const char*) &(length), sizeof(length));
+  image.write((const char*) &(checksum), sizeof(checksum));
+  image.write(state.data(), state.size());
+  return image.str();
+}
+
+// Write DATA to PATH through a synced temporary file and an atomic rename.
+// Returns 0 on failure, leaving any previous file at PATH untouched.
+
+static int WriteFileAtomically(const string &path, const string &data)
+{
+  string temp = path + ".tmp";
+  int fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) return 0;
+  const char *p = data.data();
+  size_t left = data.size();
+  while (left > 0) {
+    ssize_t n = write(fd, p, left);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      close(fd);
+      return 0;
+    }
+    p += n;
+    left -= n;
+  }
+  if (fsync(fd) != 0) {close(fd); return 0;}
+  if (close(fd) != 0) return 0;
+  if (rename(temp.c_str(), path.c_str()) != 0) return 0;
+  // Sync the directory so that the rename itself survives a crash
+  size_t slash = path.find_last_of('/');
+  string dir = (slash == string::npos) ? "." : path.substr(0, slash + 1);
+  int dfd = open(dir.c_str(), O_RDONLY);
+  if (dfd >= 0) {fsync(dfd); close(dfd);}
+  return 1;
+}
+
+// Read the checkpoint at PATH into STATE. Returns 0 if there is no checkpoint
+// and -1 (after reporting why) if the file is not a valid checkpoint.
+
+static int ReadCheckpointImage(const string &path, string &state)
+{
+  ifstream bifs(path.c_str(), ios::binary);
+  if (!bifs) return 0;
+  char magic[sizeof(CheckpointMagic)];
+  int version;
+  uint64_t length, checksum;
+  bifs.read(magic, sizeof(magic));
+  bifs.read((char*) &(version), sizeof(version));
+  bifs.read((char*) &(length), sizeof(length));
+  bifs.read((char*) &(checksum), sizeof(checksum));
+  if (!bifs || memcmp(magic, CheckpointMagic, sizeof(magic)) != 0) {
+    cerr << "Checkpoint file " << path << " is not a search checkpoint" << endl;
+    return -1;
+  }
+  if (version != CheckpointVersion) {
+    cerr << "Checkpoint file " << path << " has format version " << version << ", expected " << CheckpointVersion << endl;
+    return -1;
+  }
+  state.resize(length);
+  bifs.read(&state[0], length);
+  if (!bifs || (uint64_t)bifs.gcount() != length || CheckpointChecksum(state) != checksum) {
+    cerr << "Checkpoint file " << path << " is truncated or corrupt" << endl;
+    return -1;
+  }
+  return 1;
+}
+
+
+// Return 1 if a valid checkpoint file exists at the checkpoint path
+
+int TSearch::CheckpointAvailable(void)
+{
+  if (CheckpointWriter != NULL) CheckpointWriter->Flush();
+  string state;
+  return ReadCheckpointImage(CheckpointFile, state) == 1;
+}
+
 
 void TSearch::WriteCheckpointFile(void)
 {
-  ofstream bofs("search.cpt", ios::binary);
+  ostringstream state(ios::binary);
+  WriteSearchState(state);
+  if (!WriteFileAtomically(CheckpointFile, CheckpointImage(state.str())))
+    cerr << "Warning: Could not write checkpoint file " << CheckpointFile << endl;
+}
+
+
+void TSearch::ReadCheckpointFile(void)
+{
+  if (CheckpointWriter != NULL) CheckpointWriter->Flush();
+  string state;
+  if (ReadCheckpointImage(CheckpointFile, state) != 1) {
+    cerr << "Error: Cannot resume from checkpoint file " << CheckpointFile << endl;
+    exit(0);
+  }
+  istringstream bifs(state, ios::binary);
+  ReadSearchState(bifs);
+}
+
+
+// Copy the state of the search into memory and leave the checksum, the
+// write and the sync to the background writer
+
+void TSearch::WriteCheckpointFileAsync(void)
+{
+  ostringstream state(ios::binary);
+  WriteSearchState(state);
+  string snapshot = state.str();
+  if (CheckpointWriter == NULL) CheckpointWriter = new TCheckpointWriter;
+  CheckpointWriter->Submit(CheckpointFile, snapshot);
+}
+
+
+// The background checkpoint writer
+
+TCheckpointWriter::TCheckpointWriter(void)
+{
+  pthread_mutex_init(&lock, NULL);
+  pthread_cond_init(&wake, NULL);
+  pthread_cond_init(&idle, NULL);
+  started = quit = pending = busy = 0;
+}
+
+TCheckpointWriter::~TCheckpointWriter()
+{
+  if (started) {
+    Flush();
+    pthread_mutex_lock(&lock);
+    quit = 1;
+    pthread_cond_signal(&wake);
+    pthread_mutex_unlock(&lock);
+    pthread_join(thread, NULL);
+  }
+  pthread_cond_destroy(&idle);
+  pthread_cond_destroy(&wake);
+  pthread_mutex_destroy(&lock);
+}
+
+void TCheckpointWriter::Submit(const string &path, string &state)
+{
+  pthread_mutex_lock(&lock);
+  if (!started) {
+    int rc = pthread_create(&thread, NULL, WriterMain, (void *)this);
+    if (rc) {cerr << "Thread creation failed: " << rc << endl; exit(-1);}
+    started = 1;
+  }
+  pendingPath = path;
+  pendingState.swap(state);
+  pending = 1;
+  pthread_cond_signal(&wake);
+  pthread_mutex_unlock(&lock);
+}
+
+void TCheckpointWriter::Flush(void)
+{
+  pthread_mutex_lock(&lock);
+  while (pending || busy)
+    pthread_cond_wait(&idle, &lock);
+  pthread_mutex_unlock(&lock);
+}
+
+void *TCheckpointWriter::WriterMain(void *arg)
+{
+  TCheckpointWriter *w = (TCheckpointWriter *)arg;
+  string path, state;
+  pthread_mutex_lock(&w->lock);
+  while (1) {
+    while (!w->pending && !w->quit)
+      pthread_cond_wait(&w->wake, &w->lock);
+    if (!w->pending) break;
+    path = w->pendingPath;
+    state.swap(w->pendingState);
+    w->pending = 0;
+    w->busy = 1;
+    pthread_mutex_unlock(&w->lock);
+    if (!WriteFileAtomically(path, CheckpointImage(state)))
+      cerr << "Warning: Could not write checkpoint file " << path << endl;
+    pthread_mutex_lock(&w->lock);
+    w->busy = 0;
+    if (!w->pending) pthread_cond_broadcast(&w->idle);
+  }
+  pthread_mutex_unlock(&w->lock);
+  return NULL;
+}
+
+
+// Write the state of the search
+
+void TSearch::WriteSearchState(ostream &bofs)
+{
   int i;
   double d;
 
@@ -888,6 +1788,7 @@ void TSearch::WriteCheckpointFile(void)
 	switch (RepMode) {
 		case HILL_CLIMBING: i = 1; break;
 		case GENETIC_ALGORITHM: i = 2; break;
+		case CMA_ES: i = 3; break;
 		default: cerr << "Invalid reproduction mode" << endl; exit(0);
 	}
   bofs.write((const char*) &(i), sizeof(i));
@@ -926,12 +1827,53 @@ void TSearch::WriteCheckpointFile(void)
   // Write out the random state for each individual in the population
   for (int i = 1; i <= PopulationSize(); i++)
     RandomStates[i].BinaryWriteRandomState(bofs);
+	// Write the common random numbers flag and the generation's random state
+  bofs.write((const char*) &(CommonTrials), sizeof(CommonTrials));
+  TrialState.BinaryWriteRandomState(bofs);
+  bofs.write((const char*) &(FidelityFrac), sizeof(FidelityFrac));
+	// Write the surrogate screening settings and the surrogate
+  bofs.write((const char*) &(ScreenCandidates), sizeof(ScreenCandidates));
+  bofs.write((const char*) &(HonestFrac), sizeof(HonestFrac));
+  bofs.write((const char*) &(SurrogateTrusted), sizeof(SurrogateTrusted));
+  bofs.write((const char*) &(SurrogateCorr), sizeof(SurrogateCorr));
+  Surrogate.WriteState(bofs);
+	// Write the CMA-ES settings and, once it has started, its state
+	switch (CMARestartMode) {
+		case NO_RESTARTS: i = 1; break;
+		case IPOP: i = 2; break;
+		case BIPOP: i = 3; break;
+		default: cerr << "Invalid restart mode" << endl; exit(0);
+	}
+  bofs.write((const char*) &(i), sizeof(i));
+  bofs.write((const char*) &(CMAInitialSigma), sizeof(CMAInitialSigma));
+  bofs.write((const char*) &(CMAMaxRestarts), sizeof(CMAMaxRestarts));
+  i = (CMASigma > 0.0);
+  bofs.write((const char*) &(i), sizeof(i));
+  if (!i) return;
+  bofs.write((const char*) &(CMABaseLambda), sizeof(CMABaseLambda));
+  bofs.write((const char*) &(CMARunGen), sizeof(CMARunGen));
+  bofs.write((const char*) &(CMARestarts), sizeof(CMARestarts));
+  bofs.write((const char*) &(CMALargeRuns), sizeof(CMALargeRuns));
+  bofs.write((const char*) &(CMALargeRegime), sizeof(CMALargeRegime));
+  bofs.write((const char*) &(CMARunEvals), sizeof(CMARunEvals));
+  bofs.write((const char*) &(CMALargeEvals), sizeof(CMALargeEvals));
+  bofs.write((const char*) &(CMASmallEvals), sizeof(CMASmallEvals));
+  bofs.write((const char*) &(CMASigma), sizeof(CMASigma));
+  CMAMean.BinaryWriteVector(bofs);
+  CMAPathC.BinaryWriteVector(bofs);
+  CMAPathSigma.BinaryWriteVector(bofs);
+  for (int i = 1; i <= vectorSize; i++)
+    bofs.write((const char*) &(CMACov[i][1]), vectorSize * sizeof(double));
+  i = CMAHistory.size();
+  bofs.write((const char*) &(i), sizeof(i));
+  if (i > 0) bofs.write((const char*) &(CMAHistory[0]), i * sizeof(double));
 }
 
 
-void TSearch::ReadCheckpointFile(void)
+// Read the state of the search
+
+void TSearch::ReadSearchState(istream &bifs)
 {
-  ifstream bifs("search.cpt", ios::binary);
   int i;
   double d;
   TVector<int> iv;
@@ -959,6 +1901,7 @@ void TSearch::ReadCheckpointFile(void)
 	switch (i) {
 		case 1: SetReproductionMode(HILL_CLIMBING);break;
 		case 2: SetReproductionMode(GENETIC_ALGORITHM);break;
+		case 3: SetReproductionMode(CMA_ES);break;
 		default: cerr << "Invalid reproduction mode" << endl; exit(0);
 	}
 	// Read the crossover mode
@@ -1002,4 +1945,52 @@ void TSearch::ReadCheckpointFile(void)
   // Read in the random state for each individual in the populaton
   for (int i = 1; i <= PopulationSize(); i++)
     RandomStates[i].BinaryReadRandomState(bifs);
+	// Read the common random numbers flag and the generation's random state
+  bifs.read((char*) &(CommonTrials), sizeof(CommonTrials));
+  TrialState.BinaryReadRandomState(bifs);
+  bifs.read((char*) &(d), sizeof(d));
+  SetLowFidelityFraction(d);
+	// Read the surrogate screening settings and the surrogate
+  bifs.read((char*) &(i), sizeof(i));
+  SetScreeningCandidates(i);
+  bifs.read((char*) &(d), sizeof(d));
+  SetHonestFraction(d);
+  bifs.read((char*) &(SurrogateTrusted), sizeof(SurrogateTrusted));
+  bifs.read((char*) &(SurrogateCorr), sizeof(SurrogateCorr));
+  Surrogate.ReadState(bifs);
+	// Read the CMA-ES settings and, if it had started, its state
+	bifs.read((char*) &(i), sizeof(i));
+	switch (i) {
+		case 1: SetRestartMode(NO_RESTARTS);break;
+		case 2: SetRestartMode(IPOP);break;
+		case 3: SetRestartMode(BIPOP);break;
+		default: cerr << "Invalid restart mode" << endl; exit(0);
+	}
+  bifs.read((char*) &(d), sizeof(d));
+  SetInitialStepSize(d);
+  bifs.read((char*) &(i), sizeof(i));
+  SetMaxRestarts(i);
+  bifs.read((char*) &(i), sizeof(i));
+  if (!i) {CMASigma = 0.0; return;}
+  bifs.read((char*) &(CMABaseLambda), sizeof(CMABaseLambda));
+  bifs.read((char*) &(CMARunGen), sizeof(CMARunGen));
+  bifs.read((char*) &(CMARestarts), sizeof(CMARestarts));
+  bifs.read((char*) &(CMALargeRuns), sizeof(CMALargeRuns));
+  bifs.read((char*) &(CMALargeRegime), sizeof(CMALargeRegime));
+  bifs.read((char*) &(CMARunEvals), sizeof(CMARunEvals));
+  bifs.read((char*) &(CMALargeEvals), sizeof(CMALargeEvals));
+  bifs.read((char*) &(CMASmallEvals), sizeof(CMASmallEvals));
+  bifs.read((char*) &(CMASigma), sizeof(CMASigma));
+  CMAMean.BinaryReadVector(bifs);
+  CMAPathC.BinaryReadVector(bifs);
+  CMAPathSigma.BinaryReadVector(bifs);
+  CMACov.SetBounds(1, vectorSize, 1, vectorSize);
+  for (int i = 1; i <= vectorSize; i++)
+    bifs.read((char*) &(CMACov[i][1]), vectorSize * sizeof(double));
+  bifs.read((char*) &(i), sizeof(i));
+  CMAHistory.resize(i);
+  if (i > 0) bifs.read((char*) &(CMAHistory[0]), i * sizeof(double));
+  // The eigendecomposition is recomputed rather than stored; it is a
+  // function of the covariance matrix alone
+  DecomposeCMACovariance();
 }
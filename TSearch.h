@@ -9,10 +9,16 @@
 #pragma once
 
 #include "VectorMatrix.h"
+#include "Reduction.h"
 #include "random.h"
+#include "EvolutionLog.h"
+#include "Surrogate.h"
+#include <string>
+#include <vector>
 #ifdef THREADED_SEARCH
-  #include <pthread.h>
+  #include "ThreadPool.h"
 #endif
+#include <pthread.h>
 
 using namespace std;
 
@@ -56,13 +62,42 @@ inline double InverseMapSearchParameter(double x, double min, double max)
 }
 
 
+// The version of the checkpoint file format
+
+const int CheckpointVersion = 5;
+
+
+// A background thread that writes checkpoint files. The search hands it an
+// in-memory copy of its state and carries on; if a newer state arrives
+// before the previous one has been written, only the newer one is written.
+
+class TCheckpointWriter {
+	public:
+		TCheckpointWriter(void);
+		~TCheckpointWriter();
+		// Queue STATE (taken over by the writer) for writing to PATH
+		void Submit(const string &path, string &state);
+		// Wait until every submitted state has been written
+		void Flush(void);
+
+	private:
+		static void *WriterMain(void *arg);
+		pthread_t thread;
+		int started, quit, pending, busy;
+		pthread_mutex_t lock;
+		pthread_cond_t wake, idle;
+		string pendingPath, pendingState;
+};
+
+
 // *******************************
 // The TSearch class declaration
 // *******************************
 
 enum TSelectionMode {FITNESS_PROPORTIONATE,RANK_BASED};    // Supported selection modes
-enum TReproductionMode {HILL_CLIMBING, GENETIC_ALGORITHM}; // Supported reproduction modes
+enum TReproductionMode {HILL_CLIMBING, GENETIC_ALGORITHM, CMA_ES}; // Supported reproduction modes
 enum TCrossoverMode {UNIFORM, TWO_POINT};                  // Supported crossover modes
+enum TRestartMode {NO_RESTARTS, IPOP, BIPOP};              // Supported CMA-ES restart strategies
 
 class TSearch {
 	public:
@@ -73,7 +108,7 @@ class TSearch {
 		// Basic Accessors
 		int VectorSize(void) {return vectorSize;};
 		void SetVectorSize(int NewSize);
-    void SetRandomSeed(long seed) {rs.SetRandomSeed(seed);};
+    void SetRandomSeed(long seed) {rs.SetRandomSeed(seed); Surrogate.SetRandomSeed(seed + 1);};
 		// Search Mode Accessors
 		TSelectionMode SelectionMode(void) {return SelectMode;};
 		void SetSelectionMode(TSelectionMode newmode) {SelectMode = newmode;};
@@ -81,6 +116,30 @@ class TSearch {
 		void SetReproductionMode(TReproductionMode newmode) {RepMode = newmode;};
 		TCrossoverMode CrossoverMode(void) {return CrossMode;};
 		void SetCrossoverMode(TCrossoverMode newmode) {CrossMode = newmode;};
+		// CMA-ES accessors. The population size is the number of offspring of
+		// the first run; IPOP doubles it at each restart, and BIPOP alternates
+		// doubling runs with runs of smaller populations and step sizes.
+		// MaxRestarts limits the doubling restarts.
+		TRestartMode RestartMode(void) {return CMARestartMode;};
+		void SetRestartMode(TRestartMode newmode) {CMARestartMode = newmode;};
+		double InitialStepSize(void) {return CMAInitialSigma;};
+		void SetInitialStepSize(double NewSigma);
+		int MaxRestarts(void) {return CMAMaxRestarts;};
+		void SetMaxRestarts(int NewMax);
+		int Restarts(void) {return CMARestarts;};
+		double StepSize(void) {return CMASigma;};
+		// Surrogate screening (GA and hill climbing). With CANDIDATES > 1, each
+		// mutated child is chosen from that many mutants of its parent by a
+		// surrogate model trained on every evaluation so far. A child is left
+		// unscreened with probability HonestFraction, and the model is only
+		// trusted while its predictions for those children correlate with
+		// their evaluated performance.
+		int ScreeningCandidates(void) {return ScreenCandidates;};
+		void SetScreeningCandidates(int n);
+		double HonestFraction(void) {return HonestFrac;};
+		void SetHonestFraction(double f);
+		TSurrogate &SurrogateModel(void) {return Surrogate;};
+		double SurrogateCorrelation(void) {return SurrogateCorr;};
 
 		void SetGeneration(int newGen) {
         Gen = newGen;
@@ -107,11 +166,40 @@ class TSearch {
 		void SetSearchConstraint(int Flag);
 		int ReEvaluationFlag(void) {return ReEvalFlag;};
 		void SetReEvaluationFlag(int flag) {ReEvalFlag = flag;};
+		// With common random numbers, every individual evaluated in a generation
+		// is given a copy of the same random state, drawn afresh each generation,
+		// so all of them face the same trial conditions. The survivors of a
+		// generation are re-evaluated on the new conditions, as with ReEvaluationFlag.
+		int CommonRandomNumbers(void) {return CommonTrials;};
+		void SetCommonRandomNumbers(int flag) {CommonTrials = flag;};
+		// Multi-fidelity evaluation: with a low-fidelity function and a fraction
+		// below 1, each individual is first evaluated by the low-fidelity
+		// function, and only the best FRACTION of them are evaluated in full.
+		// The correlation between the two over those is reported each generation.
+		double LowFidelityFraction(void) {return FidelityFrac;};
+		void SetLowFidelityFraction(double f);
+		double FidelityCorrelation(void) {return FidelityCorr;};
+		int TrialParallelism(void) {return TrialParallel;};
+#ifdef THREADED_SEARCH
+		int ThreadCount(void) {return SharedThreadPool().ThreadCount();};
+		void SetThreadCount(int threads) {SharedThreadPool().SetThreadCount(threads);};
+#endif
+		void SetTrialParallelism(int flag) {TrialParallel = flag;};
 		double CheckpointInterval(void) {return CheckpointInt;};
 		void SetCheckpointInterval(int NewFreq);
+		const string &CheckpointFileName(void) {return CheckpointFile;};
+		void SetCheckpointFileName(const string &path) {CheckpointFile = path;};
+		int AsyncCheckpointing(void) {return AsyncCheckpoint;};
+		void SetAsyncCheckpointing(int flag);
+		// Per-generation records go to LOG (not owned by the search) if it is not NULL
+		TEvolutionLog *EvolutionLog(void) {return EvolLog;};
+		void SetEvolutionLog(TEvolutionLog *log) {EvolLog = log;};
 		// Function Pointer Accessors
+		// (a new function also discards the surrogate's training data)
 		void SetEvaluationFunction(double (*EvalFn)(TVector<double> &v, RandomState &rs))
-			{EvaluationFunction = EvalFn;};
+			{EvaluationFunction = EvalFn; Surrogate.Clear(); SurrogateTrusted = 1;};
+		void SetLowFidelityFunction(double (*LowFn)(TVector<double> &v, RandomState &rs))
+			{LowFidelityFunction = LowFn;};
 		void SetBestActionFunction(void (*BestFn)(int Generation,TVector<double> &v))
 			{BestActionFunction = BestFn;};
 		void SetPopulationStatisticsDisplayFunction(void (*DisplayFn)(int Generation,double BestPerf,double AvgPerf,double PerfVar))
@@ -133,7 +221,11 @@ class TSearch {
 		void ResumeSearch(void);
 		// Input and output
     void WriteCheckpointFile(void);
+    void WriteCheckpointFileAsync(void);
     void ReadCheckpointFile(void);
+    int CheckpointAvailable(void);
+    void WriteSearchState(ostream &bofs);
+    void ReadSearchState(istream &bifs);
     //friend ostream& operator<<(ostream& os, TSearch& s);
 		//friend istream& operator>>(istream& is, TSearch& s);
 
@@ -151,20 +243,36 @@ class TSearch {
 		};
 		void RandomizeVector(TVector<double> &Vector);
 		void RandomizePopulation(void);
-		double EvaluateVector(TVector<double> &Vector, RandomState &rs);
-    friend void *EvaluatePopulationRange(void *arg);
-		void EvaluatePopulation(int start = 1);
+		double EvaluateVector(TVector<double> &Vector, RandomState &rs, int lowFidelity = 0);
+		double EvaluateIndividual(int i, int lowFidelity = 0);
+		void DrawTrialSet(void);
+    friend void EvaluateIndividualTask(int i, void *arg);
+		void EvaluatePopulation(int start = 1, int allowLowFidelity = 1);
+    friend void EvaluateSelectedTask(int k, void *arg);
+		void EvaluateSelected(int lowFidelity);
+		void EvaluatePopulationMultiFidelity(int start);
 		void SortPopulation(void);
 		void UpdatePopulationFitness(void);
 		void ReproducePopulationHillClimbing(void);
 		void ReproducePopulationGeneticAlgorithm(void);
+		void ReproducePopulationCMAES(void);
+		void InitializeCMA(void);
+		void StartCMARun(int lambda, double sigma);
+		void UpdateCMADistribution(void);
+		void DecomposeCMACovariance(void);
+		int CMARunConverged(void);
+		void RestartCMA(void);
+		void SampleCMAPopulation(void);
 		void MutateVector(TVector<double> &Vector);
+		void MutateChild(int i);
+		void UpdateSurrogate(int start);
 		void UniformCrossover(TVector<double> &v1, TVector<double> &v2);
 		void TwoPointCrossover(TVector<double> &v1, TVector<double> &v2);
 		void PrintPopulationStatistics(void);
 		void ReproducePopulation(void);
 		void UpdatePopulationStatistics(void);
 		void DisplayPopulationStatistics(void);
+		void LogPopulationStatistics(void);
 		int SearchTerminated(void);
 		void DisplaySearchResults(void);
 
@@ -194,17 +302,62 @@ class TSearch {
 		TVector<int> crossTemplate;
 		TVector<int> crossPoints;
 		TVector<int> ConstraintVector;
+		TVector<double> MutationVector;
 		int ReEvalFlag;
+		int CommonTrials;
+		RandomState TrialState;    // The random state shared by the current generation
+		int TrialParallel;
 		int CheckpointInt;
+		string CheckpointFile;
+		int AsyncCheckpoint;
+		TCheckpointWriter *CheckpointWriter;
+		TEvolutionLog *EvolLog;
+		// CMA-ES state: the mean, step size and covariance of the search
+		// distribution (with its eigenvectors and the square roots of its
+		// eigenvalues), the evolution paths, the best performance of each
+		// generation of the current run, and the restart bookkeeping
+		TRestartMode CMARestartMode;
+		double CMAInitialSigma;
+		int CMAMaxRestarts;
+		int CMABaseLambda;
+		TVector<double> CMAMean;
+		double CMASigma;
+		TMatrix<double> CMACov, CMAEigenvectors;
+		TVector<double> CMAEigenvalues;
+		TVector<double> CMAPathC, CMAPathSigma;
+		vector<double> CMAHistory;
+		int CMARunGen, CMARestarts, CMALargeRuns, CMALargeRegime;
+		long CMARunEvals, CMALargeEvals, CMASmallEvals;
+		// Surrogate screening: the model, the prediction made for each child
+		// (and whether it was honest, screened or not predicted at all), and
+		// how well the predictions of the last generation held up
+		int ScreenCandidates;
+		double HonestFrac;
+		TSurrogate Surrogate;
+		TVector<double> Predicted;
+		TVector<int> PredictionKind;
+		double SurrogateCorr;
+		int SurrogateTrusted;
+		long GenScreened;
+		// Multi-fidelity evaluation: the low-fidelity performances, whether each
+		// performance comes from a full-fidelity evaluation, the individuals
+		// being evaluated, and the correlation of the last generation
+		double FidelityFrac;
+		TVector<double> LowPerf;
+		TVector<int> FullFidelity;
+		vector<int> EvalIndices;
+		int EvalLowFidelity;
+		double FidelityCorr;
+		long GenLowEvaluations;
+		// Work done in the current generation, for the log
+		long GenEvaluations;
+		double EvalTime, ReproTime, CheckpointTime;
 		// Function Pointers
 		double (*EvaluationFunction)(TVector<double> &v, RandomState &rs);
+		double (*LowFidelityFunction)(TVector<double> &v, RandomState &rs);
 		void (*BestActionFunction)(int Generation,TVector<double> &v);
 		void (*PopulationStatisticsDisplayFunction)(int Generation,double BestPerf,double AvgPerf,double PerfVar);
 		int (*SearchTerminationFunction)(int Generation,double BestPerf,double AvgPerf,double PerfVar);
 		void (*SearchResultsDisplayFunction)(TSearch &s);
 };
 
-
-// A range specification structure for threaded evaluation
-
-struct PopRangeSpec {TSearch *search; int start; int end;};
@@ -0,0 +1,177 @@
+// ***********************************************************
+// Methods for the thread pool
+// ***********************************************************
+
+#include "ThreadPool.h"
+#include "Profile.h"
+#include <iostream>
+#include <cstdlib>
+#include <algorithm>
+
+
+// Set while the calling thread is running a task of some pool
+
+static thread_local int InPoolTask = 0;
+
+TThreadPool &SharedThreadPool(void)
+{
+	static TThreadPool pool;
+	return pool;
+}
+
+
+// *****************************
+// Constructors and Destructors
+// *****************************
+
+TThreadPool::TThreadPool(int threads)
+{
+	pthread_mutex_init(&callLock, NULL);
+	pthread_mutex_init(&lock, NULL);
+	pthread_cond_init(&wake, NULL);
+	pthread_cond_init(&done, NULL);
+	quit = 0;
+	threadCount = 1;
+	StartWorkers(threads);
+}
+
+TThreadPool::~TThreadPool()
+{
+	StopWorkers();
+	pthread_cond_destroy(&done);
+	pthread_cond_destroy(&wake);
+	pthread_mutex_destroy(&lock);
+	pthread_mutex_destroy(&callLock);
+}
+
+
+// *******
+// Workers
+// *******
+
+void TThreadPool::SetThreadCount(int threads)
+{
+	if (threads < 1) {
+		cerr << "Error: The thread count must be at least 1\n";
+		exit(0);
+	}
+	pthread_mutex_lock(&callLock);
+	if (threads != threadCount) {
+		StopWorkers();
+		StartWorkers(threads);
+	}
+	pthread_mutex_unlock(&callLock);
+}
+
+void TThreadPool::StartWorkers(int threads)
+{
+	if (threads < 1) threads = 1;
+	quit = 0;
+	workers.resize(threads - 1);
+	for (int i = 0; i < threads - 1; i++) {
+		int rc = pthread_create(&workers[i], NULL, WorkerMain, (void *)this);
+		if (rc) {cerr << "Thread creation failed: " << rc << endl; exit(-1);}
+	}
+	threadCount = threads;
+}
+
+void TThreadPool::StopWorkers(void)
+{
+	pthread_mutex_lock(&lock);
+	quit = 1;
+	pthread_cond_broadcast(&wake);
+	pthread_mutex_unlock(&lock);
+	for (size_t i = 0; i < workers.size(); i++)
+		pthread_join(workers[i], NULL);
+	workers.clear();
+	threadCount = 1;
+}
+
+void *TThreadPool::WorkerMain(void *arg)
+{
+	TThreadPool *pool = (TThreadPool *)arg;
+	pthread_mutex_lock(&pool->lock);
+	while (1) {
+		while (!pool->quit && pool->loops.empty())
+			pthread_cond_wait(&pool->wake, &pool->lock);
+		if (pool->quit) break;
+		pool->RunTask(pool->loops[0]);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+
+// *************
+// Parallel loops
+// *************
+
+// The loop to take an index from: PREFERRED if it has unclaimed indices, else
+// the oldest loop that has (NULL if none). Called with the lock held.
+
+TThreadPool::TLoop *TThreadPool::ClaimableLoop(TLoop *preferred)
+{
+	if (preferred->next <= preferred->last) return preferred;
+	return loops.empty() ? NULL : loops[0];
+}
+
+// Claim the next index of LOOP and run it. Called with the lock held, which
+// is released while the task runs.
+
+void TThreadPool::RunTask(TLoop *loop)
+{
+	int i = loop->next++;
+	if (loop->next > loop->last)
+		loops.erase(find(loops.begin(), loops.end(), loop));
+	pthread_mutex_unlock(&lock);
+	int outer = InPoolTask;
+	InPoolTask = 1;
+	{
+		PROFILE_TASK();
+		(*loop->task)(i, loop->arg);
+	}
+	InPoolTask = outer;
+	pthread_mutex_lock(&lock);
+	if (--loop->unfinished == 0) pthread_cond_broadcast(&done);
+}
+
+void TThreadPool::ParallelFor(int start, int end, TParallelTask fn, void *arg)
+{
+	// Run nested loops in place
+	if (InPoolTask) {
+		for (int i = start; i <= end; i++) (*fn)(i, arg);
+		return;
+	}
+	// Without workers, the caller runs every index as a task of its own
+	if (threadCount <= 1) {
+		InPoolTask = 1;
+		for (int i = start; i <= end; i++) {
+			PROFILE_TASK();
+			(*fn)(i, arg);
+		}
+		InPoolTask = 0;
+		return;
+	}
+	// A single index runs on the caller, leaving the pool to any loop inside it
+	if (start >= end) {
+		for (int i = start; i <= end; i++) (*fn)(i, arg);
+		return;
+	}
+	TLoop loop;
+	loop.task = fn;
+	loop.arg = arg;
+	loop.next = start;
+	loop.last = end;
+	loop.unfinished = end - start + 1;
+	pthread_mutex_lock(&lock);
+	loops.push_back(&loop);
+	pthread_cond_broadcast(&wake);
+	pthread_cond_broadcast(&done);   // Callers waiting for their stragglers can help
+	// Work alongside the pool, then on other loops until the stragglers finish
+	while (loop.unfinished > 0) {
+		TLoop *l = ClaimableLoop(&loop);
+		if (l != NULL) RunTask(l);
+		else pthread_cond_wait(&done, &lock);
+	}
+	pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,80 @@
+// ***********************************************************
+// A persistent pool of worker threads for parallel loops
+//
+// The workers are created once and sleep between loops, so
+// evaluating a population or the trials of a single genotype
+// does not pay for thread creation every generation. The
+// calling thread takes part in each loop.
+//
+// Several threads may run loops at the same time (e.g., the
+// searches of a batch). The workers take indices from the
+// oldest unfinished loop first, so one search's generation
+// barrier does not leave the pool idle while another search
+// has work.
+// ***********************************************************
+
+#pragma once
+
+#include <pthread.h>
+#include <vector>
+
+using namespace std;
+
+// The default number of threads in the shared pool (including the caller)
+
+#ifndef THREAD_COUNT
+#define THREAD_COUNT 64
+#endif
+
+
+// The body of a parallel loop: called once for each index, with the
+// argument passed to ParallelFor
+
+typedef void (*TParallelTask)(int i, void *arg);
+
+
+// The TThreadPool class declaration
+
+class TThreadPool {
+	public:
+		// The constructor
+		TThreadPool(int threads = THREAD_COUNT);
+		// The destructor
+		~TThreadPool();
+		// Accessors
+		int ThreadCount(void) {return threadCount;};
+		void SetThreadCount(int threads);
+		// Call TASK(i, ARG) for every i in [START,END] and return when all calls
+		// have finished. Indices are handed out in increasing order to whichever
+		// thread is free, so TASK must only write to storage owned by index i.
+		// Loops started from inside a task run serially on the calling thread.
+		// While its own stragglers finish, the caller helps with other loops.
+		void ParallelFor(int start, int end, TParallelTask task, void *arg);
+
+	private:
+		// A loop in progress
+		struct TLoop {
+			TParallelTask task;
+			void *arg;
+			int next, last;     // The indices not yet claimed
+			int unfinished;     // The indices not yet finished
+		};
+		static void *WorkerMain(void *arg);
+		void StartWorkers(int threads);
+		void StopWorkers(void);
+		TLoop *ClaimableLoop(TLoop *preferred);
+		void RunTask(TLoop *loop);
+
+		int threadCount;
+		vector<pthread_t> workers;
+		pthread_mutex_t callLock;   // Serializes changes of the thread count
+		pthread_mutex_t lock;       // Protects the loop state below
+		pthread_cond_t wake, done;
+		int quit;
+		vector<TLoop *> loops;      // The loops with unclaimed indices, oldest first
+};
+
+
+// The pool shared by the search and the fitness functions
+
+TThreadPool &SharedThreadPool(void);
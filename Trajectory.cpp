@@ -0,0 +1,287 @@
+// ***********************************************************
+// Methods for recording and reading trajectories
+// ***********************************************************
+
+#include "Trajectory.h"
+#include <sstream>
+
+static const char TrajectoryMagic[4] = {'T', 'T', 'R', 'J'};
+static const char TrialMagic[4] = {'T', 'R', 'I', 'L'};
+
+// The channels in record order, with their names and the names of their values
+
+static const int ChannelCount = 6;
+static const char *ChannelNames[ChannelCount] =
+	{"position", "heading", "neurons", "respiration", "sensors", "breathing"};
+static const char *ChannelColumns[ChannelCount] =
+	{"x y", "theta", "", "o2 co2", "left right", "rate phase passedout"};
+
+
+// ********
+// Channels
+// ********
+
+int TrajectoryChannelByName(const string &name)
+{
+	if (name == "all") return TRACE_ALL;
+	for (int c = 0; c < ChannelCount; c++)
+		if (name == ChannelNames[c]) return 1 << c;
+	return 0;
+}
+
+int TrajectoryChannelWidth(int channel, int neurons)
+{
+	switch (channel) {
+		case TRACE_POSITION: return 2;
+		case TRACE_HEADING: return 1;
+		case TRACE_NEURONS: return neurons;
+		case TRACE_RESPIRATION: return 2;
+		case TRACE_SENSORS: return 2;
+		case TRACE_BREATHING: return 3;
+		default: return 0;
+	}
+}
+
+int TrajectoryChannelOffset(int channels, int channel, int neurons)
+{
+	if (!(channels & channel)) return -1;
+	int offset = 0;
+	for (int c = 1; c < channel; c <<= 1)
+		if (channels & c) offset += TrajectoryChannelWidth(c, neurons);
+	return offset;
+}
+
+string TrajectoryColumnNames(int channels, int neurons)
+{
+	ostringstream names;
+	for (int c = 0; c < ChannelCount; c++) {
+		if (!(channels & (1 << c))) continue;
+		if ((1 << c) == TRACE_NEURONS)
+			for (int i = 1; i <= neurons; i++) names << (names.tellp() > 0 ? " " : "") << "n" << i;
+		else
+			names << (names.tellp() > 0 ? " " : "") << ChannelColumns[c];
+	}
+	return names.str();
+}
+
+static int RecordWidth(int channels, int neurons)
+{
+	int width = 0;
+	for (int c = 0; c < ChannelCount; c++)
+		if (channels & (1 << c)) width += TrajectoryChannelWidth(1 << c, neurons);
+	return width;
+}
+
+
+// ****************
+// Trajectory files
+// ****************
+
+TTrajectoryFile::TTrajectoryFile(void)
+{
+	file = NULL;
+	channels = neurons = width = 0;
+	pthread_mutex_init(&lock, NULL);
+}
+
+TTrajectoryFile::~TTrajectoryFile()
+{
+	Close();
+	pthread_mutex_destroy(&lock);
+}
+
+int TTrajectoryFile::Open(const string &path, int chans, int n)
+{
+	Close();
+	file = fopen(path.c_str(), "wb");
+	if (file == NULL) return 0;
+	setvbuf(file, NULL, _IOFBF, 1 << 20);
+	channels = chans;
+	neurons = n;
+	width = RecordWidth(channels, neurons);
+	int header[4] = {TrajectoryVersion, channels, neurons, width};
+	fwrite(TrajectoryMagic, 1, sizeof(TrajectoryMagic), file);
+	fwrite(header, sizeof(int), 4, file);
+	return 1;
+}
+
+void TTrajectoryFile::Close(void)
+{
+	if (file == NULL) return;
+	fclose(file);
+	file = NULL;
+}
+
+void TTrajectoryFile::WriteTrial(int trial, const TTrajectoryConditions &conditions, const vector<char> &block, int records)
+{
+	double c[6] = {conditions.x, conditions.y, conditions.theta, conditions.peakX, conditions.peakY, conditions.steepness};
+	int header[2] = {trial, records};
+	pthread_mutex_lock(&lock);
+	if (file != NULL) {
+		fwrite(TrialMagic, 1, sizeof(TrialMagic), file);
+		fwrite(header, sizeof(int), 2, file);
+		fwrite(c, sizeof(double), 6, file);
+		if (!block.empty()) fwrite(block.data(), 1, block.size(), file);
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+
+// *********
+// Recorders
+// *********
+
+TTrajectoryRecorder::TTrajectoryRecorder(TTrajectoryFile &f)
+{
+	file = &f;
+	width = file->Width();
+	recordSize = sizeof(double) + width * sizeof(float);
+	values.assign(width, 0.0f);
+	decimation = 1;
+	trigger = NULL;
+	triggerArg = NULL;
+	before = after = 0;
+	trial = records = 0;
+	steps = 0;
+	remaining = 0;
+	historyStart = historyCount = 0;
+}
+
+void TTrajectoryRecorder::SetDecimation(int d)
+{
+	decimation = d < 1 ? 1 : d;
+}
+
+void TTrajectoryRecorder::SetTrigger(TTrajectoryTrigger fn, void *arg, int b, int a)
+{
+	trigger = fn;
+	triggerArg = arg;
+	before = b < 0 ? 0 : b;
+	after = a < 0 ? 0 : a;
+	history.assign((size_t)before * recordSize, 0);
+}
+
+void TTrajectoryRecorder::BeginTrial(int t, const TTrajectoryConditions &c)
+{
+	trial = t;
+	conditions = c;
+	records = 0;
+	steps = 0;
+	remaining = 0;
+	historyStart = historyCount = 0;
+	block.clear();
+}
+
+void TTrajectoryRecorder::EndTrial(void)
+{
+	file->WriteTrial(trial, conditions, block, records);
+	block.clear();
+}
+
+void TTrajectoryRecorder::Append(vector<char> &buffer, double time, const float *v)
+{
+	size_t end = buffer.size();
+	buffer.resize(end + recordSize);
+	memcpy(&buffer[end], &time, sizeof(double));
+	memcpy(&buffer[end + sizeof(double)], v, width * sizeof(float));
+}
+
+// Keep the sample just taken if it is in a window, else remember it in case
+// a later sample opens one
+
+void TTrajectoryRecorder::Sample(double time)
+{
+	if (trigger == NULL) {
+		Append(block, time, values.data());
+		records++;
+		return;
+	}
+	if ((*trigger)(time, values.data(), triggerArg)) {
+		for (int i = 0; i < historyCount; i++) {
+			const char *r = &history[(size_t)((historyStart + i) % before) * recordSize];
+			block.insert(block.end(), r, r + recordSize);
+		}
+		records += historyCount;
+		historyStart = historyCount = 0;
+		Append(block, time, values.data());
+		records++;
+		remaining = after;
+	}
+	else if (remaining > 0) {
+		Append(block, time, values.data());
+		records++;
+		remaining--;
+	}
+	else if (before > 0) {
+		int slot = (historyStart + historyCount) % before;
+		if (historyCount < before) historyCount++;
+		else historyStart = (historyStart + 1) % before;
+		char *r = &history[(size_t)slot * recordSize];
+		memcpy(r, &time, sizeof(double));
+		memcpy(r + sizeof(double), values.data(), width * sizeof(float));
+	}
+}
+
+
+// *******
+// Readers
+// *******
+
+TTrajectoryReader::TTrajectoryReader(void)
+{
+	file = NULL;
+	channels = neurons = width = 0;
+}
+
+TTrajectoryReader::~TTrajectoryReader()
+{
+	Close();
+}
+
+int TTrajectoryReader::Open(const string &path)
+{
+	Close();
+	file = fopen(path.c_str(), "rb");
+	if (file == NULL) return 0;
+	char magic[4];
+	int header[4];
+	if (fread(magic, 1, 4, file) != 4 || memcmp(magic, TrajectoryMagic, 4) != 0 ||
+	    fread(header, sizeof(int), 4, file) != 4 || header[0] != TrajectoryVersion) {
+		Close();
+		return 0;
+	}
+	channels = header[1];
+	neurons = header[2];
+	width = header[3];
+	return 1;
+}
+
+void TTrajectoryReader::Close(void)
+{
+	if (file == NULL) return;
+	fclose(file);
+	file = NULL;
+}
+
+int TTrajectoryReader::ReadTrial(TTrajectoryTrial &t)
+{
+	if (file == NULL) return 0;
+	char magic[4];
+	int header[2];
+	double c[6];
+	if (fread(magic, 1, 4, file) != 4 || memcmp(magic, TrialMagic, 4) != 0 ||
+	    fread(header, sizeof(int), 2, file) != 2 || fread(c, sizeof(double), 6, file) != 6)
+		return 0;
+	t.trial = header[0];
+	t.conditions.x = c[0]; t.conditions.y = c[1]; t.conditions.theta = c[2];
+	t.conditions.peakX = c[3]; t.conditions.peakY = c[4]; t.conditions.steepness = c[5];
+	int records = header[1];
+	t.time.resize(records);
+	t.values.resize((size_t)records * width);
+	for (int r = 0; r < records; r++) {
+		if (fread(&t.time[r], sizeof(double), 1, file) != 1 ||
+		    (width > 0 && fread(&t.values[(size_t)r * width], sizeof(float), width, file) != (size_t)width))
+			return 0;
+	}
+	return 1;
+}
@@ -0,0 +1,192 @@
+// ***********************************************************
+// Recording the trajectories of agents
+//
+// A TTrajectoryRecorder samples selected channels of an agent
+// (position, heading, neuron states, O2 and CO2, the chemical
+// sensors, breathing) while it is simulated: every DECIMATION-th
+// step and, if a trigger is set, only in windows around the
+// samples where the trigger fires. A trial is buffered in memory
+// and appended to a TTrajectoryFile as one binary block when it
+// ends, so the trials of a parallel loop can share one file.
+// TTrajectoryReader reads the trials back.
+//
+// The file (in the byte order of the machine that wrote it):
+//   "TTRJ" int version, channels, neurons, width
+//   for each trial:
+//   "TRIL" int trial, records  double conditions[6]
+//          records x (double time, float values[width])
+// ***********************************************************
+
+#pragma once
+
+#include "Sniffer.h"
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+const int TrajectoryVersion = 1;
+
+// The channels that can be recorded (bit flags), in the order they
+// appear in a record. The neurons channel holds the state of every
+// neuron, and breathing holds the rate, the phase and whether the
+// agent has passed out.
+
+enum TTrajectoryChannel {TRACE_POSITION = 1, TRACE_HEADING = 2, TRACE_NEURONS = 4, TRACE_RESPIRATION = 8,
+                         TRACE_SENSORS = 16, TRACE_BREATHING = 32, TRACE_ALL = 63};
+
+// The channel called NAME ("position", ..., "all"), or 0 if there is none
+int TrajectoryChannelByName(const string &name);
+// The number of values of CHANNEL
+int TrajectoryChannelWidth(int channel, int neurons);
+// The offset of CHANNEL in a record of CHANNELS (-1 if it is not recorded)
+int TrajectoryChannelOffset(int channels, int channel, int neurons);
+// The names of the values in a record, separated by spaces
+string TrajectoryColumnNames(int channels, int neurons);
+
+// The conditions of a trial: start position and heading, source position and steepness
+
+struct TTrajectoryConditions {
+	double x, y, theta, peakX, peakY, steepness;
+};
+
+// A trigger is called with the time and values of each sample and returns
+// nonzero for the samples that open a window
+
+typedef int (*TTrajectoryTrigger)(double time, const float *values, void *arg);
+
+
+// The TTrajectoryFile class declaration
+
+class TTrajectoryFile {
+	public:
+		// The constructor
+		TTrajectoryFile(void);
+		// The destructor (closes the file)
+		~TTrajectoryFile();
+		// Create PATH for trials recording CHANNELS of agents with NEURONS
+		// neurons. Returns 0 on failure.
+		int Open(const string &path, int channels, int neurons);
+		void Close(void);
+		int IsOpen(void) {return file != NULL;};
+		// Accessors
+		int Channels(void) {return channels;};
+		int Neurons(void) {return neurons;};
+		int Width(void) {return width;};
+		// Append a trial of RECORDS records held in BLOCK (safe to call
+		// from several threads)
+		void WriteTrial(int trial, const TTrajectoryConditions &conditions, const vector<char> &block, int records);
+
+	private:
+		FILE *file;
+		int channels, neurons, width;
+		pthread_mutex_t lock;
+};
+
+
+// The TTrajectoryRecorder class declaration
+
+class TTrajectoryRecorder {
+	public:
+		// The constructor (the trials are appended to FILE)
+		TTrajectoryRecorder(TTrajectoryFile &file);
+		// Record every DECIMATION-th step
+		void SetDecimation(int decimation);
+		int Decimation(void) {return decimation;};
+		// Record only the BEFORE samples up to a sample where TRIGGER fires, that
+		// sample and the AFTER samples following it (NULL records every sample)
+		void SetTrigger(TTrajectoryTrigger trigger, void *arg, int before, int after);
+		// Start and finish a trial
+		void BeginTrial(int trial, const TTrajectoryConditions &conditions);
+		void EndTrial(void);
+		// Take a step of the trial (called once per simulation step)
+		template<class Real> void Record(double time, TSniffer<Real> &agent);
+
+	private:
+		void Sample(double time);
+		void Append(vector<char> &buffer, double time, const float *values);
+
+		TTrajectoryFile *file;
+		int width, recordSize, decimation;
+		TTrajectoryTrigger trigger;
+		void *triggerArg;
+		int before, after;
+		int trial, records;
+		long steps;
+		int remaining;                 // The samples left in the open window
+		TTrajectoryConditions conditions;
+		vector<float> values;
+		vector<char> block;            // The records of the trial
+		vector<char> history;          // The last BEFORE samples (a ring)
+		int historyStart, historyCount;
+};
+
+// Sample the channels of AGENT at TIME if this step is recorded
+
+template<class Real>
+void TTrajectoryRecorder::Record(double time, TSniffer<Real> &agent)
+{
+	if (steps++ % decimation != 0) return;
+	int channels = file->Channels(), k = 0;
+	if (channels & TRACE_POSITION) {
+		values[k++] = agent.posX;
+		values[k++] = agent.posY;
+	}
+	if (channels & TRACE_HEADING) values[k++] = agent.theta;
+	if (channels & TRACE_NEURONS)
+		for (int i = 1; i <= file->Neurons(); i++) values[k++] = agent.NervousSystem.NeuronState(i);
+	if (channels & TRACE_RESPIRATION) {
+		values[k++] = agent.oxygenLevel;
+		values[k++] = agent.co2Level;
+	}
+	if (channels & TRACE_SENSORS) {
+		values[k++] = agent.leftSensor;
+		values[k++] = agent.rightSensor;
+	}
+	if (channels & TRACE_BREATHING) {
+		double rate = agent.GetBreathingRate();
+		values[k++] = rate;
+		values[k++] = sin(time / 10.0 * 2 * M_PI * rate);
+		values[k++] = agent.is_passed_out ? 1 : 0;
+	}
+	Sample(time);
+}
+
+
+// A trial read back from a file
+
+struct TTrajectoryTrial {
+	int trial;
+	TTrajectoryConditions conditions;
+	vector<double> time;
+	vector<float> values;   // Records x width
+	int Records(void) {return time.size();};
+};
+
+
+// The TTrajectoryReader class declaration
+
+class TTrajectoryReader {
+	public:
+		// The constructor
+		TTrajectoryReader(void);
+		// The destructor (closes the file)
+		~TTrajectoryReader();
+		// Open a file written by TTrajectoryFile. Returns 0 on failure.
+		int Open(const string &path);
+		void Close(void);
+		// Accessors
+		int Channels(void) {return channels;};
+		int Neurons(void) {return neurons;};
+		int Width(void) {return width;};
+		// Read the next trial into T. Returns 0 at the end of the file.
+		int ReadTrial(TTrajectoryTrial &t);
+
+	private:
+		FILE *file;
+		int channels, neurons, width;
+};
@@ -0,0 +1,170 @@
+// ***********************************************************
+// A cache of the states trials reach at the end of their transient
+//
+// Fitness is measured only after a long transient, and a genotype
+// evaluated again on the same trial conditions passes through the
+// same transient. The cache keeps the state at the end of the
+// transient, keyed by the genotype and the trial's conditions, so
+// that the later evaluation can resume from it. The conditions must
+// include everything else the transient depends on (the step size,
+// the length of the transient, the integrator). The most recent
+// CAPACITY states are kept, and the cache is shared by the
+// evaluation threads.
+//
+// SNAPSHOT is the type of the stored state. It is copied in and out
+// with its copy constructor and assignment operator.
+// ***********************************************************
+
+#pragma once
+
+#include "VectorMatrix.h"
+#include "Arena.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+
+// The TTransientCache class declaration
+
+template<class Snapshot>
+class TTransientCache {
+	public:
+		// The constructor
+		TTransientCache(void) {capacity = next = 0; pthread_mutex_init(&lock, NULL);};
+		// The destructor
+		~TTransientCache() {Clear(); pthread_mutex_destroy(&lock);};
+		// The number of states kept (0 disables the cache). Changing it empties
+		// the cache, so it must not be changed while evaluations are running.
+		int Capacity(void) {return capacity;};
+		void SetCapacity(int n);
+		// Copy the state stored for GENOTYPE under CONDITIONS into S. Returns 0
+		// if there is none.
+		int Lookup(TVector<double> &genotype, const vector<double> &conditions, Snapshot &s);
+		// Store S as the state of GENOTYPE under CONDITIONS
+		void Store(TVector<double> &genotype, const vector<double> &conditions, Snapshot &s);
+		void Clear(void);
+
+	private:
+		struct Entry {uint64_t hash; vector<double> key; Snapshot *snapshot;};
+		static void MakeKey(TVector<double> &genotype, const vector<double> &conditions, vector<double> &key);
+		static uint64_t Hash(const vector<double> &key);
+
+		int capacity, next;
+		vector<Entry> entries;                  // A ring of CAPACITY entries
+		unordered_map<uint64_t, int> index;     // The entry holding each hash
+		pthread_mutex_t lock;
+};
+
+
+// ****************************
+// Constructors and Settings
+// ****************************
+
+template<class Snapshot>
+void TTransientCache<Snapshot>::SetCapacity(int n)
+{
+	if (n < 0) {
+		cerr << "Invalid transient cache capacity: " << n;
+		exit(0);
+	}
+	if (n == capacity) return;
+	Clear();
+	capacity = n;
+	entries.assign(capacity, Entry());
+	for (int i = 0; i < capacity; i++) entries[i].snapshot = NULL;
+}
+
+template<class Snapshot>
+void TTransientCache<Snapshot>::Clear(void)
+{
+	pthread_mutex_lock(&lock);
+	for (size_t i = 0; i < entries.size(); i++) {
+		delete entries[i].snapshot;
+		entries[i].snapshot = NULL;
+		entries[i].key.clear();
+	}
+	index.clear();
+	next = 0;
+	pthread_mutex_unlock(&lock);
+}
+
+
+// *********
+// The cache
+// *********
+
+// The key is the genotype followed by the conditions, compared exactly
+
+template<class Snapshot>
+void TTransientCache<Snapshot>::MakeKey(TVector<double> &genotype, const vector<double> &conditions, vector<double> &key)
+{
+	key.resize(genotype.Size() + conditions.size());
+	for (int k = 0; k < genotype.Size(); k++)
+		key[k] = genotype[genotype.LowerBound() + k];
+	for (size_t k = 0; k < conditions.size(); k++)
+		key[genotype.Size() + k] = conditions[k];
+}
+
+// FNV-1a over the bytes of the key
+
+template<class Snapshot>
+uint64_t TTransientCache<Snapshot>::Hash(const vector<double> &key)
+{
+	uint64_t h = 14695981039346656037ULL;
+	for (size_t k = 0; k < key.size(); k++) {
+		uint64_t bits;
+		memcpy(&bits, &key[k], sizeof(bits));
+		for (int b = 0; b < 8; b++, bits >>= 8)
+			h = (h ^ (bits & 0xff)) * 1099511628211ULL;
+	}
+	return h;
+}
+
+template<class Snapshot>
+int TTransientCache<Snapshot>::Lookup(TVector<double> &genotype, const vector<double> &conditions, Snapshot &s)
+{
+	if (capacity == 0) return 0;
+	vector<double> key;
+	MakeKey(genotype, conditions, key);
+	uint64_t h = Hash(key);
+	int found = 0;
+	pthread_mutex_lock(&lock);
+	typename unordered_map<uint64_t, int>::iterator it = index.find(h);
+	if (it != index.end() && entries[it->second].key == key) {
+		s = *entries[it->second].snapshot;
+		found = 1;
+	}
+	pthread_mutex_unlock(&lock);
+	return found;
+}
+
+// The new state replaces the oldest, and the copy is made on the heap since
+// it outlives the evaluation that stores it
+
+template<class Snapshot>
+void TTransientCache<Snapshot>::Store(TVector<double> &genotype, const vector<double> &conditions, Snapshot &s)
+{
+	if (capacity == 0) return;
+	TArenaSuspend heap;
+	vector<double> key;
+	MakeKey(genotype, conditions, key);
+	uint64_t h = Hash(key);
+	Snapshot *copy = new Snapshot(s);
+	pthread_mutex_lock(&lock);
+	Entry &e = entries[next];
+	if (e.snapshot != NULL) {
+		typename unordered_map<uint64_t, int>::iterator it = index.find(e.hash);
+		if (it != index.end() && it->second == next) index.erase(it);
+		delete e.snapshot;
+	}
+	e.hash = h;
+	e.key.swap(key);
+	e.snapshot = copy;
+	index[h] = next;
+	next = (next + 1) % capacity;
+	pthread_mutex_unlock(&lock);
+}
@@ -10,6 +10,7 @@
 #include <fstream>
 #include <cstdlib>
 #include <cstdarg>
+#include "Arena.h"
 
 using namespace std;
 
@@ -43,8 +44,8 @@ public:
 	void PushFront(EltType value);
 	void InitializeContents(EltType v1,...);
 	// Vector i/o
-	void BinaryWriteVector(ofstream& bofs);
-	void BinaryReadVector(ifstream& binfs);
+	void BinaryWriteVector(ostream& bofs);
+	void BinaryReadVector(istream& binfs);
 	// Overloaded operators
 	EltType &operator[](int index)
 	{
@@ -60,6 +61,7 @@ public:
 protected:
 	int lb, ub;
 	EltType *Vector;
+	int arenaflag;
 };
 
 
@@ -68,7 +70,7 @@ protected:
 template<class EltType>
 TVector<EltType>::TVector(void)
 {
-	lb = 1; ub = 0;
+	lb = 1; ub = 0; arenaflag = 0;
 }
 
 
@@ -77,7 +79,7 @@ TVector<EltType>::TVector(void)
 template<class EltType>
 TVector<EltType>::TVector(int LB, int UB)
 {
-	lb = 1; ub = 0;
+	lb = 1; ub = 0; arenaflag = 0;
 	SetBounds(LB,UB);
 }
 
@@ -87,7 +89,7 @@ TVector<EltType>::TVector(int LB, int UB)
 template<class EltType>
 TVector<EltType>::TVector(TVector<EltType> &v)
 {
-	lb = 1; ub = 0;
+	lb = 1; ub = 0; arenaflag = 0;
 	SetBounds(v.LowerBound(),v.UpperBound());
 	for (int i = lb; i <= ub; i++)
 		Vector[i] = v[i];
@@ -114,6 +116,7 @@ void TVector<EltType>::SetBounds(int newlb, int newub)
 	// Save the old info and init the new
 	EltType *OldVector = Vector;
 	int oldlb = lb, oldub = ub, oldlen = ub - lb + 1, len = newub - newlb + 1;
+	int oldarenaflag = arenaflag;
 	lb = newlb; ub = newub;
 	// No negative length vectors allowed!
 	if (len < 0) {
@@ -122,13 +125,13 @@ void TVector<EltType>::SetBounds(int newlb, int newub)
 	}
 	// Allocate the new storage and copy as much of the old info as possible
 	if (len != 0) {
-		Vector = new EltType[len] - lb;
+		Vector = ScratchAllocate<EltType>(len,arenaflag) - lb;
 		if (oldlen != 0)
 			for (int i = oldlb, j = lb; i <= oldub && j <= ub; i++,j++)
 				Vector[j] = OldVector[i];
 	}
 	// Recover the old storage
-	if (oldlen != 0) delete [] (OldVector + oldlb);
+	if (oldlen != 0) ScratchFree(OldVector + oldlb,oldarenaflag);
 }
 
 
@@ -222,7 +225,7 @@ istream& operator>>(istream& is, TVector<EltType>& v)
 // (Thanks to Chad Seys)
 
 template<class EltType>
-void TVector<EltType>::BinaryWriteVector(ofstream& bofs)
+void TVector<EltType>::BinaryWriteVector(ostream& bofs)
 {
 	int thisSize = ub-lb+1;
 	bofs.write((const char*) &(lb), sizeof(lb));
@@ -237,7 +240,7 @@ void TVector<EltType>::BinaryWriteVector(ofstream& bofs)
 }
 
 template<class EltType>
-void TVector<EltType>::BinaryReadVector(ifstream& bifs)
+void TVector<EltType>::BinaryReadVector(istream& bifs)
 {
 	int LB;
 	int UB;
@@ -307,6 +310,7 @@ public:
 protected:
 	int lb1, ub1, lb2, ub2, collen, rowlen;
 	EltType **Matrix;
+	int arenaflag, rowarenaflag;
 };
 
 
@@ -315,7 +319,7 @@ protected:
 template<class EltType>
 TMatrix<EltType>::TMatrix(void)
 {
-	lb1 = lb2 = 1; ub1 = ub2 = 0; collen = 0; rowlen = 0;
+	lb1 = lb2 = 1; ub1 = ub2 = 0; collen = 0; rowlen = 0; arenaflag = rowarenaflag = 0;
 }
 
 
@@ -325,7 +329,7 @@ template<class EltType>
 TMatrix<EltType>::TMatrix(int RowLowerBound, int RowUpperBound,
                           int ColumnLowerBound, int ColumnUpperBound)
 {
-	lb1 = lb2 = 1; ub1 = ub2 = 0; collen = 0; rowlen = 0;
+	lb1 = lb2 = 1; ub1 = ub2 = 0; collen = 0; rowlen = 0; arenaflag = rowarenaflag = 0;
 	SetBounds(RowLowerBound,RowUpperBound,ColumnLowerBound,ColumnUpperBound);
 }
 
@@ -335,7 +339,7 @@ TMatrix<EltType>::TMatrix(int RowLowerBound, int RowUpperBound,
 template<class EltType>
 TMatrix<EltType>::TMatrix(TMatrix<EltType> &m)
 {
-	lb1 = lb2 = 1; ub1 = ub2 = 0; collen = 0; rowlen = 0;
+	lb1 = lb2 = 1; ub1 = ub2 = 0; collen = 0; rowlen = 0; arenaflag = rowarenaflag = 0;
 	SetBounds(m.RowLowerBound(),m.RowUpperBound(),m.ColumnLowerBound(),m.ColumnUpperBound());
 	for (int i = lb1; i <= ub1; i++)
 		for (int j = lb2; j <= ub2; j++)
@@ -364,8 +368,8 @@ void TMatrix<EltType>::SetBounds(int newlb1, int newub1, int newlb2, int newub2)
 	if (collen != 0) {
 		if (rowlen != 0)
 			for (int i = lb1; i <= ub1; i++)
-				delete (Matrix[i] + lb2);
-		delete [] (Matrix + lb1);
+				ScratchFree(Matrix[i] + lb2,rowarenaflag);
+		ScratchFree(Matrix + lb1,arenaflag);
 	}
 	// Save the new bounds info
 	lb1 = newlb1; ub1 = newub1; lb2 = newlb2; ub2 = newub2;
@@ -377,10 +381,10 @@ void TMatrix<EltType>::SetBounds(int newlb1, int newub1, int newlb2, int newub2)
 	}
 	// If new storage is needed, allocate it
 	if (collen != 0) {
-		Matrix = new EltType*[collen] - lb1;
+		Matrix = ScratchAllocate<EltType *>(collen,arenaflag) - lb1;
 		if (rowlen != 0)
 			for (int i = lb1; i <= ub1; i++)
-				Matrix[i] = new EltType[rowlen] - lb2;
+				Matrix[i] = ScratchAllocate<EltType>(rowlen,rowarenaflag) - lb2;
 		else
 			for (int i = lb1; i <= ub1; i++)
 				Matrix[i] = NULL;
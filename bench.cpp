@@ -0,0 +1,398 @@
+// *******************************************************************************
+// Benchmarks for the simulation kernels
+//
+// Build and run with "make bench". Arguments:
+//   csv      print the results as CSV (benchmark,param,ns_per_op,ops_per_s)
+//            instead of a table, for tracking regressions
+//   <name>   run only the groups whose name contains <name>
+//            (sigmoid, ctrnn, sniffer, field, trial, fluid, random)
+// *******************************************************************************
+
+#include "CTRNN.h"
+#include "Sniffer.h"
+#include "OdorField.h"
+#include "Fluid.h"
+#include "random.h"
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Keep the optimizer from discarding benchmark results
+volatile double BenchSink;
+
+// Wall-clock time in seconds
+double BenchTime(void)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+// *******
+// Results
+// *******
+
+struct TBenchResult {
+	string name;
+	int param;
+	double nsPerOp;
+};
+
+vector<TBenchResult> BenchResults;
+int CSVOutput = 0;
+
+// PARAM is the size the benchmark was run at (circuit or grid size), or 0
+void Report(const char *name, int param, double seconds, long ops)
+{
+	TBenchResult r;
+	r.name = name;
+	r.param = param;
+	r.nsPerOp = 1e9 * seconds / ops;
+	BenchResults.push_back(r);
+	if (CSVOutput) return;
+	string label = name;
+	if (param > 0) label += " (" + to_string(param) + ")";
+	cout << setw(36) << left << label << setw(12) << right << fixed << setprecision(3) << r.nsPerOp << " ns/op";
+	cout << setw(16) << right << setprecision(0) << 1e9 / r.nsPerOp << " ops/s" << endl;
+}
+
+void Note(const string &text)
+{
+	if (!CSVOutput) cout << text << endl;
+}
+
+void WriteCSV(void)
+{
+	cout << "benchmark,param,ns_per_op,ops_per_s" << endl;
+	for (size_t i = 0; i < BenchResults.size(); i++) {
+		TBenchResult &r = BenchResults[i];
+		cout << r.name << "," << r.param << "," << setprecision(6) << r.nsPerOp << "," << 1e9 / r.nsPerOp << endl;
+	}
+}
+
+// The shortest time a measurement is allowed to take
+const double MinBenchTime = 0.25;
+
+// Time BODY(reps), which performs reps * OPSPERREP operations, with reps
+// growing until the run is long enough to time reliably
+template<class Body>
+void Measure(const char *name, int param, long opsPerRep, Body body)
+{
+	long reps = 1;
+	while (1) {
+		double start = BenchTime();
+		body(reps);
+		double elapsed = BenchTime() - start;
+		if (elapsed >= MinBenchTime) {
+			Report(name, param, elapsed, reps * opsPerRep);
+			return;
+		}
+		// Aim a little past the minimum time on the next try
+		long next = (elapsed > 0.0) ? (long)(reps * 1.2 * MinBenchTime / elapsed) : 2 * reps;
+		reps = (next > 2 * reps) ? next : 2 * reps;
+	}
+}
+
+
+// *******
+// Sigmoid
+// *******
+
+// The body of CTRNN::EulerStep with the sigmoid supplied as a template parameter
+
+template<double (*Sig)(double)>
+void EulerStepWith(CTRNN &c, double stepsize)
+{
+	for (int i = 1; i <= c.size; i++) {
+		double input = c.externalinputs[i];
+		for (int j = 1; j <= c.size; j++)
+			input += c.weights[j][i] * c.outputs[j];
+		c.states[i] += stepsize * c.Rtaus[i] * (input - c.states[i]);
+	}
+	for (int i = 1; i <= c.size; i++)
+		c.outputs[i] = Sig(c.gains[i] * (c.states[i] + c.biases[i]));
+}
+
+void RandomCircuit(CTRNN &c, int size, RandomState &rs)
+{
+	c.SetCircuitSize(size);
+	for (int i = 1; i <= size; i++) {
+		c.SetNeuronTimeConstant(i, rs.UniformRandom(1.0, 10.0));
+		c.SetNeuronBias(i, rs.UniformRandom(-8.0, 8.0));
+		c.SetNeuronExternalInput(i, rs.UniformRandom(-2.0, 2.0));
+		for (int j = 1; j <= size; j++)
+			c.SetConnectionWeight(i, j, rs.UniformRandom(-8.0, 8.0));
+	}
+}
+
+void BenchSigmoid(void)
+{
+	RandomState rs(1);
+	const int n = 4096;
+	double x[n], y[n];
+	for (int i = 0; i < n; i++) x[i] = rs.UniformRandom(-20.0, 20.0);
+
+	ostringstream note;
+	note << "Fast sigmoid: " << SigTabSize << " intervals on [" << -SigTabRange << "," << SigTabRange << "], max abs error ";
+	note << scientific << setprecision(3) << FastSigmoidMaxError();
+	Note(note.str());
+
+	// Throughput on a batch of inputs
+	Measure("sigma", 0, n, [&](long reps) {
+		for (long r = 0; r < reps; r++)
+			for (int i = 0; i < n; i++) y[i] = sigma(x[i]);
+		BenchSink = y[n/2];
+	});
+	Measure("fastsigmoid", 0, n, [&](long reps) {
+		for (long r = 0; r < reps; r++)
+			for (int i = 0; i < n; i++) y[i] = fastsigmoid(x[i]);
+		BenchSink = y[n/2];
+	});
+	Measure("FastSigmoidBatch", 0, n, [&](long reps) {
+		for (long r = 0; r < reps; r++) FastSigmoidBatch(x, y, n);
+		BenchSink = y[n/2];
+	});
+
+	// Inside the Euler step
+	for (int size = 4; size <= 8; size += 4) {
+		CTRNN c;
+		RandomCircuit(c, size, rs);
+		c.RandomizeCircuitState(0.0, 0.0);
+		Measure("EulerStep with sigma", size, 1, [&](long reps) {
+			for (long k = 0; k < reps; k++) EulerStepWith<sigma>(c, 0.01);
+			BenchSink = c.NeuronOutput(1);
+		});
+		c.RandomizeCircuitState(0.0, 0.0);
+		Measure("EulerStep with fastsigmoid", size, 1, [&](long reps) {
+			for (long k = 0; k < reps; k++) EulerStepWith<fastsigmoid>(c, 0.01);
+			BenchSink = c.NeuronOutput(1);
+		});
+	}
+}
+
+
+// *****
+// CTRNN
+// *****
+
+void BenchCTRNN(void)
+{
+	RandomState rs(2);
+	const int sizes[] = {2, 4, 8, 12, 16};
+	for (int k = 0; k < 5; k++) {
+		CTRNN c;
+		RandomCircuit(c, sizes[k], rs);
+		c.RandomizeCircuitState(0.0, 0.0);
+		Measure("CTRNN::EulerStep", sizes[k], 1, [&](long reps) {
+			for (long r = 0; r < reps; r++) c.EulerStep(0.01);
+			BenchSink = c.NeuronOutput(1);
+		});
+		c.RandomizeCircuitState(0.0, 0.0);
+		Measure("CTRNN::RK4Step", sizes[k], 1, [&](long reps) {
+			for (long r = 0; r < reps; r++) c.RK4Step(0.01);
+			BenchSink = c.NeuronOutput(1);
+		});
+	}
+}
+
+
+// *******
+// Sniffer
+// *******
+
+// An agent with random parameters in the ranges searched by main.cpp
+
+void RandomAgent(Sniffer &a, int size, RandomState &rs)
+{
+	RandomCircuit(a.NervousSystem, size, rs);
+	for (int i = 1; i <= a.sensorweights.Size(); i++)
+		a.SetSensorWeight(i, rs.UniformRandom(-8.0, 8.0));
+	a.Reset(20.0, 20.0, 0.0);
+}
+
+void BenchSniffer(void)
+{
+	RandomState rs(3);
+	for (int size = 2; size <= 8; size *= 2) {
+		Sniffer a(size);
+		RandomAgent(a, size, rs);
+		double time = 0.0;
+		Measure("Sniffer::SenseResp+Step", size, 1, [&](long reps) {
+			for (long r = 0; r < reps; r++) {
+				a.SenseResp(0.5, 0.51, time, ReferenceStepSize);
+				a.Step(ReferenceStepSize);
+				time += ReferenceStepSize;
+			}
+			BenchSink = a.posX;
+		});
+	}
+}
+
+
+// ***********
+// Odor fields
+// ***********
+
+// DistanceGradient as written in main.cpp (the reference for AnalyticOdorField)
+
+double DistanceGradient(double posX, double posY, double peakPosX, double peakPosY, double steepness = 1.5)
+{
+	double dx = std::abs(posX - peakPosX);
+	double dy = std::abs(posY - peakPosY);
+	double effective_distance = sqrt(dx * dx + dy * dy);
+	const double max_distance = sqrt(100.0 * 100.0 + 100.0 * 100.0);
+	double normalized_distance = effective_distance / max_distance;
+	return 1.0 - std::abs(normalized_distance) * steepness;
+}
+
+template<class Field>
+void MeasureField(const char *name, Field &field, const double *x, const double *y, int n)
+{
+	Measure(name, 0, n, [&](long reps) {
+		double sum = 0.0;
+		for (long r = 0; r < reps; r++)
+			for (int i = 0; i < n; i++) sum += field.Concentration(x[i], y[i]);
+		BenchSink = sum;
+	});
+}
+
+void BenchField(void)
+{
+	RandomState rs(4);
+	const int n = 4096;
+	double x[n], y[n];
+	for (int i = 0; i < n; i++) {
+		x[i] = rs.UniformRandom(0.0, 100.0);
+		y[i] = rs.UniformRandom(0.0, 100.0);
+	}
+	Measure("DistanceGradient", 0, n, [&](long reps) {
+		double sum = 0.0;
+		for (long r = 0; r < reps; r++)
+			for (int i = 0; i < n; i++) sum += DistanceGradient(x[i], y[i], 50.0, 50.0);
+		BenchSink = sum;
+	});
+	AnalyticOdorField analytic(50.0, 50.0, 1.5);
+	MeasureField("AnalyticOdorField", analytic, x, y, n);
+	RasterOdorField raster(analytic, 101, 101);
+	MeasureField("RasterOdorField", raster, x, y, n);
+}
+
+
+// *****************
+// The per-trial loop
+// *****************
+
+// The inner loop of ChemoRespTrial in main.cpp: sense the field at both
+// sensors, respire, move and accumulate the distance to the peak
+
+template<class Field>
+void MeasureTrialLoop(const char *name, int size, Field &field, RandomState &rs)
+{
+	Sniffer a(size);
+	RandomAgent(a, size, rs);
+	double time = 0.0, dist = 0.0;
+	Measure(name, size, 1, [&](long reps) {
+		for (long r = 0; r < reps; r++) {
+			field.Advance(time);
+			double left = field.Concentration(a.LeftSensorX(), a.LeftSensorY());
+			double right = field.Concentration(a.RightSensorX(), a.RightSensorY());
+			a.SenseResp(left, right, time, ReferenceStepSize);
+			a.Step(ReferenceStepSize);
+			double dx = a.posX - 50.0, dy = a.posY - 50.0;
+			dist += sqrt(dx * dx + dy * dy);
+			time += ReferenceStepSize;
+		}
+		BenchSink = dist;
+	});
+}
+
+void BenchTrial(void)
+{
+	RandomState rs(5);
+	AnalyticOdorField analytic(50.0, 50.0, 1.5);
+	for (int size = 2; size <= 8; size *= 2)
+		MeasureTrialLoop("trial step, analytic field", size, analytic, rs);
+	RasterOdorField raster(analytic, 101, 101);
+	MeasureTrialLoop("trial step, raster field", 4, raster, rs);
+}
+
+
+// *****
+// Fluid
+// *****
+
+void BenchFluid(void)
+{
+	const int sizes[] = {32, 64, 100, 128};
+	for (int k = 0; k < 4; k++) {
+		int n = sizes[k];
+		Fluid f(0.1, 0.0001, 0.0000001, n);
+		// A developed plume: emit and stir for a few steps first
+		for (int i = 0; i < 5; i++) {
+			f.addOdor(n/2, n/2, 10.0);
+			f.addVelocity(n/2, n/2, 2.0, 2.0);
+			f.step();
+		}
+		Measure("Fluid::step", n, 1, [&](long reps) {
+			for (long r = 0; r < reps; r++) f.step();
+			BenchSink = f.odor[f.IX(n/2, n/2)];
+		});
+		float a = f.dt * f.diff * (n - 2) * (n - 2);
+		Measure("Fluid::lin_solve", n, 1, [&](long reps) {
+			for (long r = 0; r < reps; r++) f.lin_solve(0, f.s, f.odor, a, 1 + 6 * a);
+			BenchSink = f.s[f.IX(n/2, n/2)];
+		});
+		Measure("Fluid::advect", n, 1, [&](long reps) {
+			for (long r = 0; r < reps; r++) f.advect(0, f.s, f.odor, f.Vx, f.Vy, f.dt);
+			BenchSink = f.s[f.IX(n/2, n/2)];
+		});
+	}
+}
+
+
+// ***********
+// RandomState
+// ***********
+
+void BenchRandom(void)
+{
+	RandomState rs(6);
+	const int n = 4096;
+	Measure("RandomState::ran1", 0, n, [&](long reps) {
+		double sum = 0.0;
+		for (long r = 0; r < reps * n; r++) sum += rs.ran1();
+		BenchSink = sum;
+	});
+	Measure("RandomState::UniformRandom", 0, n, [&](long reps) {
+		double sum = 0.0;
+		for (long r = 0; r < reps * n; r++) sum += rs.UniformRandom(-1.0, 1.0);
+		BenchSink = sum;
+	});
+	Measure("RandomState::GaussianRandom", 0, n, [&](long reps) {
+		double sum = 0.0;
+		for (long r = 0; r < reps * n; r++) sum += rs.GaussianRandom(0.0, 1.0);
+		BenchSink = sum;
+	});
+}
+
+
+int main(int argc, const char* argv[])
+{
+	string filter = "";
+	for (int i = 1; i < argc; i++) {
+		if (string(argv[i]) == "csv") CSVOutput = 1;
+		else filter = argv[i];
+	}
+	struct {const char *name; void (*run)(void);} groups[] = {
+		{"sigmoid", BenchSigmoid}, {"ctrnn", BenchCTRNN}, {"sniffer", BenchSniffer},
+		{"field", BenchField}, {"trial", BenchTrial}, {"fluid", BenchFluid}, {"random", BenchRandom}
+	};
+	for (size_t g = 0; g < sizeof(groups) / sizeof(groups[0]); g++)
+		if (filter.empty() || string(groups[g].name).find(filter) != string::npos)
+			(*groups[g].run)();
+	if (CSVOutput) WriteCSV();
+	return 0;
+}
@@ -15,20 +15,72 @@
 #include "random.h"
 #include <random>
 #include "Fluid.h"
+#include "OdorField.h"
+#include "Profile.h"
+#include "Config.h"
+#include "Trajectory.h"
+#include "LimitSet.h"
+#include "TransientCache.h"
 #include <iostream>
 #include <fstream>
+#include <iomanip>
 #include <string>
 #include <sstream>
+#include <vector>
+#include <atomic>
+#include <thread>
 #include <sys/stat.h>
 #include <unistd.h>
 
 #define PRINTOFILE
 
+// Uncomment the following line to run the fitness simulations in single precision
+//#define SINGLE_PRECISION
+
+#ifdef SINGLE_PRECISION
+typedef float SimReal;
+#else
+typedef double SimReal;
+#endif
+
 // Task params
-const double StepSize = 0.01;
-const double RunDuration = 6000; // 6000, 5500 transient
-const double TransDuration = 5500; // Transient duration 
-const double EvalDuration = RunDuration - TransDuration; // Evaluation duration
+double StepSize = ReferenceStepSize;
+TIntegrator Integrator = EULER;  // CTRNN integration method used in the fitness functions
+double RunDuration = 6000; // 6000, 5500 transient
+double TransDuration = 5500; // Transient duration 
+double EvalDuration = RunDuration - TransDuration; // Evaluation duration
+
+// Set the length of a trial and of its transient (fitness is measured over the rest)
+void SetTrialDuration(double run, double transient)
+{
+	RunDuration = run;
+	TransDuration = transient;
+	EvalDuration = run - transient;
+}
+
+// The time step, length and transient of a respiratory chemotaxis trial
+struct TrialTiming {double step, run, transient;};
+
+// The trial timing of the task
+TrialTiming FullTiming(void)
+{
+	TrialTiming t = {StepSize, RunDuration, TransDuration};
+	return t;
+}
+
+// The low-fidelity trials of multi-fidelity evaluation: a shorter transient
+// before the same evaluation window, at a coarser step
+double LowFidelityTransient = 500;
+double LowFidelityStepSize = 0.05;
+
+TrialTiming LowFidelityTiming(void)
+{
+	TrialTiming t = {LowFidelityStepSize, LowFidelityTransient + EvalDuration, LowFidelityTransient};
+	return t;
+}
+
+// The number of agent steps taken in ChemoRespTrial, for throughput measurements
+std::atomic<long> AgentSteps(0);
 
 const double SpaceHeight = 100.0;    // Size of the space
 const double SpaceWidth = 100.0; 
@@ -38,15 +90,38 @@ const double peakPositionY = 50.0;
 
 const double sensorOffset = 1.0; // Offset of the sensor from the center of the agent
 
-// EA params
-const int POPSIZE = 500;    //500 
-const int GENS = 1000;       //100
-const double MUTVAR = 0.2;
-const double CROSSPROB = 0.05;
-const double EXPECTED = 1.1;
-const double ELITISM = 0.02;
-
-const int Stage1Gens = 300;
+// Fluid-based odor plume params
+const float FluidStepSize = 0.1;
+const float FluidDiffusion = 0.0001;
+const float FluidViscosity = 0.0000001;
+const float OdorEmission = 10.0;
+
+// The steepness of the gradients the agents are tested on
+double MinSteepness = 0.1;
+double MaxSteepness = 2.0;
+double SteepnessStep = 0.5;
+
+// EA params (the defaults of the [search] settings)
+int POPSIZE = 500;    //500 
+int GENS = 1000;       //100
+double MUTVAR = 0.2;
+double CROSSPROB = 0.05;
+double EXPECTED = 1.1;
+double ELITISM = 0.02;
+TReproductionMode REPRODUCTION = GENETIC_ALGORITHM;
+TRestartMode RESTARTS = BIPOP;  // CMA-ES only
+double CMA_SIGMA = 0.5;         // The step size each CMA-ES run starts with
+int MAX_RESTARTS = 9;
+int SCREEN_CANDIDATES = 1;      // Mutants per surrogate-screened child (1 disables screening)
+double HONEST_FRACTION = 0.2;   // Children left unscreened to check the surrogate
+int SURROGATE_FEATURES = 128;
+int SURROGATE_WINDOW = 1000;    // The most recent evaluations the surrogate is trained on
+int COMMON_TRIALS = 0;          // Evaluate each generation on one shared set of trial conditions
+double LOW_FIDELITY_FRACTION = 1.0; // Evaluated in full after a low-fidelity pre-run (1 disables it)
+double TargetFitness = 0.99; // The search stops once the best fitness exceeds it
+
+int Stage1Gens = 300;
+int CHECKPOINT_INTERVAL = 1; // Generations between checkpoints (0 disables checkpointing)
 
 // Nervous system params
 const int NumSensors = 4;
@@ -59,16 +134,31 @@ const double TMAX = 10.0;
 
 int	VectSize = N*N + 2*N + NumSensors*N;
 
+// The number of neurons encoded by GENOTYPE (searches over different circuit
+// sizes can run side by side in a batch, so the fitness functions take N from
+// the genotype rather than from the global)
+int GenotypeNeurons(TVector<double> &genotype)
+{
+	int n = 0;
+	while (n*n + 2*n + NumSensors*n < genotype.Size()) n++;
+	return n;
+}
+
 
 // Global variable to hold the index for running on super computer
 
 std::string fileIndex = "";
 
+// The per-generation log of the run
+
+TEvolutionLog EvolutionLog;
+
 // ------------------------------------
 // Genotype-Phenotype Mapping Functions
 // ------------------------------------
 void GenPhenMapping(TVector<double> &gen, TVector<double> &phen)
 {
+	int N = GenotypeNeurons(gen);
 	int k = 1;
 	// Time-constants
 	for (int i = 1; i <= N; i++) {
@@ -94,6 +184,41 @@ void GenPhenMapping(TVector<double> &gen, TVector<double> &phen)
 	}
 }
 
+// Load the phenotype encoded by a genotype into an agent
+template<class Real>
+void GenotypeToAgent(TVector<double> &genotype, TSniffer<Real> &Agent)
+{
+	int N = GenotypeNeurons(genotype);
+	TVector<double> phenotype;
+	phenotype.SetBounds(1, genotype.Size());
+	GenPhenMapping(genotype, phenotype);
+
+	Agent.NervousSystem.SetCircuitSize(N);
+	int k = 1;
+	// Time-constants
+	for (int i = 1; i <= N; i++) {
+		Agent.NervousSystem.SetNeuronTimeConstant(i,phenotype(k));
+		k++;
+	}
+	// Biases
+	for (int i = 1; i <= N; i++) {
+		Agent.NervousSystem.SetNeuronBias(i,phenotype(k));
+		k++;
+	}
+	// Weights
+	for (int i = 1; i <= N; i++) {
+		for (int j = 1; j <= N; j++) {
+			Agent.NervousSystem.SetConnectionWeight(i,j,phenotype(k));
+			k++;
+		}
+	}
+	// Sensor Weights
+	for (int i = 1; i <= N*NumSensors; i++) {
+		Agent.SetSensorWeight(i,phenotype(k));
+		k++;
+	}
+}
+
 double DistanceGradient(double posX, double posY, double peakPosX, double peakPosY, double steepness = 1.5) {
     // Calculate direct Euclidean distance along x and y axes
     double dx = std::abs(posX - peakPosX);
@@ -110,18 +235,21 @@ double DistanceGradient(double posX, double posY, double peakPosX, double peakPo
     return 1.0 - std::abs(normalized_distance) * steepness;
 }
 
-double FitnessFunctionChemoIndex(TVector<double> &genotype, RandomState &rs)
+template<class Real>
+double ChemoIndexFitness(TVector<double> &genotype, RandomState &rs)
 {
+	int N = GenotypeNeurons(genotype);
 	// Map genotype to phenotype
 	TVector<double> phenotype;
-	phenotype.SetBounds(1, VectSize);
+	phenotype.SetBounds(1, genotype.Size());
 	GenPhenMapping(genotype, phenotype);
 
 	// Create the agent
-	Sniffer Agent(N);
+	TSniffer<Real> Agent(N);
 
 	// Instantiate the nervous systems
 	Agent.NervousSystem.SetCircuitSize(N);
+	Agent.NervousSystem.SetIntegrator(Integrator);
 
 	int k = 1;
 
@@ -150,13 +278,10 @@ double FitnessFunctionChemoIndex(TVector<double> &genotype, RandomState &rs)
 
     double totalFit = 0.0;
     int trials = 0;
+    const double StepScale = StepSize / ReferenceStepSize; // Penalties are per reference step
 
     // Vary the steepness of the gradient
-    const double minSteepness = 0.1;
-    const double maxSteepness = 2.0;
-    const double steepnessStep = 0.5;
-
-    for (double steepness = minSteepness; steepness <= maxSteepness; steepness += steepnessStep) {
+    for (double steepness = MinSteepness; steepness <= MaxSteepness; steepness += SteepnessStep) {
         for (double theta = 0.0; theta < 2*M_PI; theta += M_PI/2) {  
           
             double x = rs.UniformRandom(10, SpaceWidth-10); 
@@ -172,6 +297,7 @@ double FitnessFunctionChemoIndex(TVector<double> &genotype, RandomState &rs)
 			
             // Set agent's position
             Agent.Reset(x, y, theta);
+            AnalyticOdorField field(peakPositionX, peakPositionY, steepness, SpaceWidth, SpaceHeight);
 
             double dist = 0.0;
             double totalDist = 0.0;
@@ -182,19 +308,19 @@ double FitnessFunctionChemoIndex(TVector<double> &genotype, RandomState &rs)
                 // Check if the agent touches the wall
                 bool touchesWall = (Agent.posX <= 0.0 || Agent.posX >= SpaceWidth ||  Agent.posY <= 0.0 || Agent.posY >= SpaceHeight);
                 if (touchesWall) {
-                    totalFit -= wallTouchPenalty; // Apply penalty
+                    totalFit -= wallTouchPenalty * StepScale; // Apply penalty
                 }
 
 ////////// FOR TWO SENSORS 
 				// // Calculate the positions of the left and right sensors
-                double leftPosX = Agent.posX - sensorOffset * cos(Agent.theta + M_PI / 3);
-                double leftPosY = Agent.posY - sensorOffset * sin(Agent.theta + M_PI / 3);
-                double rightPosX = Agent.posX + sensorOffset * cos(Agent.theta + M_PI / 3);
-                double rightPosY = Agent.posY + sensorOffset * sin(Agent.theta + M_PI / 3);
+                double leftPosX = Agent.LeftSensorX();
+                double leftPosY = Agent.LeftSensorY();
+                double rightPosX = Agent.RightSensorX();
+                double rightPosY = Agent.RightSensorY();
                 
                 // Calculate chemical gradients at the sensor positions
-                double leftGradientValue = DistanceGradient(leftPosX, leftPosY, peakPositionX, peakPositionY, steepness);
-                double rightGradientValue = DistanceGradient(rightPosX, rightPosY, peakPositionX, peakPositionY, steepness);
+                double leftGradientValue = field.Concentration(leftPosX, leftPosY);
+                double rightGradientValue = field.Concentration(rightPosX, rightPosY);
 
                 // Sense the gradient
 				Agent.Sense(leftGradientValue, rightGradientValue);
@@ -228,130 +354,336 @@ double FitnessFunctionChemoIndex(TVector<double> &genotype, RandomState &rs)
     return totalFit / trials;
 }
 
-double FitnessFunctionChemoIndexResp(TVector<double> &genotype, RandomState &rs)
+double FitnessFunctionChemoIndex(TVector<double> &genotype, RandomState &rs)
 {
-	// Map genotype to phenotype
-	TVector<double> phenotype;
-	phenotype.SetBounds(1, VectSize);
-	GenPhenMapping(genotype, phenotype);
-
-	// Create the agent
-	Sniffer Agent(N);
-
-    // std::cout << "Running simulation with N = " << N << std::endl;
+	return ChemoIndexFitness<SimReal>(genotype, rs);
+}
 
-	// Instantiate the nervous systems
-	Agent.NervousSystem.SetCircuitSize(N);
-	
-	int k = 1;
+// The state of a respiratory chemotaxis trial at the end of its transient:
+// the time it resumes at, the penalties charged so far and the agent
+template<class Real, class Sum>
+struct TrialSnapshot {
+	int taken;
+	double time;
+	Sum penalty;
+	TSniffer<Real> agent;
+
+	TrialSnapshot(int neurons) : taken(0), time(0.0), penalty(0.0), agent(neurons) {}
+};
+
+// Run one respiratory chemotaxis trial of AGENT in FIELD, starting from
+// (x, y, theta), and return its fitness. Penalties are charged to TOTALFIT
+// as they are incurred (TOTALFIT is a double or a TCompensatedSum). The field
+// type is a template parameter, so static gradients and Fluid-based fields
+// share this loop without a virtual call per sensor reading. If RECORDER is
+// given, the agent is recorded after it senses at each step. TIMING sets the
+// step size, length and transient of the trial. If SNAPSHOT has been taken,
+// the trial resumes from it instead of running its transient; otherwise the
+// state at the end of the transient is taken into it. Snapshots need a field
+// whose concentrations do not depend on its history, and a TOTALFIT that
+// starts the trial at zero.
+template<class Real, class Field, class Sum>
+double ChemoRespTrial(TSniffer<Real> &Agent, Field &field, double x, double y, double theta,
+                      double peakPositionX, double peakPositionY, Sum &totalFit,
+                      const TrialTiming &timing = FullTiming(), TTrajectoryRecorder *recorder = NULL,
+                      TrialSnapshot<Real, Sum> *snapshot = NULL)
+{
+    const double StepScale = timing.step / ReferenceStepSize; // Penalties are per reference step
+
+    // Calculate initial distance
+    double initialDist = sqrt(pow(x - peakPositionX, 2) + pow(y - peakPositionY, 2));
+    if (initialDist < 1.0) initialDist = 1.0; // Avoid division by zero
+
+    // Set agent's position, or resume from the end of the transient
+    double start = 0.0;
+    if (snapshot != NULL && snapshot->taken) {
+        Agent = snapshot->agent;
+        totalFit = snapshot->penalty;
+        start = snapshot->time;
+    }
+    else Agent.Reset(x, y, theta);
+    bool taking = (snapshot != NULL && !snapshot->taken);
+
+    double dist = 0.0;
+    double wallTouchPenalty = 0.1;
+    long steps = 0;
+
+    for (double time = start; time < timing.run; time += timing.step, steps++) {
+
+        // Nothing has been measured yet at the first step past the transient
+        if (taking && time > timing.transient) {
+            snapshot->time = time;
+            snapshot->penalty = totalFit;
+            snapshot->agent = Agent;
+            snapshot->taken = 1;
+            taking = false;
+        }
+
+        // Check if the agent touches the wall
+        bool touchesWall = (Agent.posX <= 0.0 || Agent.posX >= SpaceWidth ||  Agent.posY <= 0.0 || Agent.posY >= SpaceHeight);
+        if (touchesWall) {
+            totalFit -= wallTouchPenalty * StepScale; // Apply penalty
+        }
+
+        if (Agent.GetPassedOutState() == true) {totalFit -= 0.5 * StepScale;}
+
+        // Sense the field at the left and right sensors
+        field.Advance(time);
+        double leftGradientValue = field.Concentration(Agent.LeftSensorX(), Agent.LeftSensorY());
+        double rightGradientValue = field.Concentration(Agent.RightSensorX(), Agent.RightSensorY());
+        Agent.SenseResp(leftGradientValue, rightGradientValue, time, timing.step);
+        if (recorder != NULL) recorder->Record(time, Agent);
+
+        // Move based on sensed gradient
+        Agent.Step(timing.step);
+
+        if (time > timing.transient) {
+            double dx = std::abs(Agent.posX - peakPositionX);
+            double dy = std::abs(Agent.posY - peakPositionY);
+            dist += sqrt(dx * dx + dy * dy);
+        }
+    }
+    AgentSteps += steps;
+    double totaldist = (dist / ((timing.run - timing.transient) / timing.step));
+    double fitnessForThisTrial = (initialDist - totaldist)/initialDist;
+    return fitnessForThisTrial < 0.0 ? 0.0 : fitnessForThisTrial; // Ensure non-negative fitness
+}
 
-	// Time-constants
-	for (int i = 1; i <= N; i++) {
-		Agent.NervousSystem.SetNeuronTimeConstant(i,phenotype(k));
-		k++;
-	}
-	// Biases
-	for (int i = 1; i <= N; i++) {
-		Agent.NervousSystem.SetNeuronBias(i,phenotype(k));
-		k++;
-	}
-	// Weights
-	for (int i = 1; i <= N; i++) {
-		for (int j = 1; j <= N; j++) {
-			Agent.NervousSystem.SetConnectionWeight(i,j,phenotype(k));
-			k++;
-		}
-	}
-	// Sensor Weights
-	for (int i = 1; i <= N*NumSensors; i++) {
-		Agent.SetSensorWeight(i,phenotype(k));
-		k++;
-	}
+template<class Real>
+double ChemoIndexRespFitness(TVector<double> &genotype, RandomState &rs, const TrialTiming &timing = FullTiming())
+{
+	// Create the agent
+	TSniffer<Real> Agent(GenotypeNeurons(genotype));
+	GenotypeToAgent(genotype, Agent);
+	Agent.NervousSystem.SetIntegrator(Integrator);
 
     double totalFit = 0.0;
     int trials = 0;
 
     // Vary the steepness of the gradient
-    const double minSteepness = 0.1;
-    const double maxSteepness = 2.0;
-    const double steepnessStep = 0.5;
+    for (double steepness = MinSteepness; steepness <= MaxSteepness; steepness += SteepnessStep) {
+        for (double theta = 0.0; theta < 2*M_PI; theta += M_PI/2) {
 
-    for (double steepness = minSteepness; steepness <= maxSteepness; steepness += steepnessStep) {
-        for (double theta = 0.0; theta < 2*M_PI; theta += M_PI/2) {  
-          
-            double x = rs.UniformRandom(10, SpaceWidth-10); 
-            double y = rs.UniformRandom(10.0, SpaceHeight-10); 
+            double x = rs.UniformRandom(10, SpaceWidth-10);
+            double y = rs.UniformRandom(10.0, SpaceHeight-10);
 
             // Peak position of chemical gradient
             const double peakPositionX = rs.UniformRandom(10.0, SpaceWidth-10);
-            const double peakPositionY = rs.UniformRandom(10.0, SpaceHeight-10); 
+            const double peakPositionY = rs.UniformRandom(10.0, SpaceHeight-10);
 
-            // Calculate initial distance
-            double initialDist = sqrt(pow(x - peakPositionX, 2) + pow(y - peakPositionY, 2));
-            if (initialDist < 1.0) initialDist = 1.0; // Avoid division by zero
-			
-            // Set agent's position
-            Agent.Reset(x, y, theta);
+            AnalyticOdorField field(peakPositionX, peakPositionY, steepness, SpaceWidth, SpaceHeight);
+            double fitnessForThisTrial = ChemoRespTrial(Agent, field, x, y, theta, peakPositionX, peakPositionY, totalFit, timing);
 
-            double dist = 0.0;
-            double totalDist = 0.0;
-            double wallTouchPenalty = 0.1;
+            totalFit += fitnessForThisTrial;
+            trials++;
+        }
+    }
+    return totalFit / trials;
+}
 
-            for (double time = 0; time < RunDuration; time += StepSize) {
+double FitnessFunctionChemoIndexResp(TVector<double> &genotype, RandomState &rs)
+{
+	return ChemoIndexRespFitness<SimReal>(genotype, rs);
+}
 
-                // Check if the agent touches the wall
-                bool touchesWall = (Agent.posX <= 0.0 || Agent.posX >= SpaceWidth ||  Agent.posY <= 0.0 || Agent.posY >= SpaceHeight);
-                if (touchesWall) {
-                    totalFit -= wallTouchPenalty; // Apply penalty
-                }
+// The same trials with the low-fidelity timing
+double LowFidelityChemoIndexResp(TVector<double> &genotype, RandomState &rs)
+{
+	return ChemoIndexRespFitness<SimReal>(genotype, rs, LowFidelityTiming());
+}
 
-				if (Agent.GetPassedOutState() == true) {totalFit -= 0.5;}
+// The respiratory chemotaxis task in the odor plume of a Fluid simulation
+// emitting at the source. The fluid is stepped every FluidStepSize time units.
+double FitnessFunctionChemoIndexRespFluid(TVector<double> &genotype, RandomState &rs)
+{
+	TSniffer<SimReal> Agent(GenotypeNeurons(genotype));
+	GenotypeToAgent(genotype, Agent);
+	Agent.NervousSystem.SetIntegrator(Integrator);
 
-////////// FOR TWO SENSORS 
-				// // Calculate the positions of the left and right sensors
-                double leftPosX = Agent.posX - sensorOffset * cos(Agent.theta + M_PI / 3);
-                double leftPosY = Agent.posY - sensorOffset * sin(Agent.theta + M_PI / 3);
-                double rightPosX = Agent.posX + sensorOffset * cos(Agent.theta + M_PI / 3);
-                double rightPosY = Agent.posY + sensorOffset * sin(Agent.theta + M_PI / 3);
-                
-                // Calculate chemical gradients at the sensor positions
-                double leftGradientValue = DistanceGradient(leftPosX, leftPosY, peakPositionX, peakPositionY, steepness);
-                double rightGradientValue = DistanceGradient(rightPosX, rightPosY, peakPositionX, peakPositionY, steepness);
+    double totalFit = 0.0;
+    int trials = 0;
 
-                // Sense the gradient
-				Agent.SenseResp(leftGradientValue, rightGradientValue, time);
-					
-/////////// FOR ONE SENSOR
-                // Calculate chemical gradient at Sniffer position
-				// double gradientValue = DistanceGradient(Agent.posX, Agent.posY, peakPositionX, peakPositionY, steepness);
+    for (double theta = 0.0; theta < 2*M_PI; theta += M_PI/2) {
+        double x = rs.UniformRandom(10, SpaceWidth-10);
+        double y = rs.UniformRandom(10.0, SpaceHeight-10);
+        const double peakPositionX = rs.UniformRandom(10.0, SpaceWidth-10);
+        const double peakPositionY = rs.UniformRandom(10.0, SpaceHeight-10);
 
-				// // Sense the gradient
-				// Agent.Sense(gradientValue, time);
-                
-//////////////////////
-				// Move based on sensed gradient
-				Agent.Step(StepSize);
-        
-                if (time > TransDuration) {
-                    double dx = std::abs(Agent.posX - peakPositionX);
-                    double dy = std::abs(Agent.posY - peakPositionY);
-                    dist += sqrt(dx * dx + dy * dy);
+        Fluid fluid(FluidStepSize, FluidDiffusion, FluidViscosity);
+        FluidOdorField field(fluid, (int)(peakPositionX * (fluid.size - 1) / SpaceWidth),
+                             (int)(peakPositionY * (fluid.size - 1) / SpaceHeight), OdorEmission, SpaceWidth, SpaceHeight);
+        double fitnessForThisTrial = ChemoRespTrial(Agent, field, x, y, theta, peakPositionX, peakPositionY, totalFit);
+
+        totalFit += fitnessForThisTrial;
+        trials++;
+    }
+    return totalFit / trials;
+}
+
+// ------------------------------------
+// Trial-level parallelism
+// ------------------------------------
+
+// The conditions of one respiratory chemotaxis trial
+struct ChemoRespTrialSpec {double x, y, theta, peakX, peakY, steepness;};
+
+// Draw the trial conditions of FitnessFunctionChemoIndexResp from RS, in the
+// order that the serial version draws them
+void ChemoRespTrialConditions(RandomState &rs, vector<ChemoRespTrialSpec> &specs)
+{
+	specs.clear();
+	for (double steepness = MinSteepness; steepness <= MaxSteepness; steepness += SteepnessStep) {
+		for (double theta = 0.0; theta < 2*M_PI; theta += M_PI/2) {
+			ChemoRespTrialSpec c;
+			c.x = rs.UniformRandom(10, SpaceWidth-10);
+			c.y = rs.UniformRandom(10.0, SpaceHeight-10);
+			c.peakX = rs.UniformRandom(10.0, SpaceWidth-10);
+			c.peakY = rs.UniformRandom(10.0, SpaceHeight-10);
+			c.theta = theta;
+			c.steepness = steepness;
+			specs.push_back(c);
+		}
+	}
+}
+
+// The states of trials at the end of their transients (task.transient_cache
+// sets how many are kept). A genotype evaluated again on the same trials, or
+// with only a longer or shorter evaluation window, resumes from them.
+typedef TrialSnapshot<SimReal, TCompensatedSum> ChemoRespSnapshot;
+TTransientCache<ChemoRespSnapshot> TransientCache;
+
+// What the transient of trial C depends on besides the genotype
+void TransientConditions(const ChemoRespTrialSpec &c, const TrialTiming &timing, vector<double> &conditions)
+{
+	double v[9] = {c.x, c.y, c.theta, c.peakX, c.peakY, c.steepness, timing.step, timing.transient, (double)Integrator};
+	conditions.assign(v, v + 9);
+}
+
+// The trials of one genotype and their results (RESUMED marks the trials that
+// resumed from a cached transient)
+struct ChemoRespTrialBatch {TVector<double> *genotype; TrialTiming timing; vector<ChemoRespTrialSpec> specs; vector<double> fitness, penalty; vector<char> resumed;};
+
+void ChemoRespTrialTask(int t, void *arg)
+{
+	ChemoRespTrialBatch *b = (ChemoRespTrialBatch *)arg;
+	TArenaScope scratch;
+	TSniffer<SimReal> Agent(GenotypeNeurons(*b->genotype));
+	GenotypeToAgent(*b->genotype, Agent);
+	Agent.NervousSystem.SetIntegrator(Integrator);
+	ChemoRespTrialSpec &c = b->specs[t];
+	AnalyticOdorField field(c.peakX, c.peakY, c.steepness, SpaceWidth, SpaceHeight);
+	TCompensatedSum penalty;
+	if (TransientCache.Capacity() == 0)
+		b->fitness[t] = ChemoRespTrial(Agent, field, c.x, c.y, c.theta, c.peakX, c.peakY, penalty, b->timing);
+	else {
+		ChemoRespSnapshot snapshot(Agent.size);
+		vector<double> conditions;
+		TransientConditions(c, b->timing, conditions);
+		b->resumed[t] = TransientCache.Lookup(*b->genotype, conditions, snapshot);
+		b->fitness[t] = ChemoRespTrial(Agent, field, c.x, c.y, c.theta, c.peakX, c.peakY, penalty, b->timing, NULL, &snapshot);
+		if (!b->resumed[t] && snapshot.taken) TransientCache.Store(*b->genotype, conditions, snapshot);
+	}
+	b->penalty[t] = penalty.Value();
+}
+
+// FitnessFunctionChemoIndexResp with the trials of the genotype run across the
+// shared thread pool. The conditions are drawn from RS before any trial runs.
+// Each trial's penalties are summed with compensation, and the trials are
+// combined in trial order, so the result does not depend on the number of
+// threads. (The serial version sums the penalties of all trials into one
+// running total, so the two can differ in the last bits.) Since each trial's
+// penalties start from zero, its transient can be cached: a trial resumed from
+// the cache gives exactly the result of running it again.
+double ParallelChemoIndexRespFitness(TVector<double> &genotype, RandomState &rs, const TrialTiming &timing)
+{
+	ChemoRespTrialBatch batch;
+	batch.genotype = &genotype;
+	batch.timing = timing;
+	ChemoRespTrialConditions(rs, batch.specs);
+	int trials = batch.specs.size();
+	batch.fitness.assign(trials, 0.0);
+	batch.penalty.assign(trials, 0.0);
+	batch.resumed.assign(trials, 0);
+	SharedThreadPool().ParallelFor(0, trials - 1, ChemoRespTrialTask, &batch);
+
+	TCompensatedSum totalFit;
+	long resumed = 0;
+	for (int t = 0; t < trials; t++) {
+		totalFit += batch.penalty[t];
+		totalFit += batch.fitness[t];
+		resumed += batch.resumed[t];
+	}
+	CountEvaluationCacheHits(resumed);
+	return totalFit.Value() / trials;
+}
+
+double ParallelFitnessChemoIndexResp(TVector<double> &genotype, RandomState &rs)
+{
+	return ParallelChemoIndexRespFitness(genotype, rs, FullTiming());
+}
+
+double ParallelLowFidelityChemoIndexResp(TVector<double> &genotype, RandomState &rs)
+{
+	return ParallelChemoIndexRespFitness(genotype, rs, LowFidelityTiming());
+}
+
+
+// The respiratory chemotaxis task integrated with error-controlled steps of the
+// joint brain-body-respiration state. Penalties are charged at the same rate per
+// unit time as in the fixed-step version, and the evaluation distance is the
+// time average over the evaluation window.
+double FitnessFunctionChemoIndexRespAdaptive(TVector<double> &genotype, RandomState &rs)
+{
+	Sniffer Agent(GenotypeNeurons(genotype));
+	GenotypeToAgent(genotype, Agent);
+
+    double totalFit = 0.0;
+    int trials = 0;
+
+    for (double steepness = MinSteepness; steepness <= MaxSteepness; steepness += SteepnessStep) {
+        for (double theta = 0.0; theta < 2*M_PI; theta += M_PI/2) {
+            double x = rs.UniformRandom(10, SpaceWidth-10);
+            double y = rs.UniformRandom(10.0, SpaceHeight-10);
+            double peakX = rs.UniformRandom(10.0, SpaceWidth-10);
+            double peakY = rs.UniformRandom(10.0, SpaceHeight-10);
+            AnalyticOdorField field(peakX, peakY, steepness, SpaceWidth, SpaceHeight);
+
+            double initialDist = sqrt(pow(x - field.peakX, 2) + pow(y - field.peakY, 2));
+            if (initialDist < 1.0) initialDist = 1.0; // Avoid division by zero
+
+            Agent.Reset(x, y, theta);
+            double dist = 0.0;
+            double time = 0.0;
+            double h = StepSize;
+            while (time < RunDuration) {
+                double penaltyRate = 0.0;
+                if (Agent.posX <= 0.0 || Agent.posX >= SpaceWidth || Agent.posY <= 0.0 || Agent.posY >= SpaceHeight)
+                    penaltyRate += 0.1;
+                if (Agent.GetPassedOutState() == true) penaltyRate += 0.5;
+                double d0 = sqrt(pow(Agent.posX - field.peakX, 2) + pow(Agent.posY - field.peakY, 2));
+
+                // Never step across the start of the evaluation window
+                double tmax = (time < TransDuration) ? TransDuration : RunDuration;
+                double dt = Agent.AdaptiveStep(time, h, tmax, OdorFieldConcentration, &field);
+
+                totalFit -= penaltyRate * dt / ReferenceStepSize;
+                if (time >= TransDuration) {
+                    double d1 = sqrt(pow(Agent.posX - field.peakX, 2) + pow(Agent.posY - field.peakY, 2));
+                    dist += 0.5 * (d0 + d1) * dt;
                 }
+                time = (dt == tmax - time) ? tmax : time + dt;
             }
-            double totaldist = (dist / (EvalDuration / StepSize));
-            double fitnessForThisTrial = (initialDist - totaldist)/initialDist;
+            double fitnessForThisTrial = (initialDist - dist / EvalDuration) / initialDist;
             fitnessForThisTrial = fitnessForThisTrial < 0.0 ? 0.0 : fitnessForThisTrial; // Ensure non-negative fitness
 
             totalFit += fitnessForThisTrial;
             trials++;
-        // }
+        }
     }
-}
     return totalFit / trials;
 }
 
 
-
 // 
 // double Breathing(TVector<double> &genotype, RandomState &rs)
 // {
@@ -481,65 +813,33 @@ double FitnessFunctionChemoIndexResp(TVector<double> &genotype, RandomState &rs)
 // FUNCTIONS FOR ANALYZING A SUCCESFUL CIRCUIT
 // ================================================
 
-double PerformanceMap(TVector<double> &genotype)
-{
-
-	ofstream perf("PerformanceMap_4N_47.dat");
+// The trials of PerformanceMap started from one cell of the map. Cells are
+// evaluated in parallel, each with its own agent.
+struct PerformanceMapBatch {TVector<double> *genotype; int rows; vector<double> cellFit; vector<int> cellTrials;};
 
-	// Map genotype to phenotype
-	TVector<double> phenotype;
-	phenotype.SetBounds(1, VectSize);
-	GenPhenMapping(genotype, phenotype);
+void PerformanceMapCellTask(int c, void *arg)
+{
+	PerformanceMapBatch *b = (PerformanceMapBatch *)arg;
+	TArenaScope scratch;
+	const double x = c / b->rows, y = c % b->rows;
 
 	// Create the agent
 	Sniffer Agent(N);
+	GenotypeToAgent(*b->genotype, Agent);
+	Agent.NervousSystem.SetIntegrator(Integrator);
 
-    // std::cout << "Running simulation with N = " << N << std::endl;
-
-	// Instantiate the nervous systems
-	Agent.NervousSystem.SetCircuitSize(N);
-	
-	int k = 1;
-
-	// Time-constants
-	for (int i = 1; i <= N; i++) {
-		Agent.NervousSystem.SetNeuronTimeConstant(i,phenotype(k));
-		k++;
-	}
-	// Biases
-	for (int i = 1; i <= N; i++) {
-		Agent.NervousSystem.SetNeuronBias(i,phenotype(k));
-		k++;
-	}
-	// Weights
-	for (int i = 1; i <= N; i++) {
-		for (int j = 1; j <= N; j++) {
-			Agent.NervousSystem.SetConnectionWeight(i,j,phenotype(k));
-			k++;
-		}
-	}
-	// Sensor Weights
-	for (int i = 1; i <= N*NumSensors; i++) {
-		Agent.SetSensorWeight(i,phenotype(k));
-		k++;
-	}
-
-    double totalFit = 0.0;
+    TCompensatedSum totalFit;
     int trials = 0;
+    const double StepScale = StepSize / ReferenceStepSize; // Penalties are per reference step
 
     // Vary the steepness of the gradient
-    const double minSteepness = 0.1;
-    const double maxSteepness = 2.0;
-    const double steepnessStep = 0.5;
-
-for (double x = 0; x <= SpaceWidth; x += 1.0){
-for (double y = 0; y <= SpaceHeight; y += 1.0){
-    for (double steepness = minSteepness; steepness <= maxSteepness; steepness += steepnessStep) {
+    for (double steepness = MinSteepness; steepness <= MaxSteepness; steepness += SteepnessStep) {
         for (double theta = 0.0; theta < 2*M_PI; theta += M_PI/2) {  
 
             // Peak position of chemical gradient
             const double peakPositionX = 50.0;
             const double peakPositionY = 50.0; 
+            AnalyticOdorField field(peakPositionX, peakPositionY, steepness, SpaceWidth, SpaceHeight);
 
             // Calculate initial distance
             double initialDist = sqrt(pow(x - peakPositionX, 2) + pow(y - peakPositionY, 2));
@@ -549,28 +849,20 @@ for (double y = 0; y <= SpaceHeight; y += 1.0){
             Agent.Reset(x, y, theta);
 
             double dist = 0.0;
-            double totalDist = 0.0;
-            double wallTouchPenalty = 0.1;
 
             for (double time = 0; time < RunDuration; time += StepSize) {
 
                 // // Punishment checks 
                 // bool touchesWall = (Agent.posX <= 0.0 || Agent.posX >= SpaceWidth ||  Agent.posY <= 0.0 || Agent.posY >= SpaceHeight);
                 // if (touchesWall) {totalFit -= wallTouchPenalty;}
-				if (Agent.GetPassedOutState() == true) {totalFit -= 0.5;}
+				if (Agent.GetPassedOutState() == true) {totalFit -= 0.5 * StepScale;}
 
-				// // Calculate the positions of the left and right sensors
-                double leftPosX = Agent.posX - sensorOffset * cos(Agent.theta + M_PI / 3);
-                double leftPosY = Agent.posY - sensorOffset * sin(Agent.theta + M_PI / 3);
-                double rightPosX = Agent.posX + sensorOffset * cos(Agent.theta + M_PI / 3);
-                double rightPosY = Agent.posY + sensorOffset * sin(Agent.theta + M_PI / 3);
-                
                 // Calculate chemical gradients at the sensor positions
-                double leftGradientValue = DistanceGradient(leftPosX, leftPosY, peakPositionX, peakPositionY, steepness);
-                double rightGradientValue = DistanceGradient(rightPosX, rightPosY, peakPositionX, peakPositionY, steepness);
+                double leftGradientValue = field.Concentration(Agent.LeftSensorX(), Agent.LeftSensorY());
+                double rightGradientValue = field.Concentration(Agent.RightSensorX(), Agent.RightSensorY());
 
                 // Sense the gradient
-				Agent.SenseResp(leftGradientValue, rightGradientValue, time);
+				Agent.SenseResp(leftGradientValue, rightGradientValue, time, StepSize);
 
 				// Move based on sensed gradient
 				Agent.Step(StepSize);
@@ -586,176 +878,629 @@ for (double y = 0; y <= SpaceHeight; y += 1.0){
             fitnessForThisTrial = fitnessForThisTrial < 0.0 ? 0.0 : fitnessForThisTrial; // Ensure non-negative fitness
             totalFit += fitnessForThisTrial;
             trials++;
-   
-    } // Theta loop 
-} // steepness loop 
- 	perf << x << " " << y << " " << totalFit / trials << endl;
-} // y loop 
-} // x loop 
-    perf.close();
+        } // Theta loop 
+    } // steepness loop 
+    b->cellFit[c] = totalFit.Value();
+    b->cellTrials[c] = trials;
 }
 
+// Evaluate GENOTYPE from every integer starting position and write the running
+// average fitness after each position to the map file PATH. The cells are run across
+// the shared thread pool and combined in the order of the original serial scan.
+double PerformanceMap(TVector<double> &genotype, const string &path = "PerformanceMap.dat")
+{
+	ofstream perf(path.c_str());
 
-// void BehavioralTraces_Specific(TVector<double> &genotype,double x1, double y1, double chemicalsourceX, double chemicalsourceY, double steepness)
-// {
-//     // Start output file for positions
-//     ofstream positionFile("AgentPositions.dat");
+	PerformanceMapBatch batch;
+	batch.genotype = &genotype;
+	int columns = (int)SpaceWidth + 1;
+	batch.rows = (int)SpaceHeight + 1;
+	batch.cellFit.assign(columns * batch.rows, 0.0);
+	batch.cellTrials.assign(columns * batch.rows, 0);
+	SharedThreadPool().ParallelFor(0, columns * batch.rows - 1, PerformanceMapCellTask, &batch);
 
-//     // Map genotype to phenotype
-//     TVector<double> phenotype;
-//     phenotype.SetBounds(1, VectSize);
-//     GenPhenMapping(genotype, phenotype);
+    TCompensatedSum totalFit;
+    int trials = 0;
+	for (int c = 0; c < columns * batch.rows; c++) {
+		totalFit += batch.cellFit[c];
+		trials += batch.cellTrials[c];
+		perf << c / batch.rows << " " << c % batch.rows << " " << totalFit.Value() / trials << endl;
+	}
+    perf.close();
+    return totalFit.Value() / trials;
+}
 
-//     // Create the agent
-//     Sniffer Agent(N);
 
-//     // Instantiate the nervous systems
-//     Agent.NervousSystem.SetCircuitSize(N);
-//     int k = 1;
+// ------------------------------------
+// Integrator validation
+// ------------------------------------
 
-//     // Time-constants
-//     for (int i = 1; i <= N; i++) {
-//         Agent.NervousSystem.SetNeuronTimeConstant(i, phenotype(k));
-//         k++;
-//     }
-//     // Biases
-//     for (int i = 1; i <= N; i++) {
-//         Agent.NervousSystem.SetNeuronBias(i, phenotype(k));
-//         k++;
-//     }
-//     // Weights
-//     for (int i = 1; i <= N; i++) {
-//         for (int j = 1; j <= N; j++) {
-//             Agent.NervousSystem.SetConnectionWeight(i, j, phenotype(k));
-//             k++;
-//         }
-//     }
-//     // Sensor Weights
-//     for (int i = 1; i <= N; i++) {
-//         Agent.SetSensorWeight(i, phenotype(k));
-//         k++;
-//     }
+// Advance an agent one step of the respiratory chemotaxis task, adding its
+// distance to the source to DIST during evaluation. Returns the penalty incurred.
+double ChemoRespStep(Sniffer &Agent, double time, double stepsize, double peakX, double peakY, double steepness, double &dist)
+{
+	double penalty = 0.0;
+	if (Agent.posX <= 0.0 || Agent.posX >= SpaceWidth || Agent.posY <= 0.0 || Agent.posY >= SpaceHeight)
+		penalty += 0.1;
+	if (Agent.GetPassedOutState() == true) penalty += 0.5;
+
+	double left = DistanceGradient(Agent.LeftSensorX(), Agent.LeftSensorY(), peakX, peakY, steepness);
+	double right = DistanceGradient(Agent.RightSensorX(), Agent.RightSensorY(), peakX, peakY, steepness);
+	Agent.SenseResp(left, right, time, stepsize);
+	Agent.Step(stepsize);
+
+	if (time > TransDuration) {
+		double dx = Agent.posX - peakX, dy = Agent.posY - peakY;
+		dist += sqrt(dx * dx + dy * dy);
+	}
+	return penalty * (stepsize / ReferenceStepSize);
+}
 
-//     // Run the simulation
-//     // for (double y1 = 0.0; y1 < SpaceHeight; y1 += 50.0) {
-//     //     for (double x1 = 0.0; x1 < SpaceWidth; x1 += 50.0) {
-            
-//             const double peakPositionX = chemicalsourceX;
-//             const double peakPositionY = chemicalsourceY;
+// Run the respiratory chemotaxis trials side by side with the reference
+// integration (forward Euler at StepSize) and with INTEGRATOR at STEPSIZE
+// (rounded to a multiple of StepSize). Each agent senses the gradient at its
+// own position. Reports the largest divergence in position, neural state and
+// per-trial fitness, and returns the largest per-trial fitness error.
+double IntegratorValidation(TVector<double> &genotype, TIntegrator integrator, double stepsize, long seed = 0, int verbose = 1)
+{
+	int ratio = (int)floor(stepsize / StepSize + 0.5);
+	if (ratio < 1) ratio = 1;
+	stepsize = ratio * StepSize;
+
+	Sniffer Reference(N), Candidate(N);
+	GenotypeToAgent(genotype, Reference);
+	GenotypeToAgent(genotype, Candidate);
+	Reference.NervousSystem.SetIntegrator(EULER);
+	Candidate.NervousSystem.SetIntegrator(integrator);
+
+	RandomState rs(seed);
+	double maxPosError = 0.0, maxStateError = 0.0, maxFitError = 0.0;
+
+	for (double steepness = MinSteepness; steepness <= MaxSteepness; steepness += SteepnessStep) {
+		for (double theta = 0.0; theta < 2*M_PI; theta += M_PI/2) {
+			double x = rs.UniformRandom(10, SpaceWidth-10);
+			double y = rs.UniformRandom(10.0, SpaceHeight-10);
+			double peakX = rs.UniformRandom(10.0, SpaceWidth-10);
+			double peakY = rs.UniformRandom(10.0, SpaceHeight-10);
+			double initialDist = sqrt(pow(x - peakX, 2) + pow(y - peakY, 2));
+			if (initialDist < 1.0) initialDist = 1.0;
+
+			Reference.Reset(x, y, theta);
+			Candidate.Reset(x, y, theta);
+			double refDist = 0.0, candDist = 0.0, refPenalty = 0.0, candPenalty = 0.0;
+			double posError = 0.0, stateError = 0.0;
+			double refTime = 0.0;
+
+			for (double time = 0; time < RunDuration; time += stepsize) {
+				// Advance the reference over the same interval
+				for (int r = 0; r < ratio; r++, refTime += StepSize)
+					refPenalty += ChemoRespStep(Reference, refTime, StepSize, peakX, peakY, steepness, refDist);
+				candPenalty += ChemoRespStep(Candidate, time, stepsize, peakX, peakY, steepness, candDist);
+				// Compare the trajectories
+				double e = sqrt(pow(Reference.posX - Candidate.posX, 2) + pow(Reference.posY - Candidate.posY, 2));
+				if (e > posError) posError = e;
+				for (int i = 1; i <= N; i++) {
+					e = std::abs(Reference.NervousSystem.NeuronState(i) - Candidate.NervousSystem.NeuronState(i));
+					if (e > stateError) stateError = e;
+				}
+			}
+			double refFit = (initialDist - refDist / (EvalDuration / StepSize)) / initialDist;
+			double candFit = (initialDist - candDist / (EvalDuration / stepsize)) / initialDist;
+			refFit = (refFit < 0.0 ? 0.0 : refFit) - refPenalty;
+			candFit = (candFit < 0.0 ? 0.0 : candFit) - candPenalty;
+			double fitError = std::abs(refFit - candFit);
+
+			if (verbose)
+				cout << steepness << " " << theta << " " << posError << " " << stateError << " " << refFit << " " << candFit << endl;
+			if (posError > maxPosError) maxPosError = posError;
+			if (stateError > maxStateError) maxStateError = stateError;
+			if (fitError > maxFitError) maxFitError = fitError;
+		}
+	}
+	if (verbose)
+		cout << "StepSize " << stepsize << ": max position error " << maxPosError << ", max state error " << maxStateError
+		     << ", max fitness error " << maxFitError << endl;
+	return maxFitError;
+}
 
-//             // Set agent's position
-//             Agent.Reset(x1, y1, 0.0);
+// Error-controlled step selection: return the largest multiple of StepSize (up
+// to MAXRATIO) at which INTEGRATOR reproduces the reference per-trial fitness of
+// GENOTYPE to within TOLERANCE
+double SelectIntegrationStepSize(TVector<double> &genotype, TIntegrator integrator, double tolerance, int maxratio = 10)
+{
+	for (int ratio = maxratio; ratio > 1; ratio--)
+		if (IntegratorValidation(genotype, integrator, ratio * StepSize, 0, 0) <= tolerance)
+			return ratio * StepSize;
+	return StepSize;
+}
 
-//             for (double time = 0; time < RunDuration; time += StepSize) {
-                
-//                 // Sense the gradient
-//                 double gradientValue = DistanceGradient(Agent.posX, Agent.posY, peakPositionX, peakPositionY, steepness);
 
-//                 Agent.Sense(gradientValue, time);
+// ------------------------------------
+// Precision validation
+// ------------------------------------
 
-//                 // Move based on sensed gradient
-//                 Agent.Step(StepSize);
+// Fill R with the ranks of V (1 = lowest, ties get their average rank)
+void RankValues(TVector<double> &v, TVector<double> &r)
+{
+	int n = v.Size();
+	r.SetBounds(1, n);
+	for (int i = 1; i <= n; i++) {
+		int below = 0, equal = 0;
+		for (int j = 1; j <= n; j++) {
+			if (v[j] < v[i]) below++;
+			else if (v[j] == v[i]) equal++;
+		}
+		r[i] = below + (equal + 1) / 2.0;
+	}
+}
 
-//                 // Save the position at each timestep
-//                 positionFile << Agent.posX << " " << Agent.posY << endl;
-//             }
-//     //     }
-//     // }
+// Evaluate the genotypes stored in FILES in double and in single precision on
+// the same trials, and report how well the float ranking of the genotypes
+// agrees with the double ranking. Returns Spearman's rank correlation.
+double PrecisionValidation(int count, const char *files[], long seed = 0)
+{
+	TVector<double> fitDouble(1, count), fitFloat(1, count);
+	for (int i = 1; i <= count; i++) {
+		ifstream genefile(files[i-1]);
+		if (!genefile) {
+			cerr << "Error: Cannot open genotype file " << files[i-1] << endl;
+			exit(0);
+		}
+		TVector<double> genotype(1, VectSize);
+		genefile >> genotype;
+		RandomState rsDouble(seed), rsFloat(seed);
+		fitDouble[i] = ChemoIndexRespFitness<double>(genotype, rsDouble);
+		fitFloat[i] = ChemoIndexRespFitness<float>(genotype, rsFloat);
+		cout << files[i-1] << " " << fitDouble[i] << " " << fitFloat[i] << " " << fitFloat[i] - fitDouble[i] << endl;
+	}
 
-//     positionFile.close();
-// }
+	// Spearman's rho is the correlation of the ranks
+	TVector<double> rankDouble, rankFloat;
+	RankValues(fitDouble, rankDouble);
+	RankValues(fitFloat, rankFloat);
+	double mean = (count + 1) / 2.0, sxy = 0.0, sxx = 0.0, syy = 0.0;
+	for (int i = 1; i <= count; i++) {
+		sxy += (rankDouble[i] - mean) * (rankFloat[i] - mean);
+		sxx += (rankDouble[i] - mean) * (rankDouble[i] - mean);
+		syy += (rankFloat[i] - mean) * (rankFloat[i] - mean);
+	}
+	double rho = (sxx > 0.0 && syy > 0.0) ? sxy / sqrt(sxx * syy) : 1.0;
 
-// void BehavioralTraces_Across_Conditions(TVector<double> &genotype, double steepness)
-// {
-//     // Start output file for positions
-//     ofstream positionFile("AgentPositions.dat");
+	// Pairs of genotypes whose order flips between the two modes
+	int flips = 0, pairs = 0;
+	for (int i = 1; i <= count; i++)
+		for (int j = i + 1; j <= count; j++, pairs++)
+			if ((fitDouble[i] - fitDouble[j]) * (fitFloat[i] - fitFloat[j]) < 0.0) flips++;
 
-//     // Map genotype to phenotype
-//     TVector<double> phenotype;
-//     phenotype.SetBounds(1, VectSize);
-//     GenPhenMapping(genotype, phenotype);
+	cout << "Spearman rho " << rho << ", order flips " << flips << " of " << pairs << " pairs" << endl;
+	return rho;
+}
 
-//     // Create the agent
-//     Sniffer Agent(N);
 
-//     // Instantiate the nervous systems
-//     Agent.NervousSystem.SetCircuitSize(N);
-//     int k = 1;
+// ------------------------------------
+// Behavioral traces
+// ------------------------------------
 
-//     // Time-constants
-//     for (int i = 1; i <= N; i++) {
-//         Agent.NervousSystem.SetNeuronTimeConstant(i, phenotype(k));
-//         k++;
-//     }
-//     // Biases
-//     for (int i = 1; i <= N; i++) {
-//         Agent.NervousSystem.SetNeuronBias(i, phenotype(k));
-//         k++;
-//     }
-//     // Weights
-//     for (int i = 1; i <= N; i++) {
-//         for (int j = 1; j <= N; j++) {
-//             Agent.NervousSystem.SetConnectionWeight(i, j, phenotype(k));
-//             k++;
-//         }
-//     }
-//     // Sensor Weights
-//     for (int i = 1; i <= N; i++) {
-//         Agent.SetSensorWeight(i, phenotype(k));
-//         k++;
-//     }
+// How the traces are recorded (the [trace] settings)
+int TraceDecimation = 1;                    // Record every TraceDecimation-th step
+std::string TraceTrigger = "none";          // none, passed-out or near-source
+int TraceWindowBefore = 100, TraceWindowAfter = 100; // Samples recorded around a trigger
+double TraceNearDistance = 5.0;             // The distance from the source that triggers near-source
 
-// 	const int NumPeakPositions = 6; // Change this as needed
+// The state of the trace triggers: the offset of the values they watch in a
+// record, and the source of the trial
+struct TraceTriggerState {int offset; double peakX, peakY;};
 
-//     // Initialize the agent's position
-//     double initPosX = 50.0;
-//     double initPosY = 50.0;
-    
-//     // Array to hold the peak positions
-//     double peakPositionsX[NumPeakPositions] = { /* x coordinates */ };
-//     double peakPositionsY[NumPeakPositions] = { /* y coordinates */ };
+int PassedOutTrigger(double /*time*/, const float *values, void *arg)
+{
+	return values[((TraceTriggerState *)arg)->offset] > 0.5;
+}
 
-    
-//     double angleStep = (2 * M_PI) / NumPeakPositions;
-//     double radius = 25; // Change the radius as needed
+int NearSourceTrigger(double /*time*/, const float *values, void *arg)
+{
+	TraceTriggerState *t = (TraceTriggerState *)arg;
+	double dx = values[t->offset] - t->peakX, dy = values[t->offset + 1] - t->peakY;
+	return dx * dx + dy * dy < TraceNearDistance * TraceNearDistance;
+}
 
+// Record the respiratory chemotaxis trial of GENOTYPE from CONDITIONS as trial
+// TRIAL of FILE and return its fitness (with its penalties)
+double TraceTrial(TVector<double> &genotype, const TTrajectoryConditions &c, int trial, TTrajectoryFile &file)
+{
+	TArenaScope scratch;
+	Sniffer Agent(GenotypeNeurons(genotype));
+	GenotypeToAgent(genotype, Agent);
+	Agent.NervousSystem.SetIntegrator(Integrator);
+	AnalyticOdorField field(c.peakX, c.peakY, c.steepness, SpaceWidth, SpaceHeight);
+
+	TTrajectoryRecorder recorder(file);
+	recorder.SetDecimation(TraceDecimation);
+	TraceTriggerState state = {0, c.peakX, c.peakY};
+	if (TraceTrigger == "passed-out") {
+		state.offset = TrajectoryChannelOffset(file.Channels(), TRACE_BREATHING, file.Neurons()) + 2;
+		recorder.SetTrigger(PassedOutTrigger, &state, TraceWindowBefore, TraceWindowAfter);
+	}
+	else if (TraceTrigger == "near-source") {
+		state.offset = TrajectoryChannelOffset(file.Channels(), TRACE_POSITION, file.Neurons());
+		recorder.SetTrigger(NearSourceTrigger, &state, TraceWindowBefore, TraceWindowAfter);
+	}
 
-//     for (int i = 0; i < NumPeakPositions; ++i) {
-//         peakPositionsX[i] = initPosX + radius * std::cos(i * angleStep);
-//         peakPositionsY[i] = initPosY + radius * std::sin(i * angleStep);
-//     }
+	recorder.BeginTrial(trial, c);
+	double penalty = 0.0;
+	double fitness = ChemoRespTrial(Agent, field, c.x, c.y, c.theta, c.peakX, c.peakY, penalty, FullTiming(), &recorder);
+	recorder.EndTrial();
+	return fitness + penalty;
+}
 
-//     // Iterate over all peak positions
-//     for (int i = 0; i < NumPeakPositions; ++i) {
-//         // Reset agent to starting position
-//         Agent.Reset(initPosX, initPosY, 0.0);
+// A single trial from (x1, y1) towards a source at (chemicalsourceX, chemicalsourceY)
+void BehavioralTraces_Specific(TVector<double> &genotype, double x1, double y1, double chemicalsourceX, double chemicalsourceY,
+                               double steepness, TTrajectoryFile &file)
+{
+	TTrajectoryConditions c = {x1, y1, 0.0, chemicalsourceX, chemicalsourceY, steepness};
+	TraceTrial(genotype, c, 0, file);
+}
 
-//         // Peak position of chemical gradient
-//         double peakPositionX = peakPositionsX[i];
-//         double peakPositionY = peakPositionsY[i];
+// Trials from the center of the space towards sources spaced evenly on a circle
+void BehavioralTraces_Across_Conditions(TVector<double> &genotype, double steepness, TTrajectoryFile &file,
+                                        int NumPeakPositions = 6, double radius = 25)
+{
+    // Initialize the agent's position
+    double initPosX = 50.0;
+    double initPosY = 50.0;
+    double angleStep = (2 * M_PI) / NumPeakPositions;
+
+    // Iterate over all peak positions
+    for (int i = 0; i < NumPeakPositions; ++i) {
+        TTrajectoryConditions c = {initPosX, initPosY, 0.0, initPosX + radius * std::cos(i * angleStep),
+                                   initPosY + radius * std::sin(i * angleStep), steepness};
+        TraceTrial(genotype, c, i, file);
+    }
+}
 
-//         for (double time = 0; time < RunDuration; time += StepSize) {
-//             // Sense the gradient
-//             double gradientValue = DistanceGradient(Agent.posX, Agent.posY, peakPositionX, peakPositionY, steepness);
+// The trials of the evaluation, drawn REPEATS times from a generator seeded
+// with SEED, traced across the shared thread pool. The trials are written in
+// the order they finish; their numbers give the order they were drawn in.
+struct TraceBatch {TVector<double> *genotype; TTrajectoryFile *file; vector<TTrajectoryConditions> conditions;};
 
-//             Agent.Sense(gradientValue, time);
+void TraceTrialTask(int t, void *arg)
+{
+	TraceBatch *b = (TraceBatch *)arg;
+	TraceTrial(*b->genotype, b->conditions[t], t, *b->file);
+}
 
-//             // Move based on sensed gradient
-//             Agent.Step(StepSize);
+void BehavioralTraces_Trials(TVector<double> &genotype, TTrajectoryFile &file, long seed, int repeats)
+{
+	RandomState rs(seed);
+	TraceBatch batch;
+	batch.genotype = &genotype;
+	batch.file = &file;
+	vector<ChemoRespTrialSpec> specs;
+	for (int r = 0; r < repeats; r++) {
+		ChemoRespTrialConditions(rs, specs);
+		for (size_t i = 0; i < specs.size(); i++) {
+			TTrajectoryConditions c = {specs[i].x, specs[i].y, specs[i].theta, specs[i].peakX, specs[i].peakY, specs[i].steepness};
+			batch.conditions.push_back(c);
+		}
+	}
+	SharedThreadPool().ParallelFor(0, (int)batch.conditions.size() - 1, TraceTrialTask, &batch);
+}
 
-//             // Save the position at each timestep
-//             positionFile << Agent.posX << " " << Agent.posY << std::endl;
-//         }
-//     }
+// Write the trials of the trajectory file PATH as text, one record per line
+void TraceText(const string &path)
+{
+	TTrajectoryReader reader;
+	if (!reader.Open(path)) {
+		cerr << "Error: Cannot read the trajectory file " << path << endl;
+		exit(0);
+	}
+	cout << "# trial time " << TrajectoryColumnNames(reader.Channels(), reader.Neurons()) << "\n";
+	TTrajectoryTrial t;
+	while (reader.ReadTrial(t)) {
+		cout << "# trial " << t.trial << " start " << t.conditions.x << " " << t.conditions.y << " " << t.conditions.theta
+		     << " source " << t.conditions.peakX << " " << t.conditions.peakY << " steepness " << t.conditions.steepness << "\n";
+		for (int r = 0; r < t.Records(); r++) {
+			cout << t.trial << " " << t.time[r];
+			for (int k = 0; k < reader.Width(); k++) cout << " " << t.values[(size_t)r * reader.Width() + k];
+			cout << "\n";
+		}
+	}
+}
+
+
+// ------------------------------------
+// Limit sets
+// ------------------------------------
+
+// The attractors and equilibria of the circuit of GENOTYPE with its sensors
+// clamped: both chemical sensors at each value of CHEMICAL (the right one
+// higher than the left by each value of DIFFERENCE), and the O2 and CO2 sensors
+// at each value of O2 and CO2. The tables are written to OUTPUT and EQUILIBRIA.
+void LimitSet(TVector<double> &genotype, const vector<double> &chemical, const vector<double> &difference,
+              const vector<double> &o2, const vector<double> &co2, const TLimitSetSettings &settings,
+              const string &output, const string &equilibria)
+{
+	Sniffer Agent(GenotypeNeurons(genotype));
+	GenotypeToAgent(genotype, Agent);
+	int n = Agent.NervousSystem.CircuitSize();
+
+	// The external input of each neuron, as in TSniffer::Step
+	vector< vector<double> > inputs, columns;
+	for (size_t a = 0; a < chemical.size(); a++)
+		for (size_t b = 0; b < difference.size(); b++)
+			for (size_t c = 0; c < o2.size(); c++)
+				for (size_t d = 0; d < co2.size(); d++) {
+					double sensors[NumSensors] = {chemical[a] - difference[b] / 2, chemical[a] + difference[b] / 2, o2[c], co2[d]};
+					vector<double> in(n, 0.0);
+					for (int i = 0; i < n; i++)
+						for (int k = 0; k < NumSensors; k++)
+							in[i] += sensors[k] * Agent.sensorweights[i * NumSensors + k + 1];
+					inputs.push_back(in);
+					columns.push_back(vector<double>(sensors, sensors + NumSensors));
+				}
+
+	vector<TLimitSetResult> results;
+	AnalyseLimitSets(Agent.NervousSystem, inputs, settings, results);
+	ofstream table(output.c_str());
+	WriteLimitSetTable(table, results, "left right o2 co2", columns);
+	table.close();
+	ofstream eqtable(equilibria.c_str());
+	WriteEquilibriumTable(eqtable, results, "left right o2 co2", columns);
+	eqtable.close();
+}
+
+
+// ------------------------------------
+// Sensitivity and lesions
+// ------------------------------------
+
+// The elements that can be lesioned, numbered from 0: the N neurons (cut from
+// the circuit and the sensors), the N*N connections (from, to) and the
+// N*NumSensors sensor weights
+const char *SensorNames[NumSensors] = {"left", "right", "o2", "co2"};
+
+string LesionName(int e, int n)
+{
+	if (e < n) return "n" + to_string(e + 1);
+	e -= n;
+	if (e < n*n) return "w" + to_string(e / n + 1) + "_" + to_string(e % n + 1);
+	e -= n*n;
+	return "s" + to_string(e / NumSensors + 1) + "_" + SensorNames[e % NumSensors];
+}
+
+template<class Real>
+void ApplyLesion(TSniffer<Real> &Agent, int e)
+{
+	int n = Agent.NervousSystem.CircuitSize();
+	if (e < n) {
+		Agent.NervousSystem.LesionNeuron(e + 1);
+		for (int k = 1; k <= NumSensors; k++) Agent.SetSensorWeight(e * NumSensors + k, 0.0);
+	}
+	else if (e < n + n*n)
+		Agent.NervousSystem.SetConnectionWeight((e - n) / n + 1, (e - n) % n + 1, 0.0);
+	else
+		Agent.SetSensorWeight(e - n - n*n + 1, 0.0);
+}
+
+// The name of the phenotype parameter K, in the order of GenPhenMapping
+string ParameterName(int k, int n)
+{
+	if (k <= n) return "tau" + to_string(k);
+	if (k <= 2*n) return "bias" + to_string(k - n);
+	if (k <= 2*n + n*n) return LesionName(n + k - 2*n - 1, n);
+	return LesionName(n + n*n + k - 2*n - n*n - 1, n);
+}
+
+// The range [MIN, MAX] of the phenotype parameter K, as in GenPhenMapping
+void ParameterRange(int k, int n, double &min, double &max)
+{
+	if (k <= n) {min = TMIN; max = TMAX;}
+	else if (k <= 2*n) {min = -BR; max = BR;}
+	else if (k <= 2*n + n*n) {min = -WR; max = WR;}
+	else {min = -SR; max = SR;}
+}
+
+// A variant of the circuit: up to two lesioned elements (-1 for none) and a
+// phenotype parameter set to VALUE (0 for none)
+struct SensitivityVariant {int lesion1, lesion2, parameter; double value;};
+
+// Every variant is run on the same trials; the tasks are (variant, trial) pairs
+struct SensitivityBatch {
+	TVector<double> *genotype;
+	vector<SensitivityVariant> variants;
+	vector<ChemoRespTrialSpec> specs;
+	vector<double> fitness, penalty;
+};
+
+void SensitivityTask(int task, void *arg)
+{
+	SensitivityBatch *b = (SensitivityBatch *)arg;
+	int trials = b->specs.size();
+	SensitivityVariant &v = b->variants[task / trials];
+	ChemoRespTrialSpec &c = b->specs[task % trials];
+	TArenaScope scratch;
+	TVector<double> genotype(1, b->genotype->Size());
+	for (int k = 1; k <= genotype.Size(); k++) genotype[k] = (*b->genotype)[k];
+	if (v.parameter > 0) {
+		double min, max;
+		ParameterRange(v.parameter, GenotypeNeurons(genotype), min, max);
+		genotype[v.parameter] = InverseMapSearchParameter(v.value, min, max);
+	}
+	TSniffer<SimReal> Agent(GenotypeNeurons(genotype));
+	GenotypeToAgent(genotype, Agent);
+	if (v.lesion1 >= 0) ApplyLesion(Agent, v.lesion1);
+	if (v.lesion2 >= 0) ApplyLesion(Agent, v.lesion2);
+	Agent.NervousSystem.SetIntegrator(Integrator);
+	AnalyticOdorField field(c.peakX, c.peakY, c.steepness, SpaceWidth, SpaceHeight);
+	TCompensatedSum penalty;
+	b->fitness[task] = ChemoRespTrial(Agent, field, c.x, c.y, c.theta, c.peakX, c.peakY, penalty);
+	b->penalty[task] = penalty.Value();
+}
+
+// Measure the fitness of GENOTYPE with every single lesion, every pair of
+// lesions (of all elements if PAIRS is "all", of the neurons if "neurons",
+// none if "none") and each phenotype parameter moved down and up by DELTA times
+// its range (clipped to the range, so the two steps can differ). All
+// variants share the trials drawn REPEATS times from a generator seeded with
+// SEED, so their differences are not sampling noise. The tables are written to
+// PREFIX_lesions.dat, PREFIX_pairs.dat (the matrix of fitness changes, single
+// lesions on the diagonal) and PREFIX_perturbations.dat.
+double SensitivitySweep(TVector<double> &genotype, const string &pairs, double delta, long seed, int repeats,
+                        const string &prefix)
+{
+	int n = GenotypeNeurons(genotype);
+	int elements = n + n*n + n*NumSensors;
+	int paired = (pairs == "all") ? elements : (pairs == "neurons") ? n : 0;
+
+	SensitivityBatch batch;
+	batch.genotype = &genotype;
+	SensitivityVariant intact = {-1, -1, 0, 0.0};
+	batch.variants.push_back(intact);
+	for (int e = 0; e < elements; e++) {
+		SensitivityVariant v = {e, -1, 0, 0.0};
+		batch.variants.push_back(v);
+	}
+	for (int a = 0; a < paired; a++)
+		for (int b = a + 1; b < paired; b++) {
+			SensitivityVariant v = {a, b, 0, 0.0};
+			batch.variants.push_back(v);
+		}
+	TVector<double> phenotype(1, genotype.Size());
+	GenPhenMapping(genotype, phenotype);
+	for (int k = 1; k <= genotype.Size(); k++)
+		for (int sign = -1; sign <= 1; sign += 2) {
+			double min, max;
+			ParameterRange(k, n, min, max);
+			SensitivityVariant v = {-1, -1, k, clip(phenotype[k] + sign * delta * (max - min), min, max)};
+			batch.variants.push_back(v);
+		}
+
+	RandomState rs(seed);
+	vector<ChemoRespTrialSpec> specs;
+	for (int r = 0; r < repeats; r++) {
+		ChemoRespTrialConditions(rs, specs);
+		batch.specs.insert(batch.specs.end(), specs.begin(), specs.end());
+	}
+	int trials = batch.specs.size(), variants = batch.variants.size();
+	batch.fitness.assign(variants * trials, 0.0);
+	batch.penalty.assign(variants * trials, 0.0);
+	SharedThreadPool().ParallelFor(0, variants * trials - 1, SensitivityTask, &batch);
+
+	// Each variant's fitness, combined in trial order
+	vector<double> fitness(variants);
+	for (int v = 0; v < variants; v++) {
+		TCompensatedSum total;
+		for (int t = 0; t < trials; t++) {
+			total += batch.penalty[v * trials + t];
+			total += batch.fitness[v * trials + t];
+		}
+		fitness[v] = total.Value() / trials;
+	}
+	double base = fitness[0];
+
+	ofstream lesions((prefix + "_lesions.dat").c_str());
+	lesions << "# intact fitness " << base << " over " << trials << " trials\n# element fitness change\n";
+	for (int e = 0; e < elements; e++)
+		lesions << LesionName(e, n) << " " << fitness[1 + e] << " " << fitness[1 + e] - base << "\n";
+	lesions.close();
+
+	if (paired > 0) {
+		vector< vector<double> > matrix(paired, vector<double>(paired));
+		int v = 1 + elements;
+		for (int a = 0; a < paired; a++) {
+			matrix[a][a] = fitness[1 + a] - base;
+			for (int b = a + 1; b < paired; b++, v++)
+				matrix[a][b] = matrix[b][a] = fitness[v] - base;
+		}
+		ofstream pairfile((prefix + "_pairs.dat").c_str());
+		pairfile << "# fitness change with both elements lesioned (intact fitness " << base << ")\n#";
+		for (int a = 0; a < paired; a++) pairfile << " " << LesionName(a, n);
+		pairfile << "\n";
+		for (int a = 0; a < paired; a++) {
+			for (int b = 0; b < paired; b++) pairfile << (b > 0 ? " " : "") << matrix[a][b];
+			pairfile << "\n";
+		}
+		pairfile.close();
+	}
+
+	ofstream perturbations((prefix + "_perturbations.dat").c_str());
+	perturbations << "# phenotype parameters moved by " << delta << " of their range (intact fitness " << base << ")\n"
+	              << "# parameter value low high fitness_low fitness_high slope (fitness change per unit of the parameter)\n";
+	int v = 1 + elements + paired * (paired - 1) / 2;
+	for (int k = 1; k <= genotype.Size(); k++, v += 2) {
+		double low = batch.variants[v].value, high = batch.variants[v + 1].value;
+		perturbations << ParameterName(k, n) << " " << phenotype[k] << " " << low << " " << high << " "
+		              << fitness[v] << " " << fitness[v + 1] << " " << (fitness[v + 1] - fitness[v]) / (high - low) << "\n";
+	}
+	perturbations.close();
+	return base;
+}
+
+// The fitness of GENOTYPE measured over evaluation windows of each length in
+// WINDOWS after the same transient, on the trials drawn REPEATS times from a
+// generator seeded with SEED, into FITNESS (RESUMED counts the trials of each
+// window that resumed from a cached transient), and return the number of
+// trials. Only the first window runs the transients; the others resume from the
+// cached states it leaves (the cache is enlarged to hold them all if it is
+// smaller).
+int WindowFitness(TVector<double> &genotype, const vector<double> &windows, long seed, int repeats,
+                   vector<double> &fitness, vector<int> &resumed)
+{
+	ChemoRespTrialBatch batch;
+	batch.genotype = &genotype;
+	RandomState rs(seed);
+	vector<ChemoRespTrialSpec> specs;
+	for (int r = 0; r < repeats; r++) {
+		ChemoRespTrialConditions(rs, specs);
+		batch.specs.insert(batch.specs.end(), specs.begin(), specs.end());
+	}
+	int trials = batch.specs.size();
+	if (TransientCache.Capacity() < trials) TransientCache.SetCapacity(trials);
+
+	fitness.assign(windows.size(), 0.0);
+	resumed.assign(windows.size(), 0);
+	for (size_t w = 0; w < windows.size(); w++) {
+		if (windows[w] <= 0) {
+			cerr << "Error: Invalid evaluation window " << windows[w] << endl;
+			exit(0);
+		}
+		TrialTiming timing = {StepSize, TransDuration + windows[w], TransDuration};
+		batch.timing = timing;
+		batch.fitness.assign(trials, 0.0);
+		batch.penalty.assign(trials, 0.0);
+		batch.resumed.assign(trials, 0);
+		SharedThreadPool().ParallelFor(0, trials - 1, ChemoRespTrialTask, &batch);
+		TCompensatedSum total;
+		for (int t = 0; t < trials; t++) {
+			total += batch.penalty[t];
+			total += batch.fitness[t];
+			resumed[w] += batch.resumed[t];
+		}
+		fitness[w] = total.Value() / trials;
+	}
+	return trials;
+}
+
+// WindowFitness written to PATH
+void EvaluationWindows(TVector<double> &genotype, const vector<double> &windows, long seed, int repeats,
+                       const string &path)
+{
+	vector<double> fitness;
+	vector<int> resumed;
+	int trials = WindowFitness(genotype, windows, seed, repeats, fitness, resumed);
+	ofstream file(path.c_str());
+	file << "# fitness after a transient of " << TransDuration << " over " << trials << " trials\n"
+	     << "# window fitness resumed\n";
+	for (size_t w = 0; w < windows.size(); w++)
+		file << windows[w] << " " << fitness[w] << " " << resumed[w] << "\n";
+	file.close();
+}
 
-//     positionFile.close();
-// }
 
 // ================================================
 // C. ADDITIONAL EVOLUTIONARY FUNCTIONS
 // ================================================
 int TerminationFunction(int Generation, double BestPerf, double AvgPerf, double PerfVar) {
-	if (BestPerf > 0.99) return 1;
+	if (BestPerf > TargetFitness) return 1;
 	else return 0;
 }
 
@@ -770,7 +1515,7 @@ int TerminationFunctionFirst(int Generation, double BestPerf, double AvgPerf, do
 // ------------------------------------
 void EvolutionaryRunDisplay(int Generation, double BestPerf, double AvgPerf, double PerfVar)
 {
-	cout << Generation << " " << BestPerf << " " << AvgPerf << " " << PerfVar << endl;
+	cout << Generation << " " << BestPerf << " " << AvgPerf << " " << PerfVar << "\n";
 }
 
 void ResultsDisplay(TSearch &s)
@@ -826,28 +1571,653 @@ void ResultsDisplay(TSearch &s)
 	BestIndividualFile.close();
 }
 
+// Set up a search with the EA params
+void ConfigureSearch(TSearch &s, long seed, int popsize = POPSIZE, int gens = GENS)
+{
+	s.SetRandomSeed(seed);
+	s.SetSelectionMode(RANK_BASED);
+	s.SetReproductionMode(REPRODUCTION);
+	s.SetRestartMode(RESTARTS);
+	s.SetInitialStepSize(CMA_SIGMA);
+	s.SetMaxRestarts(MAX_RESTARTS);
+	s.SetScreeningCandidates(SCREEN_CANDIDATES);
+	s.SetHonestFraction(HONEST_FRACTION);
+	s.SurrogateModel().SetFeatures(SURROGATE_FEATURES);
+	s.SurrogateModel().SetWindow(SURROGATE_WINDOW);
+	s.SetPopulationSize(popsize);
+	s.SetMaxGenerations(gens);
+	s.SetCrossoverProbability(CROSSPROB);
+	s.SetCrossoverMode(UNIFORM);
+	s.SetMutationVariance(MUTVAR);
+	s.SetMaxExpectedOffspring(EXPECTED);
+	s.SetElitistFraction(ELITISM);
+	s.SetCommonRandomNumbers(COMMON_TRIALS);
+	s.SetLowFidelityFraction(LOW_FIDELITY_FRACTION);
+	s.SetSearchConstraint(1);
+}
+
 // ------------------------------------
-// THE MAIN PROGRAM 
+// Determinism check
 // ------------------------------------
-int main (int argc, const char* argv[]) 
+
+// A display function that leaves the output of the checks and the timed output
+// of the benchmark uncluttered
+void QuietDisplay(int, double, double, double) {}
+
+// The benchmark search: a few generations of the respiratory chemotaxis task
+// with short trials, from a fixed seed
+const int BenchGens = 4;
+const int BenchPopSize = 24;
+const long BenchSeed = 1;
+const double BenchRunDuration = 600;
+const double BenchTransDuration = 550;
+
+// Run the benchmark search with 1, 4 and 64 threads, with population-level and
+// with trial-level parallelism, and check that for each kind of parallelism
+// every thread count finds the same best genotype and performance, bit for
+// bit. The best performance must be above 0, so that the ranking is not decided
+// by ties of performances clipped to 0; the unclipped fitness of the best
+// genotype is compared as well. Returns 1 if all runs agree.
+int DeterminismCheck(int gens = BenchGens, int popsize = BenchPopSize, long seed = BenchSeed)
 {
+	const int threadCounts[] = {1, 4, 64};
+	double savedRun = RunDuration, savedTransient = TransDuration;
+	SetTrialDuration(BenchRunDuration, BenchTransDuration);
+	int passed = 1;
+
+	for (int trialLevel = 0; trialLevel <= 1; trialLevel++) {
+		double (*evaluate)(TVector<double> &, RandomState &) = trialLevel ? ParallelFitnessChemoIndexResp : FitnessFunctionChemoIndexResp;
+		TVector<double> reference;
+		double referencePerf = 0.0, referenceFit = 0.0;
+		for (int k = 0; k < 3; k++) {
+			TSearch s(VectSize);
+			ConfigureSearch(s, seed, popsize, gens);
+			s.SetThreadCount(threadCounts[k]);
+			s.SetTrialParallelism(trialLevel);
+			s.SetEvaluationFunction(evaluate);
+			s.ExecuteSearch();
+			RandomState rs(seed);
+			double fit = (*evaluate)(s.BestIndividual(), rs);
+
+			int same = 1;
+			if (k == 0) {
+				reference = s.BestIndividual();
+				referencePerf = s.BestPerformance();
+				referenceFit = fit;
+				same = (referencePerf > 0);
+			}
+			else {
+				same = (s.BestPerformance() == referencePerf) && (fit == referenceFit);
+				for (int i = 1; i <= VectSize; i++)
+					if (s.BestIndividual()[i] != reference[i]) same = 0;
+			}
+			cout << (trialLevel ? "trial" : "population") << "-level, " << threadCounts[k] << " threads: best "
+			     << setprecision(17) << s.BestPerformance() << ", fitness " << fit << (same ? "" : k == 0 ? "  CLIPPED TO 0" : "  MISMATCH") << endl;
+			if (!same) passed = 0;
+		}
+	}
+	SharedThreadPool().SetThreadCount(THREAD_COUNT);
+	SetTrialDuration(savedRun, savedTransient);
+	cout << "Determinism check " << (passed ? "passed" : "FAILED") << endl;
+	return passed;
+}
 
-//-------------------------------------
-// EVOLUTION 
-//-------------------------------------
+// Check that no evaluation run so far has left a vector in arena storage after
+// its scope ended, and that such a vector is detected: one resized inside a
+// scope, whether it started on the heap or in an enclosing scope's arena. A
+// vector resized under a TArenaSuspend must not be counted.
+int ArenaCheck(void)
+{
+	long before = ArenaEscapeCount();
+	int passed = (before == 0);
+	TVector<double> outer(1, 4);
+	{
+		TArenaScope scope;
+		outer.SetSize(1000);
+	}
+	outer.SetSize(0);
+	{
+		TArenaScope scope;
+		TVector<double> enclosing(1, 10);
+		{
+			TArenaScope inner;
+			enclosing.SetSize(20);
+		}
+		enclosing.SetSize(0);
+	}
+	long detected = ArenaEscapeCount() - before;
+	{
+		TArenaScope scope;
+		TArenaSuspend heap;
+		outer.SetSize(2000);
+	}
+	outer.SetSize(0);
+	long suspended = ArenaEscapeCount() - before - detected;
+	if (detected != 2 || suspended != 0) passed = 0;
+	cout << "Arena check: " << before << " escapes in the evaluations, " << detected << " of 2 planted detected, "
+	     << suspended << " false" << endl;
+	cout << "Arena check " << (passed ? "passed" : "FAILED") << endl;
+	return passed;
+}
+
+// Check that a trial resumed from a cached transient gives exactly the result
+// of running it from the start: a random genotype is evaluated on trials of
+// RUN/TRANSIENT time units with the cache off, then twice with it on (the
+// second evaluation resuming every trial), and its evaluation windows are
+// compared with uncached evaluations of the same length. Returns 1 if all agree.
+int TransientCacheCheck(double run = 600, double transient = 550, long seed = 1)
+{
+	double savedRun = RunDuration, savedTransient = TransDuration;
+	int savedCapacity = TransientCache.Capacity();
+	SetTrialDuration(run, transient);
+	RandomState grs(seed);
+	TVector<double> genotype(1, VectSize);
+	for (int i = 1; i <= VectSize; i++) genotype[i] = grs.UniformRandom(MinSearchValue, MaxSearchValue);
+	vector<ChemoRespTrialSpec> specs;
+	ChemoRespTrialConditions(grs, specs);
+	long trials = specs.size();
+	int passed = 1;
+
+	TransientCache.SetCapacity(0);
+	RandomState rs0(seed);
+	double uncached = ParallelFitnessChemoIndexResp(genotype, rs0);
+	TransientCache.SetCapacity(4 * trials);
+	RandomState rs1(seed), rs2(seed);
+	double stored = ParallelFitnessChemoIndexResp(genotype, rs1);
+	long before = AgentSteps;
+	double resumed = ParallelFitnessChemoIndexResp(genotype, rs2);
+	long resumedSteps = AgentSteps - before;
+	// A resumed evaluation runs only the evaluation windows of its trials
+	long windowSteps = trials * (long)ceil((run - transient) / StepSize + 1);
+	if (stored != uncached || resumed != uncached || resumedSteps > windowSteps) passed = 0;
+	cout << "Transient cache check: uncached " << setprecision(17) << uncached << ", stored " << stored
+	     << ", resumed " << resumed << " in " << resumedSteps << " steps" << endl;
+
+	// The second window resumes from the first one's transients
+	vector<double> windows, fitness;
+	vector<int> hits;
+	windows.push_back(run - transient);
+	windows.push_back(2 * (run - transient));
+	TransientCache.Clear();
+	WindowFitness(genotype, windows, seed, 1, fitness, hits);
+	TransientCache.SetCapacity(0);
+	for (size_t w = 0; w < windows.size(); w++) {
+		TrialTiming timing = {StepSize, transient + windows[w], transient};
+		RandomState rs(seed);
+		double reference = ParallelChemoIndexRespFitness(genotype, rs, timing);
+		int same = (fitness[w] == reference) && (hits[w] == (w == 0 ? 0 : trials));
+		if (!same) passed = 0;
+		cout << "window " << windows[w] << ": " << fitness[w] << " (" << hits[w] << " trials resumed), uncached "
+		     << reference << (same ? "" : "  MISMATCH") << endl;
+	}
+
+	TransientCache.SetCapacity(savedCapacity);
+	SetTrialDuration(savedRun, savedTransient);
+	cout << "Transient cache check " << (passed ? "passed" : "FAILED") << endl;
+	return passed;
+}
+
+// The objective of the CMA-ES check: a quadratic bowl, scaled differently along
+// each coordinate, whose peak of 1 is at CMACheckOptimum in every coordinate
+const double CMACheckOptimum = 0.3;
+
+double QuadraticPerformance(TVector<double> &v, RandomState &)
+{
+	double d = 0.0;
+	for (int i = 1; i <= v.Size(); i++)
+		d += i * (v[i] - CMACheckOptimum) * (v[i] - CMACheckOptimum);
+	return 1.0 / (1.0 + d);
+}
 
-    long randomseed = static_cast<long>(time(NULL));
+// Stops the first half of the interrupted CMA-ES check
+int CMACheckInterruptGen = 0;
+
+int CMACheckInterrupt(int Generation, double, double, double)
+{
+	return Generation >= CMACheckInterruptGen;
+}
+
+void ConfigureCMACheck(TSearch &s, TRestartMode mode, int gens, long seed)
+{
+	s.SetRandomSeed(seed);
+	s.SetReproductionMode(CMA_ES);
+	s.SetRestartMode(mode);
+	s.SetInitialStepSize(0.5);
+	s.SetMaxRestarts(9);
+	s.SetPopulationSize(8);
+	s.SetMaxGenerations(gens);
+	s.SetSearchConstraint(1);
+	s.SetEvaluationFunction(QuadraticPerformance);
+	s.SetPopulationStatisticsDisplayFunction(QuietDisplay);
+}
+
+// Run CMA-ES with IPOP and BIPOP restarts on QuadraticPerformance in DIM
+// dimensions for GENS generations, and check that it converges to the peak and
+// restarts at least once. Then run the same search stopped halfway, resume it
+// from its checkpoint in a new search object, and check that it ends in the
+// same state, bit for bit: the best individual, the final population and their
+// performances, the step size and the number of restarts. Returns 1 if all pass.
+int CMAESCheck(int dim = 5, int gens = 400, long seed = 1)
+{
+	const TRestartMode modes[] = {IPOP, BIPOP};
+	const char *names[] = {"IPOP", "BIPOP"};
+	const string checkpoint = "CMAESCheck.cpt";
+	int passed = 1;
+
+	for (int m = 0; m < 2; m++) {
+		TSearch full(dim);
+		ConfigureCMACheck(full, modes[m], gens, seed);
+		full.ExecuteSearch();
+		int converged = full.BestPerformance() > 1 - 1e-9 && full.Restarts() > 0;
+
+		TSearch first(dim);
+		ConfigureCMACheck(first, modes[m], gens, seed);
+		first.SetCheckpointFileName(checkpoint);
+		first.SetCheckpointInterval(1);
+		CMACheckInterruptGen = gens / 2;
+		first.SetSearchTerminationFunction(CMACheckInterrupt);
+		first.ExecuteSearch();
+		int interruptedRestarts = first.Restarts();
+		TSearch resumed(dim);
+		resumed.SetEvaluationFunction(QuadraticPerformance);
+		resumed.SetPopulationStatisticsDisplayFunction(QuietDisplay);
+		resumed.SetCheckpointFileName(checkpoint);
+		resumed.ResumeSearch();
+		unlink(checkpoint.c_str());
+		int same = resumed.BestPerformance() == full.BestPerformance() && resumed.Restarts() == full.Restarts() &&
+		           resumed.StepSize() == full.StepSize() && resumed.PopulationSize() == full.PopulationSize();
+		for (int i = 1; i <= dim; i++)
+			if (resumed.BestIndividual()[i] != full.BestIndividual()[i]) same = 0;
+		for (int k = 1; same && k <= full.PopulationSize(); k++) {
+			if (resumed.Performance(k) != full.Performance(k)) same = 0;
+			for (int i = 1; i <= dim; i++)
+				if (resumed.Individual(k)[i] != full.Individual(k)[i]) same = 0;
+		}
+
+		cout << "CMA-ES " << names[m] << ": best " << setprecision(17) << full.BestPerformance() << " after "
+		     << full.Restarts() << " restarts" << (converged ? "" : "  NOT CONVERGED") << "; resumed after "
+		     << interruptedRestarts << " restarts: best " << resumed.BestPerformance() << (same ? "" : "  MISMATCH") << endl;
+		if (!converged || !same) passed = 0;
+	}
+	cout << "CMA-ES check " << (passed ? "passed" : "FAILED") << endl;
+	return passed;
+}
+
+// ------------------------------------
+// Throughput benchmark
+// ------------------------------------
+
+// The results of the benchmark search are compared with those stored in this
+// file, to within a relative tolerance that allows for floating-point
+// contraction on other compilers and targets
+const char *BenchGoldenFile = "bench.golden";
+const double BenchGoldenTolerance = 1e-9;
+
+// Run the benchmark search with each of the given thread counts and report
+// agent steps per second and generations per hour. The best and average
+// performance of the final population must match the golden file (WRITEGOLDEN
+// replaces it instead). Returns 1 if every run matched.
+int ThroughputBenchmark(const vector<int> &threadCounts, int writeGolden = 0)
+{
+	SetTrialDuration(BenchRunDuration, BenchTransDuration);
+	double goldenBest = 0.0, goldenAvg = 0.0;
+	int haveGolden = 0;
+	if (!writeGolden) {
+		ifstream golden(BenchGoldenFile);
+		string line;
+		while (getline(golden, line))
+			if (!line.empty() && line[0] != '#') {
+				istringstream fields(line);
+				int gens, popsize;
+				long seed;
+				double run, transient;
+				fields >> gens >> popsize >> seed >> run >> transient >> goldenBest >> goldenAvg;
+				haveGolden = fields && gens == BenchGens && popsize == BenchPopSize && seed == BenchSeed &&
+				             run == BenchRunDuration && transient == BenchTransDuration;
+			}
+		if (!haveGolden)
+			cerr << "Warning: No golden results for this benchmark in " << BenchGoldenFile << endl;
+	}
+
+	int passed = 1;
+	cout << "threads  seconds  agent-steps/s  gens/hour  best  average" << endl;
+	for (size_t k = 0; k < threadCounts.size(); k++) {
+		TSearch s(VectSize);
+		ConfigureSearch(s, BenchSeed, BenchPopSize, BenchGens);
+		s.SetThreadCount(threadCounts[k]);
+		s.SetEvaluationFunction(FitnessFunctionChemoIndexResp);
+		s.SetPopulationStatisticsDisplayFunction(QuietDisplay);
+		AgentSteps = 0;
+		double start = WallClock();
+		s.ExecuteSearch();
+		double elapsed = WallClock() - start;
+		// The search evaluates the initial population and then BenchGens generations
+		double best = s.BestPerformance(), avg = 0.0;
+		for (int i = 1; i <= s.PopulationSize(); i++) avg += s.Performance(i);
+		avg /= s.PopulationSize();
+		cout << threadCounts[k] << "  " << setprecision(4) << elapsed << "  " << AgentSteps / elapsed
+		     << "  " << 3600.0 * (BenchGens + 1) / elapsed << "  " << setprecision(17) << best << "  " << avg;
+		if (haveGolden) {
+			int same = fabs(best - goldenBest) <= BenchGoldenTolerance * fabs(goldenBest) &&
+			           fabs(avg - goldenAvg) <= BenchGoldenTolerance * fabs(goldenAvg);
+			cout << (same ? "" : "  MISMATCH");
+			if (!same) passed = 0;
+		}
+		cout << endl;
+		if (writeGolden && k == 0) {
+			ofstream golden(BenchGoldenFile);
+			golden << "# generations popsize seed runduration transduration best average" << endl;
+			golden << BenchGens << " " << BenchPopSize << " " << BenchSeed << " " << BenchRunDuration << " "
+			       << BenchTransDuration << " " << setprecision(17) << best << " " << avg << endl;
+		}
+	}
+	SharedThreadPool().SetThreadCount(THREAD_COUNT);
+	if (!writeGolden && haveGolden)
+		cout << "Golden results " << (passed ? "matched" : "DID NOT MATCH") << endl;
+	return passed;
+}
+
+// ------------------------------------
+// Configuration
+// ------------------------------------
+
+// The default configuration. Experiments start from it, then apply their INI
+// files and command-line assignments, so every experiment in a process sees
+// the same defaults. "main defaults" prints it as a template.
+string DefaultConfiguration(void)
+{
+	return
+	"[run]\n"
+	"mode = evolve              ; evolve, performance-map, integrator, select-step, precision,\n"
+	"                           ; trace, trace-conditions, trace-trials, trace-text, limit-set,\n"
+	"                           ; sensitivity, windows, check, bench\n"
+	"index =                    ; added to output file names and to the time-based seed\n"
+	"genotype =                 ; the genotype file analysed by the other modes\n"
+	"genotypes =                ; the genotype files compared by precision\n"
+	"output = PerformanceMap.dat\n"
+	"\n"
+	"[task]\n"
+	"fitness = resp             ; chemo, resp, resp-trials, resp-adaptive, resp-fluid\n"
+	"neurons = 4\n"
+	"run_duration = 6000\n"
+	"transient_duration = 5500\n"
+	"step_size = 0.01\n"
+	"integrator = euler         ; euler, exponential-euler, rk4\n"
+	"steepness_min = 0.1\n"
+	"steepness_max = 2.0\n"
+	"steepness_step = 0.5\n"
+	"low_fidelity_transient = 500   ; the pre-runs of multi-fidelity evaluation (resp, resp-trials)\n"
+	"low_fidelity_step_size = 0.05\n"
+	"transient_cache = 0        ; end-of-transient states kept for evaluations repeated on the same trials\n"
+	"                           ; (resp-trials; 0 disables; the windows mode sizes it as it needs)\n"
+	"\n"
+	"[search]\n"
+	"seed = time                ; an integer, or time for the clock plus the index\n"
+	"threads = " + to_string(THREAD_COUNT) + "\n"
+	"reproduction = ga          ; ga, hill-climbing, cma-es\n"
+	"popsize = 500              ; cma-es: the offspring of the first run (e.g. 16)\n"
+	"generations = 1000\n"
+	"stage1_generations = 0     ; generations of the chemo task before the main one (0 skips it)\n"
+	"mutation_variance = 0.2\n"
+	"crossover_probability = 0.05\n"
+	"expected_offspring = 1.1\n"
+	"elitism = 0.02\n"
+	"restarts = bipop           ; cma-es: none, ipop, bipop\n"
+	"cma_step_size = 0.5\n"
+	"max_restarts = 9\n"
+	"screen_candidates = 1      ; ga, hill-climbing: mutants a surrogate picks each child from (1 disables)\n"
+	"honest_fraction = 0.2      ; children left unscreened to check the surrogate\n"
+	"surrogate_features = 128\n"
+	"surrogate_window = 1000    ; the most recent evaluations it is trained on\n"
+	"low_fidelity_fraction = 1  ; below 1: pre-run everyone at low fidelity, evaluate the best fraction in full\n"
+	"common_trials = false      ; one set of trial conditions per generation, shared by all individuals\n"
+	"target_fitness = 0.99\n"
+	"checkpoint_interval = 1\n"
+	"async_checkpoints = true\n"
+	"\n"
+	"[analysis]\n"
+	"integrator = exponential-euler\n"
+	"step_size = 0.05\n"
+	"tolerance = 0.01\n"
+	"\n"
+	"[trace]\n"
+	"output = Traces.trj        ; trace-text reads this file\n"
+	"channels = position        ; position, heading, neurons, respiration, sensors, breathing, all\n"
+	"decimation = 1             ; record every n-th step\n"
+	"trigger = none             ; none, passed-out, near-source\n"
+	"window_before = 100        ; samples recorded before and after each triggering sample\n"
+	"window_after = 100\n"
+	"near_distance = 5\n"
+	"start_x = 10               ; the trial of trace\n"
+	"start_y = 10\n"
+	"source_x = 50\n"
+	"source_y = 50\n"
+	"steepness = 1.5            ; trace and trace-conditions\n"
+	"sources = 6                ; trace-conditions: sources on a circle around the center\n"
+	"radius = 25\n"
+	"repeats = 1                ; trace-trials: the evaluation trials, drawn this many times\n"
+	"seed = 0\n"
+	"\n"
+	"[limitset]\n"
+	"chemical = 0 1 11          ; both chemical sensors (min max count)\n"
+	"difference = 0 0 1         ; the right chemical sensor minus the left\n"
+	"o2 = 100 100 1\n"
+	"co2 = 0 0 1\n"
+	"integrator = rk4\n"
+	"step_size = 0.01\n"
+	"transient = 500\n"
+	"window = 200\n"
+	"tolerance = 1e-4           ; the largest state range of a fixed point\n"
+	"cycle_tolerance = 1e-3     ; the largest return distance of a cycle, relative to its range\n"
+	"newton_starts = 20\n"
+	"seed = 0\n"
+	"output = LimitSets.dat\n"
+	"equilibria = Equilibria.dat\n"
+	"\n"
+	"[sensitivity]\n"
+	"pairs = all                ; the pairwise lesions: all, neurons, none\n"
+	"delta = 0.025              ; the phenotype perturbation, as a fraction of each parameter's range\n"
+	"repeats = 1                ; the evaluation trials, drawn this many times\n"
+	"seed = 0\n"
+	"output = Sensitivity       ; the prefix of the tables\n"
+	"\n"
+	"[windows]\n"
+	"lengths = 100 250 500      ; the evaluation windows, all after the transient of the task\n"
+	"repeats = 1                ; the evaluation trials, drawn this many times\n"
+	"seed = 0\n"
+	"output = Windows.dat\n"
+	"\n"
+	"[batch]\n"
+	"seeds =                    ; run a search for each seed (and each size below), side by side\n"
+	"neurons =\n"
+	"concurrency = 0            ; the searches run at once (0 for as many as there are threads)\n"
+	"\n"
+	"[bench]\n"
+	"threads =                  ; 1 and all hardware threads if empty\n"
+	"golden = false\n";
+}
+
+TIntegrator IntegratorByName(const string &name)
+{
+	if (name == "euler") return EULER;
+	if (name == "exponential-euler") return EXPONENTIAL_EULER;
+	if (name == "rk4") return RUNGE_KUTTA4;
+	cerr << "Error: Unknown integrator " << name << endl;
+	exit(0);
+}
+
+TReproductionMode ReproductionByName(const string &name)
+{
+	if (name == "ga") return GENETIC_ALGORITHM;
+	if (name == "hill-climbing") return HILL_CLIMBING;
+	if (name == "cma-es") return CMA_ES;
+	cerr << "Error: Unknown reproduction mode " << name << endl;
+	exit(0);
+}
+
+TRestartMode RestartsByName(const string &name)
+{
+	if (name == "none") return NO_RESTARTS;
+	if (name == "ipop") return IPOP;
+	if (name == "bipop") return BIPOP;
+	cerr << "Error: Unknown restart strategy " << name << endl;
+	exit(0);
+}
+
+// The fitness functions that can be selected by name (TRIALPARALLEL marks
+// those that spread their trials over the thread pool, and LOWFIDELITY is the
+// cheaper version used by multi-fidelity evaluation, if there is one)
+struct FitnessFunctionEntry {
+	const char *name;
+	double (*function)(TVector<double> &, RandomState &);
+	int trialParallel;
+	double (*lowFidelity)(TVector<double> &, RandomState &);
+};
+
+const FitnessFunctionEntry FitnessFunctions[] = {
+	{"chemo", FitnessFunctionChemoIndex, 0, NULL},
+	{"resp", FitnessFunctionChemoIndexResp, 0, LowFidelityChemoIndexResp},
+	{"resp-trials", ParallelFitnessChemoIndexResp, 1, ParallelLowFidelityChemoIndexResp},
+	{"resp-adaptive", FitnessFunctionChemoIndexRespAdaptive, 0, NULL},
+	{"resp-fluid", FitnessFunctionChemoIndexRespFluid, 0, NULL}
+};
+
+const FitnessFunctionEntry &FitnessFunctionByName(const string &name)
+{
+	for (size_t i = 0; i < sizeof(FitnessFunctions) / sizeof(FitnessFunctions[0]); i++)
+		if (name == FitnessFunctions[i].name) return FitnessFunctions[i];
+	cerr << "Error: Unknown fitness function " << name << endl;
+	exit(0);
+}
+
+// Set the task and search parameters from CFG
+void ApplyConfiguration(TConfig &cfg)
+{
+	N = cfg.Integer("task.neurons", N);
+	VectSize = N*N + 2*N + NumSensors*N;
+	SetTrialDuration(cfg.Real("task.run_duration", RunDuration), cfg.Real("task.transient_duration", TransDuration));
+	LowFidelityTransient = cfg.Real("task.low_fidelity_transient", LowFidelityTransient);
+	LowFidelityStepSize = cfg.Real("task.low_fidelity_step_size", LowFidelityStepSize);
+	TransientCache.SetCapacity(cfg.Integer("task.transient_cache", TransientCache.Capacity()));
+	StepSize = cfg.Real("task.step_size", StepSize);
+	Integrator = IntegratorByName(cfg.String("task.integrator", "euler"));
+	MinSteepness = cfg.Real("task.steepness_min", MinSteepness);
+	MaxSteepness = cfg.Real("task.steepness_max", MaxSteepness);
+	SteepnessStep = cfg.Real("task.steepness_step", SteepnessStep);
+
+	SharedThreadPool().SetThreadCount(cfg.Integer("search.threads", THREAD_COUNT));
+	POPSIZE = cfg.Integer("search.popsize", POPSIZE);
+	GENS = cfg.Integer("search.generations", GENS);
+	Stage1Gens = cfg.Integer("search.stage1_generations", Stage1Gens);
+	MUTVAR = cfg.Real("search.mutation_variance", MUTVAR);
+	CROSSPROB = cfg.Real("search.crossover_probability", CROSSPROB);
+	EXPECTED = cfg.Real("search.expected_offspring", EXPECTED);
+	ELITISM = cfg.Real("search.elitism", ELITISM);
+	REPRODUCTION = ReproductionByName(cfg.String("search.reproduction", "ga"));
+	RESTARTS = RestartsByName(cfg.String("search.restarts", "bipop"));
+	CMA_SIGMA = cfg.Real("search.cma_step_size", CMA_SIGMA);
+	MAX_RESTARTS = cfg.Integer("search.max_restarts", MAX_RESTARTS);
+	SCREEN_CANDIDATES = cfg.Integer("search.screen_candidates", SCREEN_CANDIDATES);
+	HONEST_FRACTION = cfg.Real("search.honest_fraction", HONEST_FRACTION);
+	SURROGATE_FEATURES = cfg.Integer("search.surrogate_features", SURROGATE_FEATURES);
+	SURROGATE_WINDOW = cfg.Integer("search.surrogate_window", SURROGATE_WINDOW);
+	COMMON_TRIALS = cfg.Flag("search.common_trials", COMMON_TRIALS);
+	LOW_FIDELITY_FRACTION = cfg.Real("search.low_fidelity_fraction", LOW_FIDELITY_FRACTION);
+	TargetFitness = cfg.Real("search.target_fitness", TargetFitness);
+	CHECKPOINT_INTERVAL = cfg.Integer("search.checkpoint_interval", CHECKPOINT_INTERVAL);
+}
+
+// Set the trace settings from CFG and return the channels to record
+int TraceChannels(TConfig &cfg)
+{
+	vector<string> names = cfg.List("trace.channels");
+	int channels = 0;
+	for (size_t i = 0; i < names.size(); i++) {
+		int c = TrajectoryChannelByName(names[i]);
+		if (c == 0) {
+			cerr << "Error: Unknown trace channel " << names[i] << endl;
+			exit(0);
+		}
+		channels |= c;
+	}
+	TraceDecimation = cfg.Integer("trace.decimation", TraceDecimation);
+	TraceTrigger = cfg.String("trace.trigger", TraceTrigger);
+	TraceWindowBefore = cfg.Integer("trace.window_before", TraceWindowBefore);
+	TraceWindowAfter = cfg.Integer("trace.window_after", TraceWindowAfter);
+	TraceNearDistance = cfg.Real("trace.near_distance", TraceNearDistance);
+	int needed = 0;
+	if (TraceTrigger == "passed-out") needed = TRACE_BREATHING;
+	else if (TraceTrigger == "near-source") needed = TRACE_POSITION;
+	else if (TraceTrigger != "none") {
+		cerr << "Error: Unknown trace trigger " << TraceTrigger << endl;
+		exit(0);
+	}
+	if (needed && !(channels & needed)) {
+		cerr << "Error: The " << TraceTrigger << " trigger needs the " << TrajectoryColumnNames(needed, 0) << " values recorded" << endl;
+		exit(0);
+	}
+	return channels;
+}
+
+// The COUNT values from MIN to MAX given by the setting KEY ("min max count")
+vector<double> SettingRange(TConfig &cfg, const string &key)
+{
+	vector<string> items = cfg.List(key);
+	int count = items.size() == 3 ? atoi(items[2].c_str()) : 0;
+	if (count < 1) {
+		cerr << "Error: " << key << " must be \"min max count\"" << endl;
+		exit(0);
+	}
+	double lo = atof(items[0].c_str()), hi = atof(items[1].c_str());
+	vector<double> values;
+	for (int i = 0; i < count; i++) values.push_back(count == 1 ? lo : lo + (hi - lo) * i / (count - 1));
+	return values;
+}
+
+// Read the genotype stored in PATH
+void ReadGenotype(const string &path, TVector<double> &genotype)
+{
+	ifstream genefile(path.c_str());
+	if (path.empty() || !genefile) {
+		cerr << "Error: Cannot open genotype file " << path << endl;
+		exit(0);
+	}
+	genotype.SetBounds(1, VectSize);
+	genefile >> genotype;
+}
+
+
+// ------------------------------------
+// Evolution
+// ------------------------------------
+
+// An evolutionary run and the files it writes
+struct EvolutionRun {
+    TSearch *search;
+    const FitnessFunctionEntry *fitness;
+    std::string fileIndex, nStr, genotypesDir, nervSystemsDir, evoDir;
+    long seed;
+    int resume;
+};
+
+// Create the output directories and the search of the run configured by CFG
+// (after ApplyConfiguration), logging its generations to LOG
+void PrepareEvolution(TConfig &cfg, EvolutionRun &run, TEvolutionLog &log)
+{
+    std::string index = cfg.String("run.index", "");
     std::string fileIndex = "";  // Default empty string for file index
+    if (!index.empty()) fileIndex = "_" + index; // Append the index to the file name
 
-    if (argc > 1) {
-        randomseed += atoi(argv[1]);
-        fileIndex = "_" + std::string(argv[1]); // Append the index to the file name
-    }
+    long randomseed = static_cast<long>(time(NULL)) + atoi(index.c_str());
+    if (cfg.String("search.seed", "time") != "time")
+        randomseed = cfg.Integer("search.seed", 0);
 
-     if (argc > 2) {
-        N = atoi(argv[2]); // Convert the argument to an integer and assign it to N
-        VectSize = N*N + 2*N + NumSensors*N;
+    run.fitness = &FitnessFunctionByName(cfg.String("task.fitness", "resp"));
+    if (LOW_FIDELITY_FRACTION < 1.0 && run.fitness->lowFidelity == NULL) {
+        cerr << "Error: The " << run.fitness->name << " task has no low-fidelity version" << endl;
+        exit(0);
     }
+
       // Convert N to string
     std::string nStr = std::to_string(N);
 
@@ -860,62 +2230,81 @@ int main (int argc, const char* argv[])
     std::string genotypesDir = baseDir + "/Genotypes";
     std::string nervSystemsDir = baseDir + "/Nerv_Systems";
     std::string seedsDir = baseDir + "/Seeds";
+    std::string checkpointsDir = baseDir + "/Checkpoints";
 
     mkdir(evoDir.c_str(), 0777);
     mkdir(genotypesDir.c_str(), 0777);
     mkdir(nervSystemsDir.c_str(), 0777);
     mkdir(seedsDir.c_str(), 0777);
+    mkdir(checkpointsDir.c_str(), 0777);
 
 
-    TSearch s(VectSize);
-	
+    TSearch &s = *(run.search = new TSearch(VectSize));
+
+    // Checkpoint periodically, and pick up an interrupted run where it left off
+    s.SetCheckpointFileName(checkpointsDir + "/search" + fileIndex + "_N" + nStr + ".cpt");
+    s.SetCheckpointInterval(CHECKPOINT_INTERVAL);
+    s.SetAsyncCheckpointing(cfg.Flag("search.async_checkpoints", 1)); // Written in the background while the next generation evaluates
+    int resume = s.CheckpointAvailable();
+
+    // Record the configuration the run used
+    std::ofstream configfile((evoDir + "/config" + fileIndex + "_N" + nStr + ".ini").c_str());
+    cfg.WriteEffective(configfile);
+    configfile.close();
 
     #ifdef PRINTOFILE
-    std::ofstream file;
+    // Log the statistics of every generation (written to disk with each checkpoint)
     std::string filename = evoDir + "/evol" + fileIndex + "_N" + nStr + ".dat"; 
-    file.open(filename);
-    cout.rdbuf(file.rdbuf());
-
-    // Save the seed to a file
-    std::ofstream seedfile;
-    std::string seedfilename = seedsDir + "/seed"  + fileIndex + "_N" + nStr +".dat"; 
-    seedfile.open(seedfilename); 
-    seedfile << randomseed << std::endl;
-    seedfile.close();
-	
-	RandomState rs(randomseed); 
-
+    if (!log.Open(filename, resume)) {
+        cerr << "Error: Could not open the evolution log " << filename << endl;
+        exit(0);
+    }
+    s.SetEvolutionLog(&log);
+
+    // Save the seed to a file (a resumed run keeps the seed it started with)
+    if (!resume) {
+        std::ofstream seedfile;
+        std::string seedfilename = seedsDir + "/seed"  + fileIndex + "_N" + nStr +".dat"; 
+        seedfile.open(seedfilename); 
+        seedfile << randomseed << std::endl;
+        seedfile.close();
+    }
 	#endif
 	
 	// Configure the search
-	s.SetRandomSeed(randomseed);
-	s.SetSearchResultsDisplayFunction(ResultsDisplay);
-	s.SetPopulationStatisticsDisplayFunction(EvolutionaryRunDisplay);
-	s.SetSelectionMode(RANK_BASED);
-	s.SetReproductionMode(GENETIC_ALGORITHM);
-	s.SetPopulationSize(POPSIZE);
-	s.SetMaxGenerations(GENS);
-	s.SetCrossoverProbability(CROSSPROB);
-	s.SetCrossoverMode(UNIFORM);
-	s.SetMutationVariance(MUTVAR);
-	s.SetMaxExpectedOffspring(EXPECTED);
-	s.SetElitistFraction(ELITISM);
-	s.SetSearchConstraint(1);
-	
-	// s.SetSearchTerminationFunction(TerminationFunction);
-	// s.SetEvaluationFunction(FitnessFunctionChemoIndexResp);
-    // s.ExecuteSearch();
-
+	ConfigureSearch(s, randomseed);
+	// Fitness functions that run their trials in parallel evaluate one individual at a time
+	s.SetTrialParallelism(run.fitness->trialParallel);
+
+	run.fileIndex = fileIndex;
+	run.nStr = nStr;
+	run.genotypesDir = genotypesDir;
+	run.nervSystemsDir = nervSystemsDir;
+	run.evoDir = evoDir;
+	run.seed = randomseed;
+	run.resume = resume;
+}
 
-	// /* Stage 1 */ // 
-	// s.SetSearchTerminationFunction(TerminationFunctionFirst);
-	// s.SetEvaluationFunction(FitnessFunctionChemoIndex);
-    // s.ExecuteSearch();
-	// s.SetGeneration(0);
+// Run (or resume) the search of RUN, then save its best individual
+void RunEvolution(EvolutionRun &run)
+{
+	TSearch &s = *run.search;
+
+	/* Stage 1 */ // 
+	if (Stage1Gens > 0 && !run.resume) {
+		s.SetSearchTerminationFunction(TerminationFunctionFirst);
+		s.SetEvaluationFunction(FitnessFunctionChemoIndex);
+		s.SetLowFidelityFunction(NULL);
+		s.ExecuteSearch();
+		s.SetGeneration(0);
+	}
     	/* Stage 2 */ //
 	s.SetSearchTerminationFunction(TerminationFunction);
-	s.SetEvaluationFunction(FitnessFunctionChemoIndexResp); 
-	s.ExecuteSearch();
+	s.SetEvaluationFunction(run.fitness->function);
+	s.SetLowFidelityFunction(run.fitness->lowFidelity); 
+	if (run.resume) s.ResumeSearch();
+	else s.ExecuteSearch();
+	if (s.EvolutionLog() != NULL) s.EvolutionLog()->Close();
 
 
 
@@ -923,15 +2312,15 @@ int main (int argc, const char* argv[])
     TVector<double> bestVector;
 	ofstream BestIndividualFile;
 	TVector<double> phenotype;
-	phenotype.SetBounds(1, VectSize);
 
 	// Save the genotype of the best individual
 
     // Use the global index in file names
-    std::string bestGenFilename = genotypesDir + "/best.gen" + fileIndex + "_N" + nStr + ".dat";
-    std::string bestNsFilename = nervSystemsDir + "/best.ns" + fileIndex + "_N" + nStr + ".dat";
+    std::string bestGenFilename = run.genotypesDir + "/best.gen" + run.fileIndex + "_N" + run.nStr + ".dat";
+    std::string bestNsFilename = run.nervSystemsDir + "/best.ns" + run.fileIndex + "_N" + run.nStr + ".dat";
 
 	bestVector = s.BestIndividual();
+	phenotype.SetBounds(1, bestVector.Size());
 	BestIndividualFile.open(bestGenFilename);
 	BestIndividualFile << bestVector << endl;
 	BestIndividualFile.close();
@@ -939,6 +2328,7 @@ int main (int argc, const char* argv[])
 	// Also show the best individual in the Circuit Model form
 	BestIndividualFile.open(bestNsFilename);
 	GenPhenMapping(bestVector, phenotype);
+	int N = GenotypeNeurons(bestVector);
 	Sniffer Agent(N);
 
 	// Instantiate the nervous system
@@ -970,30 +2360,358 @@ int main (int argc, const char* argv[])
 	BestIndividualFile << Agent.sensorweights << "\n" << endl;
 	BestIndividualFile.close();
 
-// ================================================
-// B. MAIN FOR ANALYZING A SUCCESFUL CIRCUIT
-// ================================================
-// 	ifstream genefile;
-// 	genefile.open("/N/u/gjseveri/BigRed200/ActivePerceiver/OdorNav/N_4/Genotypes/best.gen_47_N4.dat");
-// 	TVector<double> genotype(1, VectSize);
-// 	genefile >> genotype;
-
-// 	// // //     agent x position, agent y position, Peak x position, Peak y position, steepness
-// 	// BehavioralTraces_Specific(genotype, 10.0, 10.0, 50.0, 50.0, 1.5);
-// 	//  BehavioralTraces_Across_Conditions(genotype, 1.5);
-// 	// // BehavioralTraces(genotype, 455.0, 2.5); 
+	// The search is complete and its results are saved, so its checkpoint is
+	// removed: running the same index again starts a new search
+	unlink(s.CheckpointFileName().c_str());
+}
 
+int Evolve(TConfig &cfg)
+{
+	EvolutionRun run;
+	PrepareEvolution(cfg, run, EvolutionLog);
+	run.search->SetSearchResultsDisplayFunction(ResultsDisplay);
+	run.search->SetPopulationStatisticsDisplayFunction(EvolutionaryRunDisplay);
+
+	#ifdef PROFILE_SEARCH
+	// Time the phases of each generation (and count hardware events if the kernel allows it)
+	SearchProfiler().SetHardwareCounters(1);
+	SearchProfiler().Open(run.evoDir + "/profile" + run.fileIndex + "_N" + run.nStr + ".dat");
+	#endif
+	RunEvolution(run);
+	#ifdef PROFILE_SEARCH
+	SearchProfiler().Close();
+	#endif
+	delete run.search;
+	return 0;
+}
 
-// PerformanceMap(genotype);
 
+// ------------------------------------
+// Batches
+// ------------------------------------
 
+// The settings that may differ between the jobs of a batch. The others
+// (the task, the thread count, ...) are process-wide and must agree.
+const char *BatchJobSettings[] = {
+	"run.index", "search.seed", "task.neurons", "task.fitness", "search.popsize", "search.generations",
+	"search.mutation_variance", "search.crossover_probability", "search.expected_offspring",
+	"search.elitism", "search.checkpoint_interval", "search.async_checkpoints", "search.reproduction",
+	"search.restarts", "search.cma_step_size", "search.max_restarts", "search.screen_candidates",
+	"search.honest_fraction", "search.surrogate_features", "search.surrogate_window", "search.common_trials",
+	"search.low_fidelity_fraction"
+};
+
+int IsBatchJobSetting(const string &key)
+{
+	for (size_t i = 0; i < sizeof(BatchJobSettings) / sizeof(BatchJobSettings[0]); i++)
+		if (key == BatchJobSettings[i]) return 1;
+	return 0;
+}
 
-// for (double sensorstate = 0.0; sensorstate <= 1.0; sensorstate += 0.1)
-	// {
-	// 	LimitSet(genotype,sensorstate);
-	// }
+// A job of a batch
+struct BatchJob {
+	TConfig cfg;
+	EvolutionRun run;
+	TEvolutionLog log;
+};
+
+// The jobs of the running batch and the next one to start
+struct BatchState {
+	vector<BatchJob *> *jobs;
+	std::atomic<int> next;
+	pthread_mutex_t outputLock;
+};
+
+void *BatchRunner(void *arg)
+{
+	BatchState *b = (BatchState *)arg;
+	int j;
+	while ((j = b->next++) < (int)b->jobs->size()) {
+		EvolutionRun &run = (*b->jobs)[j]->run;
+		RunEvolution(run);
+		pthread_mutex_lock(&b->outputLock);
+		cout << "Job " << j + 1 << " of " << b->jobs->size() << ": N " << run.nStr << ", seed " << run.seed
+		     << ", generation " << run.search->Generation() << ", best " << run.search->BestPerformance() << endl;
+		pthread_mutex_unlock(&b->outputLock);
+		delete run.search;
+	}
+	return NULL;
+}
 
+// Run the evolutionary searches of JOBS side by side, CONCURRENCY at a time
+// (0 for as many as there are threads). Each search's thread takes part in its
+// evaluations, so the pool gets the remaining threads, and every search draws
+// on it while the others sort, reproduce or wait for their stragglers.
+int EvolveBatch(vector<BatchJob *> &jobs, int concurrency)
+{
+	if (jobs.empty()) return 0;
+	map<string, int> outputs;   // The job writing each set of output files
+	for (size_t j = 0; j < jobs.size(); j++) {
+		TConfig &cfg = jobs[j]->cfg;
+		ApplyConfiguration(cfg);
+		PrepareEvolution(cfg, jobs[j]->run, jobs[j]->log);
+		jobs[j]->run.search->SetPopulationStatisticsDisplayFunction(QuietDisplay);
+		int &owner = outputs[jobs[j]->run.nStr + jobs[j]->run.fileIndex];
+		if (owner != 0) {
+			cerr << "Error: Batch jobs " << owner << " and " << j + 1 << " write the same files (give them different run.index)" << endl;
+			exit(0);
+		}
+		owner = j + 1;
+		const map<string, string> &settings = cfg.Used(), &first = jobs[0]->cfg.Used();
+		for (map<string, string>::const_iterator it = settings.begin(); it != settings.end(); ++it) {
+			map<string, string>::const_iterator f = first.find(it->first);
+			if (!IsBatchJobSetting(it->first) && f != first.end() && f->second != it->second) {
+				cerr << "Error: Batch job " << j + 1 << " sets " << it->first << " = " << it->second
+				     << " but job 1 sets it to " << f->second << " (only per-search settings may differ)" << endl;
+				exit(0);
+			}
+		}
+	}
+	#ifdef PROFILE_SEARCH
+	cerr << "Warning: The profiler does not separate the searches of a batch" << endl;
+	#endif
 
+	int threads = SharedThreadPool().ThreadCount();
+	if (concurrency <= 0 || concurrency > threads) concurrency = threads;
+	if (concurrency > (int)jobs.size()) concurrency = jobs.size();
+	SharedThreadPool().SetThreadCount(threads - concurrency + 1);
+
+	BatchState state;
+	state.jobs = &jobs;
+	state.next = 0;
+	pthread_mutex_init(&state.outputLock, NULL);
+	vector<pthread_t> runners(concurrency);
+	for (int i = 0; i < concurrency; i++) {
+		int rc = pthread_create(&runners[i], NULL, BatchRunner, (void *)&state);
+		if (rc) {cerr << "Thread creation failed: " << rc << endl; exit(-1);}
+	}
+	for (int i = 0; i < concurrency; i++)
+		pthread_join(runners[i], NULL);
+	pthread_mutex_destroy(&state.outputLock);
+	SharedThreadPool().SetThreadCount(threads);
 
+	for (size_t j = 0; j < jobs.size(); j++) jobs[j]->cfg.WarnUnused();
 	return 0;
 }
+
+
+// ------------------------------------
+// Experiments
+// ------------------------------------
+
+// Run the experiment selected by run.mode. Returns the exit status.
+int RunExperiment(TConfig &cfg)
+{
+	ApplyConfiguration(cfg);
+	string mode = cfg.String("run.mode", "evolve");
+	int status = 0;
+	if (mode == "evolve")
+		status = Evolve(cfg);
+	else if (mode == "check")
+		status = (DeterminismCheck() & TransientCacheCheck() & CMAESCheck() & ArenaCheck()) ? 0 : 1;
+	else if (mode == "bench") {
+		vector<string> items = cfg.List("bench.threads");
+		vector<int> threadCounts;
+		for (size_t i = 0; i < items.size(); i++) threadCounts.push_back(atoi(items[i].c_str()));
+		if (threadCounts.empty()) {
+			threadCounts.push_back(1);
+			int hardware = (int)std::thread::hardware_concurrency();
+			if (hardware > 1) threadCounts.push_back(hardware);
+		}
+		status = ThroughputBenchmark(threadCounts, cfg.Flag("bench.golden", 0)) ? 0 : 1;
+	}
+	else if (mode == "performance-map" || mode == "integrator" || mode == "select-step") {
+		TVector<double> genotype;
+		ReadGenotype(cfg.String("run.genotype", ""), genotype);
+		TIntegrator integrator = IntegratorByName(cfg.String("analysis.integrator", "exponential-euler"));
+		if (mode == "performance-map")
+			cout << "Average fitness " << PerformanceMap(genotype, cfg.String("run.output", "PerformanceMap.dat")) << endl;
+		else if (mode == "integrator")
+			IntegratorValidation(genotype, integrator, cfg.Real("analysis.step_size", 5 * StepSize));
+		else
+			cout << "Step size " << SelectIntegrationStepSize(genotype, integrator, cfg.Real("analysis.tolerance", 0.01)) << endl;
+	}
+	else if (mode == "trace" || mode == "trace-conditions" || mode == "trace-trials") {
+		TVector<double> genotype;
+		ReadGenotype(cfg.String("run.genotype", ""), genotype);
+		TTrajectoryFile file;
+		string output = cfg.String("trace.output", "Traces.trj");
+		if (!file.Open(output, TraceChannels(cfg), GenotypeNeurons(genotype))) {
+			cerr << "Error: Cannot create the trajectory file " << output << endl;
+			exit(0);
+		}
+		if (mode == "trace")
+			BehavioralTraces_Specific(genotype, cfg.Real("trace.start_x", 10), cfg.Real("trace.start_y", 10),
+			                          cfg.Real("trace.source_x", 50), cfg.Real("trace.source_y", 50),
+			                          cfg.Real("trace.steepness", 1.5), file);
+		else if (mode == "trace-conditions")
+			BehavioralTraces_Across_Conditions(genotype, cfg.Real("trace.steepness", 1.5), file,
+			                                   cfg.Integer("trace.sources", 6), cfg.Real("trace.radius", 25));
+		else
+			BehavioralTraces_Trials(genotype, file, cfg.Integer("trace.seed", 0), cfg.Integer("trace.repeats", 1));
+		file.Close();
+	}
+	else if (mode == "limit-set") {
+		TVector<double> genotype;
+		ReadGenotype(cfg.String("run.genotype", ""), genotype);
+		TLimitSetSettings settings;
+		settings.integrator = IntegratorByName(cfg.String("limitset.integrator", "rk4"));
+		settings.stepSize = cfg.Real("limitset.step_size", settings.stepSize);
+		settings.transient = cfg.Real("limitset.transient", settings.transient);
+		settings.window = cfg.Real("limitset.window", settings.window);
+		settings.tolerance = cfg.Real("limitset.tolerance", settings.tolerance);
+		settings.cycleTolerance = cfg.Real("limitset.cycle_tolerance", settings.cycleTolerance);
+		settings.newtonStarts = cfg.Integer("limitset.newton_starts", settings.newtonStarts);
+		settings.seed = cfg.Integer("limitset.seed", settings.seed);
+		LimitSet(genotype, SettingRange(cfg, "limitset.chemical"), SettingRange(cfg, "limitset.difference"),
+		         SettingRange(cfg, "limitset.o2"), SettingRange(cfg, "limitset.co2"), settings,
+		         cfg.String("limitset.output", "LimitSets.dat"), cfg.String("limitset.equilibria", "Equilibria.dat"));
+	}
+	else if (mode == "sensitivity") {
+		TVector<double> genotype;
+		ReadGenotype(cfg.String("run.genotype", ""), genotype);
+		string pairs = cfg.String("sensitivity.pairs", "all");
+		if (pairs != "all" && pairs != "neurons" && pairs != "none") {
+			cerr << "Error: sensitivity.pairs must be all, neurons or none" << endl;
+			exit(0);
+		}
+		double delta = cfg.Real("sensitivity.delta", 0.025);
+		if (delta <= 0) {
+			cerr << "Error: Invalid sensitivity delta " << delta << endl;
+			exit(0);
+		}
+		cout << "Intact fitness " << SensitivitySweep(genotype, pairs, delta,
+		        cfg.Integer("sensitivity.seed", 0), cfg.Integer("sensitivity.repeats", 1),
+		        cfg.String("sensitivity.output", "Sensitivity")) << endl;
+	}
+	else if (mode == "windows") {
+		TVector<double> genotype;
+		ReadGenotype(cfg.String("run.genotype", ""), genotype);
+		vector<string> items = cfg.List("windows.lengths");
+		vector<double> windows;
+		for (size_t i = 0; i < items.size(); i++) windows.push_back(atof(items[i].c_str()));
+		EvaluationWindows(genotype, windows, cfg.Integer("windows.seed", 0), cfg.Integer("windows.repeats", 1),
+		                  cfg.String("windows.output", "Windows.dat"));
+	}
+	else if (mode == "trace-text")
+		TraceText(cfg.String("trace.output", "Traces.trj"));
+	else if (mode == "precision") {
+		vector<string> files = cfg.List("run.genotypes");
+		vector<const char *> names;
+		for (size_t i = 0; i < files.size(); i++) names.push_back(files[i].c_str());
+		PrecisionValidation((int)names.size(), names.data());
+	}
+	else {
+		cerr << "Error: Unknown mode " << mode << endl;
+		exit(0);
+	}
+	cfg.WarnUnused();
+	return status;
+}
+
+
+// ------------------------------------
+// THE MAIN PROGRAM 
+// ------------------------------------
+//
+//   main [index] [N] [threads]         evolve (the index names the output files)
+//   main run [file.ini ...] [key=value ...]
+//                                      run one experiment per INI file (or one with
+//                                      the defaults), with the assignments applied
+//                                      to each; the thread pool is shared by all
+//   main batch [file.ini ...] [key=value ...]
+//                                      run the evolutionary searches of the INI files
+//                                      (each expanded over batch.seeds and
+//                                      batch.neurons) side by side in this process
+//   main defaults                      print the default configuration
+//   main check                         the determinism, transient cache, CMA-ES and arena checks
+//   main bench [golden] [threads ...]  the throughput benchmark
+int main (int argc, const char* argv[]) 
+{
+    string command = (argc > 1) ? argv[1] : "";
+
+    if (command == "defaults") {
+        cout << DefaultConfiguration();
+        return 0;
+    }
+
+    // Positional and shorthand forms are translated into assignments
+    vector<string> files, assignments;
+    if (command == "run" || command == "batch") {
+        for (int i = 2; i < argc; i++) {
+            if (std::string(argv[i]).find('=') != string::npos) assignments.push_back(argv[i]);
+            else files.push_back(argv[i]);
+        }
+    }
+    else if (command == "check")
+        assignments.push_back("run.mode=check");
+    else if (command == "bench") {
+        assignments.push_back("run.mode=bench");
+        string threads;
+        for (int i = 2; i < argc; i++) {
+            if (std::string(argv[i]) == "golden") assignments.push_back("bench.golden=true");
+            else threads += std::string(argv[i]) + " ";
+        }
+        assignments.push_back("bench.threads=" + threads);
+    }
+    else {
+        if (argc > 1) assignments.push_back("run.index=" + std::string(argv[1]));
+        if (argc > 2) assignments.push_back("task.neurons=" + std::string(argv[2]));
+        if (argc > 3) assignments.push_back("search.threads=" + std::string(argv[3])); // The number of evaluation threads
+    }
+
+    // One experiment per configuration file, all in this process
+    if (files.empty()) files.push_back("");
+    int status = 0, concurrency = 0;
+    vector<BatchJob *> jobs;
+    for (size_t f = 0; f < files.size(); f++) {
+        TConfig cfg;
+        istringstream defaults(DefaultConfiguration());
+        cfg.Read(defaults, "defaults");
+        cfg.MarkDefaults();
+        if (!files[f].empty() && !cfg.ReadFile(files[f])) {
+            cerr << "Error: Cannot open configuration file " << files[f] << endl;
+            exit(0);
+        }
+        for (size_t i = 0; i < assignments.size(); i++) cfg.SetAssignment(assignments[i]);
+        if (command != "batch") {
+            int result = RunExperiment(cfg);
+            if (result != 0) status = result;
+            continue;
+        }
+        // A batch job for each seed and size (the seed also names the files)
+        vector<string> seeds = cfg.List("batch.seeds"), sizes = cfg.List("batch.neurons");
+        if (seeds.empty()) seeds.push_back("");
+        if (sizes.empty()) sizes.push_back("");
+        concurrency = cfg.Integer("batch.concurrency", 0);
+        for (size_t i = 0; i < seeds.size(); i++)
+            for (size_t j = 0; j < sizes.size(); j++) {
+                BatchJob *job = new BatchJob;
+                job->cfg = cfg;
+                if (!seeds[i].empty()) {
+                    job->cfg.Set("search.seed", seeds[i]);
+                    job->cfg.Set("run.index", seeds[i]);
+                }
+                if (!sizes[j].empty()) job->cfg.Set("task.neurons", sizes[j]);
+                jobs.push_back(job);
+            }
+    }
+    if (command == "batch") {
+        status = EvolveBatch(jobs, concurrency);
+        for (size_t j = 0; j < jobs.size(); j++) delete jobs[j];
+    }
+    return status;
+
+// ================================================
+// B. MAIN FOR ANALYZING A SUCCESFUL CIRCUIT
+// ================================================
+// 	ifstream genefile;
+// 	genefile.open("/N/u/gjseveri/BigRed200/ActivePerceiver/OdorNav/N_4/Genotypes/best.gen_47_N4.dat");
+// 	TVector<double> genotype(1, VectSize);
+// 	genefile >> genotype;
+
+// // The performance map, integrator checks, precision validation, behavioral
+// // traces, limit sets and lesions are run with run.mode = performance-map,
+// // integrator, select-step, precision, trace, trace-conditions, trace-trials,
+// // limit-set or sensitivity
+}
@@ -21,9 +21,9 @@ RandomState GRS;
 void SetRandomSeed(long seed) {GRS.SetRandomSeed(seed);};
 long GetRandomSeed(void) {return GRS.GetRandomSeed();};
 void WriteRandomState(ostream& os) {GRS.WriteRandomState(os);};
-void BinaryWriteRandomState(ofstream& bofs) {GRS.BinaryWriteRandomState(bofs);};
+void BinaryWriteRandomState(ostream& bofs) {GRS.BinaryWriteRandomState(bofs);};
 void ReadRandomState(istream& is) {GRS.ReadRandomState(is);};
-void BinaryReadRandomState(ifstream& bifs) {GRS.BinaryReadRandomState(bifs);};
+void BinaryReadRandomState(istream& bifs) {GRS.BinaryReadRandomState(bifs);};
 double UniformRandom(double min,double max) { return GRS.UniformRandom(min, max);};
 int UniformRandomInteger(int min,int max) {return GRS.UniformRandomInteger(min, max);};
 double GaussianRandom(double mean, double variance) {return GRS.GaussianRandom(mean, variance);};
@@ -76,7 +76,7 @@ long RandomState::GetRandomSeed(void)
 
 // Write a random state to a stream
 
-void RandomState::BinaryWriteRandomState (ofstream& bosf)
+void RandomState::BinaryWriteRandomState (ostream& bosf)
 {
   bosf.write((const char*) &(seed), sizeof(seed));
   bosf.write((const char*) &(idum), sizeof(idum));
@@ -112,7 +112,7 @@ void RandomState::ReadRandomState(istream& is)
 		is >> iv[i];
 }
 
-void RandomState::BinaryReadRandomState (ifstream& bisf)
+void RandomState::BinaryReadRandomState (istream& bisf)
 {
   bisf.read((char*) &(seed), sizeof(seed));
   bisf.read((char*) &(idum), sizeof(idum));
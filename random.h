@@ -29,9 +29,9 @@ using namespace std;
 void SetRandomSeed(long seed);
 long GetRandomSeed(void);
 void WriteRandomState(ostream& os);
-void BinaryWriteRandomState(ofstream& bofs);
+void BinaryWriteRandomState(ostream& bofs);
 void ReadRandomState(istream& is);
-void BinaryReadRandomState(ifstream& bifs);
+void BinaryReadRandomState(istream& bifs);
 double UniformRandom(double min,double max);
 int UniformRandomInteger(int min,int max);
 double GaussianRandom(double mean, double variance);
@@ -65,9 +65,9 @@ public:
   
   // Input/Output 
   void WriteRandomState(ostream& os);
-  void BinaryWriteRandomState(ofstream& bofs);
+  void BinaryWriteRandomState(ostream& bofs);
   void ReadRandomState(istream& is);
-  void BinaryReadRandomState(ifstream& bifs);
+  void BinaryReadRandomState(istream& bifs);
   
 
   long seed, idum, iy, iv[NTAB];